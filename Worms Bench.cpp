@@ -0,0 +1,1158 @@
+/*
+* "WORMS" - Benchmarks
+*
+* Mesure les noyaux du jeu un par un : physique, terrain, rendu, mixage audio
+* et entres.
+* Le moteur tourne sans fentre (mode OLC_HEADLESS, par dfaut hors Windows)
+* et les rsultats sont crits en JSON, au format de Google Benchmark,
+* pour pouvoir suivre les rgressions d'un commit  l'autre.
+*
+* Le macro-benchmark BM_Match joue des parties compltes, toutes les quipes
+* aux mains de l'IA, sans rendu, avec une graine et un pas de temps fixes.
+*
+*   g++ -std=c++17 -O2 "Worms Bench.cpp" -o worms_bench -pthread
+*   ./worms_bench [--filter=Boom] [--min_time=0.2] [--out=bench.json]
+*                 [--matches=3] [--seed=1] [--dt=0.002]
+*                 [--teams=16] [--worms=16] [--map_width=4096] [--map_height=512]
+*                 [--wav=partie.wav] [--save_replay=partie.rpl] [--replay=partie.rpl] [--ai_plan]
+*                 [--map=carte.pbm] [--physics=distance|swept|fixed] [--no_object_collisions]
+*
+* BM_Replay rejoue la dernire partie de BM_Match (ou un replay envoy avec un
+* rapport de bug, --replay) et vrifie qu'elle se droule  l'identique.
+*
+* Par dfaut l'IA des parties vise comme avant (au hasard, en balistique) ; avec
+* --ai_plan, elle planifie ses tirs (BM_Match/.../plan).
+*
+* Avec --map, les parties et les mesures de physique et de rendu se font sur une
+* map dessine (masque PBM, voir cBitmapTerrain) au lieu de la map de bruit.
+*
+* Les collisions se font par dfaut dans le champ de distance de la map, en pas de
+* physique longs ; --physics=swept les fait avec la sonde promene le long du
+* dplacement (BM_Match/.../swept), --physics=fixed avec les 10 pas fixes par
+* frame d'avant (BM_Match/.../fixed). Avec --no_object_collisions, les objets des
+* parties se traversent (BM_Match/.../passthrough) ; --fixed_steps rejoue ainsi les
+* parties exactement comme avant ces deux changements.
+*
+* BM_Barrage lche cent missiles d'un coup et note la frame la plus lente, avec
+* des particules pour dbris, puis avec des dbris objets, selon le budget
+* d'objets des parties (--object_budget=, 0 : sans limite) puis sans.
+* --debris_objects fait jouer les parties avec des dbris objets, comme avant
+* les particules (BM_Match/.../debris_objects).
+*
+* BM_StreamTerrain parcourt une map de 65536x4096, gnre tuile par tuile  la
+* demande, avec un budget de tuiles en mmoire volontairement petit.
+*/
+
+#define WORMS_NO_MAIN
+#include "Worms Pixel.cpp"
+#include <ctime>
+#include <functional>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+
+struct sBenchResult
+{
+    string sName;
+    long long nIterations = 0;
+    double fRealTime = 0.0;     // ns par itration
+    double fCpuTime = 0.0;      // ns par itration
+    double fItemsPerSecond = 0.0;
+    vector<pair<string, double>> vecCounters; // Compteurs propres au benchmark
+};
+
+// Pic de mmoire rsidente du processus, en octets
+static double PeakRSS()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_maxrss * 1024.0; // Linux : en Ko
+#else
+    return 0.0;
+#endif
+}
+
+// Accde aux entrailles de Worms (classe amie)
+struct sWormsBench
+{
+    Worms game;
+    vector<sBenchResult> vecResults;
+    string sFilter;
+    double fMinTime = 0.2;
+
+    int nMatches = 1;
+    unsigned int nSeed = 1;
+    float fMatchElapsedTime = 0.002f;   // Assez petit pour que l'IA vise juste (pas de 1/s)
+    wstring sMatchWavFile;              // Si non vide, le son de la premire partie y est enregistr
+    int nMatchTeams = 4;
+    int nMatchWormsPerTeam = 3;
+    int nMatchMapWidth = 1024;
+    int nMatchMapHeight = 512;
+    wstring sSaveReplayFile;            // Si non vide, le replay de la premire partie y est sauv
+    wstring sReplayFile;                // Replay  rejouer par BM_Replay, au lieu de la dernire partie
+    bool bMatchAIPlanning = false;      // L'IA des parties planifie ses tirs
+    Worms::PHYSICS nMatchPhysics = Worms::PHYSICS_DISTANCE;  // La dtection des collisions des parties
+    bool bMatchObjectCollisions = true; // Les objets des parties se heurtent entre eux
+    int nMatchWeapon = 0;               // L'arme que tire l'IA des parties (0 : la premire)
+    bool bMatchForces = true;           // Le vent et la trane dans les parties
+    uint32_t nMatchObjectBudget = 1024; // Objets en vie au-del desquels les explosions lancent moins de dbris
+    bool bMatchParticles = true;        // Les dbris des parties sont des particules, pas des objets
+
+    sWormsBench()
+    {
+        game.ConstructConsole(256, 160, 6, 6);
+        game.OnUserCreate();
+        cRandom::Seed(1);
+        game.CreateMap();
+    }
+
+    // Vide la partie de ses objets, sans laisser la camra, le worm contrl ou la
+    // cible de l'IA pointer vers l'un d'eux
+    void ClearObjects()
+    {
+        game.listObjects.clear();
+        game.pObjectUnderControl = game.pCameraTrackingObject = game.pAITargetWorm = nullptr;
+    }
+
+    // Remplace les objets de la partie par nWorms worms puis nDebris dbris, sems au
+    // hasard (toujours le mme) sur toute la map. Les dbris restent en vie quoi qu'il arrive
+    void SpawnDebris(int nDebris, int nWorms = 0)
+    {
+        srand(2);
+        cRandom::Seed(2);
+        ClearObjects();
+        for (int i = 0; i < nWorms + nDebris; i++)
+        {
+            float x = (float)(rand() % game.nMapWidth);
+            float y = (float)(rand() % game.nMapHeight);
+            if (i < nWorms)
+                game.listObjects.push_back(unique_ptr<cWorm>(new cWorm(x, y)));
+            else
+            {
+                cDebris* d = new cDebris(x, y);
+                d->nBounceBeforeDeath = -1;
+                game.listObjects.push_back(unique_ptr<cDebris>(d));
+            }
+        }
+    }
+
+    // Rpte fn par lots de plus en plus gros jusqu' dpasser fMinTime secondes.
+    // nItems : nombre d'lments traits par itration (objets, pixels...)
+    void Run(const string& sName, const function<void()>& fn, long long nItems = 0)
+    {
+        if (!sFilter.empty() && sName.find(sFilter) == string::npos)
+            return;
+
+        fn(); // Echauffement
+
+        long long nIterations = 1;
+        while (true)
+        {
+            clock_t c1 = clock();
+            auto t1 = chrono::steady_clock::now();
+            for (long long i = 0; i < nIterations; i++)
+                fn();
+            auto t2 = chrono::steady_clock::now();
+            clock_t c2 = clock();
+
+            double fSeconds = chrono::duration<double>(t2 - t1).count();
+            if (fSeconds >= fMinTime || nIterations >= (1LL << 40))
+            {
+                sBenchResult r;
+                r.sName = sName;
+                r.nIterations = nIterations;
+                r.fRealTime = fSeconds * 1e9 / (double)nIterations;
+                r.fCpuTime = (double)(c2 - c1) / CLOCKS_PER_SEC * 1e9 / (double)nIterations;
+                if (nItems > 0)
+                    r.fItemsPerSecond = (double)nItems * (double)nIterations / fSeconds;
+                vecResults.push_back(r);
+                fprintf(stderr, "%-40s %14.0f ns %12lld\n", sName.c_str(), r.fRealTime, nIterations);
+                return;
+            }
+
+            // Vise directement la dure voulue, sans exploser d'un coup
+            double fScale = fSeconds > 0.0 ? (fMinTime * 1.4) / fSeconds : 10.0;
+            if (fScale > 10.0) fScale = 10.0;
+            if (fScale < 2.0) fScale = 2.0;
+            nIterations = (long long)(nIterations * fScale);
+        }
+    }
+
+    // Les parties et les mesures se feront sur cette map dessine,  sa taille
+    bool LoadMapFile(const string& sFile)
+    {
+        if (!game.LoadMapFile(wstring(sFile.begin(), sFile.end())))
+            return false;
+        nMatchMapWidth = game.nMapWidth;
+        nMatchMapHeight = game.nMapHeight;
+        game.CreateMap();
+        return true;
+    }
+
+    // La dtection des collisions des parties, par son nom
+    bool SetPhysics(const string& sPhysics)
+    {
+        if (sPhysics == "distance") nMatchPhysics = Worms::PHYSICS_DISTANCE;
+        else if (sPhysics == "swept") nMatchPhysics = Worms::PHYSICS_SWEPT;
+        else if (sPhysics == "fixed") nMatchPhysics = Worms::PHYSICS_FIXED;
+        else return false;
+        return true;
+    }
+
+    // Les armes des parties, lues dans un fichier comme armes.txt
+    bool LoadWeapons(const string& sFile)
+    {
+        nMatchWeapon = 0;
+        return game.LoadWeapons(wstring(sFile.begin(), sFile.end()));
+    }
+
+    // L'arme tire dans les parties, par son nom
+    bool SetWeapon(const string& sName)
+    {
+        nMatchWeapon = game.weapons.Find(sName);
+        if (nMatchWeapon >= 0)
+            return true;
+        nMatchWeapon = 0;
+        return false;
+    }
+
+    // Ralloue la map  une autre taille
+    void ResizeMap(int nWidth, int nHeight)
+    {
+        game.nMapWidth = nWidth;
+        game.nMapHeight = nHeight;
+        game.terrain.Create(nWidth, nHeight);
+    }
+
+    void BenchPhysics()
+    {
+        // Une itration de physique selon le nombre d'objets : avec la sonde de collision
+        // en demi-cercle, puis avec le champ de distance. Sans vent (la dernire partie a pu en laisser)
+        Worms::PHYSICS nPhysics = game.nPhysics;
+        game.forces = sForces();
+        for (int nObjects : { 16, 128, 1024, 8192 })
+            for (Worms::PHYSICS n : { Worms::PHYSICS_SWEPT, Worms::PHYSICS_DISTANCE })
+        {
+            SpawnDebris(nObjects);
+            game.nPhysics = n;
+            size_t nResults = vecResults.size();
+            Run(string(n == Worms::PHYSICS_SWEPT ? "BM_CollisionProbe/" : "BM_CollisionField/") + to_string(nObjects),
+                [&]() { game.PhysicsStep(0.016f); }, nObjects);
+            if (n == Worms::PHYSICS_DISTANCE && vecResults.size() > nResults)
+                vecResults.back().vecCounters.push_back({ "field_bytes", (double)game.terrain.field.Bytes() });
+        }
+        game.nPhysics = nPhysics;
+
+        // Les chocs entre objets : 256 worms au milieu des dbris
+        for (int nObjects : { 1024, 8192 })
+        {
+            SpawnDebris(nObjects, 256);
+            Run("BM_ObjectCollisions/" + to_string(nObjects), [&]() { game.PhysicsStep(0.016f); }, nObjects + 256);
+        }
+
+        // L'air seul, sur des dbris en plein vol : le vent, puis le vent et 16 souffles
+        for (int nBlasts : { 0, 16 })
+        {
+            SpawnDebris(8192);
+            game.forces.fWind = 5.0f;
+            for (int i = 0; i < nBlasts; i++)
+                game.forces.AddBlast((float)(rand() % game.nMapWidth), (float)(rand() % game.nMapHeight), 20.0f, 40.0f, 1.0e9f);
+            Run(string("BM_AirForces/8192") + (nBlasts > 0 ? "/Blasts" : ""), [&]()
+                {
+                    for (auto& p : game.listObjects)
+                        game.forces.Acceleration(p->px, p->py, p->vx, p->vy, p->fDrag, p->ax, p->ay);
+                }, 8192);
+        }
+        game.forces = sForces();
+        ClearObjects();
+
+        // Les particules : 16384 en vol, tires d'explosions partout sur la map, au vent.
+        // Un pas, puis leur trac
+        {
+            cRandom::Seed(1);
+            game.CreateMap();
+            srand(2);
+            game.forces.fWind = 5.0f;
+            auto Fill = [&]()
+                {
+                    game.particles.Clear();
+                    while (game.particles.Size() < cParticles::nCapacity)
+                        game.particles.Explosion((float)(rand() % game.nMapWidth), (float)(rand() % (game.nMapHeight / 2)), 20.0f);
+                };
+            Fill();
+            long long nSteps = 0;
+            Run("BM_Particles/16384", [&]()
+                {
+                    // Sans les laisser s'teindre : l'anneau reste plein
+                    if (++nSteps % 32 == 0)
+                        Fill();
+                    game.particles.Update(game.terrain, 0.16f, game.forces);
+                }, cParticles::nCapacity);
+            Fill();
+            game.fCameraPosX = 0.0f;
+            game.fCameraPosY = 0.0f;
+            Run("BM_DrawParticles/16384", [&]() { game.particles.Draw(&game, 0.0f, 0.0f, (float)game.ScreenWidth() / game.nMapWidth,
+                (float)game.ScreenHeight() / game.nMapHeight); }, cParticles::nCapacity);
+            game.particles.Clear();
+            game.forces = sForces();
+        }
+
+        // Cratres : terrain neuf pour chaque rayon, les dbris sont jets  chaque itration
+        for (int nRadius : { 5, 10, 20, 50, 128, 256 })
+        {
+            cRandom::Seed(1);
+            game.CreateMap();
+            Run("BM_Boom/" + to_string(nRadius), [&]()
+                {
+                    game.Boom(game.nMapWidth / 2.0f, game.nMapHeight * 0.75f, (float)nRadius);
+                    ClearObjects();
+                });
+        }
+    }
+
+    // Cent missiles lchs d'un coup sur toute la largeur de la map, jous frame par
+    // frame jusqu'au dernier objet : la frame la plus lente doit tenir dans le budget
+    // d'une frame. Avec des particules pour dbris, puis avec des dbris objets, avec
+    // le budget d'objets des parties et sans
+    void BenchBarrage()
+    {
+        const int nMissiles = 100;
+        const float fElapsedTime = 1.0f / 60.0f;
+        uint32_t nBudget = game.nObjectBudget;
+        bool bParticles = game.bParticles;
+        vector<pair<bool, uint32_t>> vecRuns = { { true, nMatchObjectBudget }, { false, nMatchObjectBudget } };
+        if (nMatchObjectBudget != 0)
+            vecRuns.push_back({ false, 0 });
+        for (auto& run : vecRuns)
+        {
+            string sName = "BM_Barrage/" + to_string(nMissiles) + (run.first ? "" : "/Objects") + (run.second == 0 ? "/Unbounded" : "");
+            if (!sFilter.empty() && sName.find(sFilter) == string::npos)
+                continue;
+
+            cRandom::Seed(1);
+            game.CreateMap();
+            ClearObjects();
+            game.particles.Clear();
+            game.forces = sForces();
+            game.bParticles = run.first;
+            game.nObjectBudget = run.second;
+            for (int i = 0; i < nMissiles; i++)
+            {
+                float x = (i + 0.5f) * game.nMapWidth / nMissiles;
+                game.listObjects.push_back(unique_ptr<cMissile>(new cMissile(x, 0.0f, 0.0f, 20.0f)));
+            }
+
+            // Une frame du jeu : les pas de physique de UpdateSimulation
+            int nSteps = game.PhysicsStepsPerFrame(fElapsedTime);
+            long long nFrames = 0;
+            double fSeconds = 0.0, fWorst = 0.0;
+            size_t nPeakObjects = 0, nPeakParticles = 0;
+            clock_t c1 = clock();
+            while (!game.listObjects.empty() && nFrames < 100000)
+            {
+                auto t1 = chrono::steady_clock::now();
+                for (int z = 0; z < nSteps; z++)
+                    game.PhysicsStep(10.0f * fElapsedTime / nSteps);
+                game.particles.Update(game.terrain, 10.0f * fElapsedTime, game.forces);
+                auto t2 = chrono::steady_clock::now();
+                double f = chrono::duration<double>(t2 - t1).count();
+                fSeconds += f;
+                fWorst = max(fWorst, f);
+                nPeakObjects = max(nPeakObjects, game.listObjects.size());
+                nPeakParticles = max(nPeakParticles, (size_t)game.particles.Size());
+                nFrames++;
+            }
+            clock_t c2 = clock();
+
+            sBenchResult r;
+            r.sName = sName;
+            r.nIterations = nFrames;
+            r.fRealTime = fSeconds * 1e9 / nFrames;
+            r.fCpuTime = (double)(c2 - c1) / CLOCKS_PER_SEC * 1e9 / nFrames;
+            r.vecCounters.push_back({ "worst_frame_ns", fWorst * 1e9 });
+            r.vecCounters.push_back({ "peak_objects", (double)nPeakObjects });
+            r.vecCounters.push_back({ "peak_particles", (double)nPeakParticles });
+            vecResults.push_back(r);
+            fprintf(stderr, "%-40s %14.0f ns %12lld  pire frame %.2f ms, %zu objets, %zu particules\n", sName.c_str(), r.fRealTime, nFrames,
+                fWorst * 1e3, nPeakObjects, nPeakParticles);
+        }
+        game.nObjectBudget = nBudget;
+        game.bParticles = bParticles;
+        ClearObjects();
+        game.particles.Clear();
+        cRandom::Seed(1);
+        game.CreateMap();
+    }
+
+    void BenchTerrain()
+    {
+        // Le bruit, mme si les parties se jouent sur une map dessine (--map)
+        bool bMapFile = game.bMapFile;
+        game.bMapFile = false;
+
+        for (auto size : vector<pair<int, int>>{ { 256, 128 }, { 1024, 512 }, { 4096, 1024 } })
+        {
+            ResizeMap(size.first, size.second);
+            size_t nResults = vecResults.size();
+            Run("BM_CreateMap/" + to_string(size.first) + "x" + to_string(size.second),
+                [&]() { game.CreateMap(); }, (long long)size.first * size.second);
+
+            // Ce que cote la map en tuiles, face au tableau plat d'une case par pixel
+            if (vecResults.size() > nResults)
+            {
+                vecResults.back().vecCounters.push_back({ "tiles", (double)game.terrain.nTilesX * game.terrain.nTilesY });
+                vecResults.back().vecCounters.push_back({ "uniform_tiles", (double)game.terrain.UniformTiles() });
+                vecResults.back().vecCounters.push_back({ "cell_bytes", (double)game.terrain.CellBytes() });
+                vecResults.back().vecCounters.push_back({ "flat_bytes", (double)size.first * size.second });
+            }
+        }
+
+        // La mme map, sauve puis recharge d'un fichier : projet en mmoire,
+        // il n'est lu que l o la premire vue en a besoin
+        const wstring sFile = L"worms_bench.pbm";
+        if (cBitmapTerrain::SaveMask(sFile, game.terrain, game.nMapWidth, game.nMapHeight))
+        {
+            cBitmapTerrain bitmap;
+            Run("BM_CreateMap/" + to_string(game.nMapWidth) + "x" + to_string(game.nMapHeight) + "/File", [&]()
+                {
+                    bitmap.Open(sFile);
+                    game.terrain.Create(bitmap.nWidth, bitmap.nHeight, &bitmap, true);
+                    game.DrawTerrain();
+                }, (long long)game.nMapWidth * game.nMapHeight);
+            game.terrain.Create(game.nMapWidth, game.nMapHeight);
+            remove(string(sFile.begin(), sFile.end()).c_str());
+        }
+
+        game.bMapFile = bMapFile;
+        ResizeMap(1024, 512);
+        cRandom::Seed(1);
+        game.CreateMap();
+
+        for (int nCount : { 256, 1024, 4096, 65536 })
+        {
+            vector<float> vecSeed(nCount), vecOutput(nCount);
+            for (auto& f : vecSeed) f = (float)rand() / (float)RAND_MAX;
+            Run("BM_PerlinNoise1D/" + to_string(nCount),
+                [&]() { game.PerlinNoise1D(nCount, vecSeed.data(), 8, 2.0f, vecOutput.data()); }, nCount);
+        }
+    }
+
+    // Une map trop grande pour tenir en mmoire case par case : les tuiles sont
+    // faites  la demande, et Evict range les plus anciennes
+    void BenchStreaming()
+    {
+        const int nWidth = 65536, nHeight = 4096;
+        bool bMapFile = game.bMapFile;
+        game.bMapFile = false;
+        ResizeMap(nWidth, nHeight);
+        cRandom::Seed(1);
+        Run("BM_CreateMap/" + to_string(nWidth) + "x" + to_string(nHeight) + "/Lazy",
+            [&]() { game.CreateMap(); }, (long long)nWidth * nHeight);
+
+        size_t nMaxLoadedTiles = game.terrain.nMaxLoadedTiles;
+        game.terrain.nMaxLoadedTiles = 256;
+        size_t nPeakTiles = 0;
+        auto AddCounters = [&]()
+        {
+            if (!vecResults.empty() && vecResults.back().sName.rfind("BM_StreamTerrain", 0) == 0)
+            {
+                vecResults.back().vecCounters.push_back({ "loaded_tiles", (double)nPeakTiles });
+                vecResults.back().vecCounters.push_back({ "cell_bytes", (double)game.terrain.CellBytes() });
+            }
+        };
+
+        // La camra balaie la map de gauche  droite, au ras du sol
+        long long nCells = (long long)game.ScreenWidth() * game.ScreenHeight();
+        cRandom::Seed(1);
+        game.CreateMap();
+        game.bZoomOut = false;
+        game.fCameraPosX = 0.0f;
+        Run("BM_StreamTerrain/Scroll", [&]()
+            {
+                game.fCameraPosX += 8.0f;
+                if (game.fCameraPosX >= nWidth - game.ScreenWidth())
+                    game.fCameraPosX = 0.0f;
+                game.fCameraPosY = game.noise.vecSurface[(int)game.fCameraPosX] * nHeight - game.ScreenHeight() / 2;
+                game.fCameraPosY = min(max(game.fCameraPosY, 0.0f), (float)(nHeight - game.ScreenHeight()));
+                game.DrawTerrain();
+                game.terrain.Evict();
+                nPeakTiles = max(nPeakTiles, game.terrain.LoadedTiles());
+            }, nCells);
+        AddCounters();
+
+        // Des missiles tirs de loin, qui traversent la map et creusent en tombant
+        nPeakTiles = 0;
+        cRandom::Seed(1);
+        game.CreateMap();
+        srand(3);
+        Run("BM_StreamTerrain/Missile", [&]()
+            {
+                bool bMissile = false;
+                for (auto& p : game.listObjects)
+                    bMissile |= dynamic_cast<cMissile*>(p.get()) != nullptr;
+                if (!bMissile)
+                    game.listObjects.push_back(unique_ptr<cMissile>(new cMissile((float)(rand() % nWidth), 0.0f,
+                        (rand() % 2 ? 1.0f : -1.0f) * 300.0f, 0.0f)));
+                for (int i = 0; i < 10; i++)
+                    game.PhysicsStep(0.002f);
+                game.listObjects.remove_if([](unique_ptr<cPhysicsObject>& o) { return o->bDead; });
+                game.terrain.Evict();
+                nPeakTiles = max(nPeakTiles, game.terrain.LoadedTiles());
+            });
+        AddCounters();
+        ClearObjects();
+
+        game.terrain.nMaxLoadedTiles = nMaxLoadedTiles;
+        game.bMapFile = bMapFile;
+        ResizeMap(1024, 512);
+        cRandom::Seed(1);
+        game.CreateMap();
+    }
+
+    void BenchRender()
+    {
+        long long nCells = (long long)game.ScreenWidth() * game.ScreenHeight();
+
+        game.fCameraPosX = 300.0f;
+        game.fCameraPosY = 200.0f;
+        game.bZoomOut = false;
+        Run("BM_DrawTerrain/ZoomIn", [&]() { game.DrawTerrain(); }, nCells);
+        game.bZoomOut = true;
+        Run("BM_DrawTerrain/ZoomOut", [&]() { game.DrawTerrain(); }, nCells);
+        game.bZoomOut = false;
+
+        // La scne entire : dessine d'un bloc, puis par calques quand rien ne bouge
+        // (l'cran n'est pas touch), quand la camra bouge (tout se redessine) et
+        // quand seul un worm bouge (copie du terrain gard). Le premier worm vise
+        ClearObjects();
+        for (int i = 0; i < 12; i++)
+            game.listObjects.push_back(unique_ptr<cWorm>(new cWorm(320.0f + i * 16.0f, 240.0f)));
+        game.pObjectUnderControl = game.listObjects.front().get();
+        game.fEnergyLevel = 0.5f;
+        game.bLayers = false;
+        Run("BM_DrawScene/Direct", [&]() { game.DrawScene(); }, nCells);
+        game.bLayers = true;
+        Run("BM_DrawScene/Layers/Static", [&]() { game.DrawScene(); }, nCells);
+        Run("BM_DrawScene/Layers/Moving", [&]()
+            {
+                game.fCameraPosX = game.fCameraPosX == 300.0f ? 301.0f : 300.0f;
+                game.DrawScene();
+            }, nCells);
+        game.fCameraPosX = 300.0f;
+        Run("BM_DrawScene/Layers/Objects", [&]()
+            {
+                cPhysicsObject* p = game.listObjects.front().get();
+                p->px = p->px == 320.0f ? 321.0f : 320.0f;
+                game.DrawScene();
+            }, nCells);
+        game.fEnergyLevel = 0.0f;
+
+        // Des dbris sur toute la map : seuls ceux de la vue de la camra sont dessins
+        SpawnDebris(8192);
+        Run("BM_DrawObjects/8192", [&]() { game.DrawObjects(); }, 8192);
+        ClearObjects();
+
+        // L'interface seule, compteur  deux chiffres compris
+        game.bShowCountDown = true;
+        game.fTurnTime = 12.5f;
+        Run("BM_DrawHUD/CountDown", [&]() { game.DrawHUD(); });
+        game.bShowCountDown = false;
+        game.fTurnTime = 0.0f;
+
+        vector<pair<float, float>> vecMissile = DefineMissile();
+        vector<pair<float, float>> vecDebris = DefineDebris();
+        float fAngle = 0.0f;
+        Run("BM_DrawWireFrameModel/Missile", [&]()
+            {
+                fAngle += 0.01f;
+                game.DrawWireFrameModel(vecMissile, 128.0f, 80.0f, fAngle, 2.5f, FG_BLACK);
+            });
+        Run("BM_DrawWireFrameModel/Debris", [&]()
+            {
+                fAngle += 0.01f;
+                game.DrawWireFrameModel(vecDebris, 128.0f, 80.0f, fAngle, 1.0f, FG_DARK_GREEN);
+            });
+
+        // Les dbris d'une grosse explosion, en un seul appel
+        vector<olcConsoleGameEngine::sWireFrameInstance> vecInstances(256);
+        for (size_t i = 0; i < vecInstances.size(); i++)
+            vecInstances[i] = { (float)(i % 32) * 8.0f, (float)(i / 32) * 20.0f, (float)i * 0.1f, 1.0f };
+        Run("BM_DrawWireFrameModels/Debris/256", [&]()
+            {
+                game.DrawWireFrameModels(vecDebris, vecInstances, FG_DARK_GREEN);
+            }, (long long)vecInstances.size());
+
+        // Un sprite synthtique aux proportions de worms1.spr (8x8 par worm, 3/4 opaque)
+        olcSprite spr(64, 16);
+        for (int x = 0; x < 64; x++)
+            for (int y = 0; y < 16; y++)
+                if ((x + y) % 4 != 0)
+                {
+                    spr.SetGlyph(x, y, PIXEL_SOLID);
+                    spr.SetColour(x, y, FG_RED);
+                }
+        int nSprite = 0;
+        Run("BM_DrawPartialSprite/8x8", [&]()
+            {
+                nSprite = (nSprite + 1) & 7;
+                game.DrawPartialSprite(100, 60, &spr, nSprite * 8, 0, 8, 8);
+            }, 64);
+        Run("BM_DrawSprite/64x16", [&]() { game.DrawSprite(100, 60, &spr); }, 64 * 16);
+
+        // Le vrai sprite des worms (une ou deux plages opaques par ligne)
+        olcSprite sprWorm(L"./worms1.spr");
+        Run("BM_DrawPartialSprite/Worm", [&]()
+            {
+                nSprite = (nSprite + 1) & 3;
+                game.DrawPartialSprite(100, 60, &sprWorm, nSprite * 8, 0, 8, 8);
+            }, 64);
+
+        Run("BM_FillTriangle/Small", [&]() { game.FillTriangle(10, 10, 20, 12, 14, 22, PIXEL_SOLID, FG_RED); });
+        Run("BM_FillTriangle/Screen", [&]()
+            {
+                game.FillTriangle(-20, -10, game.ScreenWidth() + 20, 40, 60, game.ScreenHeight() + 10, PIXEL_SOLID, FG_RED);
+            });
+
+        // Diffrentiel du tampon cran, comme dans GameThread : rien n'a chang / tout a chang
+        game.Fill(0, 0, game.ScreenWidth(), game.ScreenHeight(), PIXEL_SOLID, FG_BLUE);
+        game.UpdateScreenArrays();
+        Run("BM_ScreenDiff/Unchanged", [&]() { game.UpdateScreenArrays(); }, nCells);
+        short nColour = FG_BLUE;
+        Run("BM_ScreenDiff/FullRedraw", [&]()
+            {
+                // Inclut le remplissage de l'cran, qui force chaque cellule  changer
+                nColour = nColour == FG_BLUE ? FG_RED : FG_BLUE;
+                game.Fill(0, 0, game.ScreenWidth(), game.ScreenHeight(), PIXEL_SOLID, nColour);
+                game.UpdateScreenArrays();
+            }, nCells);
+    }
+
+    // Mixage d'un bloc audio de 512 chantillons selon le nombre de voix
+    // (des explosions superposes), sur la sortie nulle : on appelle le mixeur directement
+    void BenchAudio()
+    {
+        game.EnableSound(new olcAudioBackendNull());
+        game.CreateAudio();
+
+        // Une seconde de bruit, comme une explosion
+        Worms::olcAudioSample a;
+        a.wavHeader.nSamplesPerSec = 44100;
+        a.nChannels = 1;
+        a.nSamples = 44100;
+        a.fSample = new float[a.nSamples];
+        for (long i = 0; i < a.nSamples; i++)
+            a.fSample[i] = ((float)rand() / (float)RAND_MAX - 0.5f) * 0.1f;
+        a.bSampleValid = true;
+        game.vecAudioSamples.push_back(a);
+        int nSampleID = (int)game.vecAudioSamples.size();
+
+        vector<float> vecBlock(512);
+        for (int nVoices : { 1, 16, 64 })
+        {
+            // Rien d'autre ne joue : ni les sons des benchmarks d'avant, ni ceux du nombre prcdent
+            game.ResetAudioVoices();
+            for (int v = 0; v < nVoices; v++)
+                game.PlaySample(nSampleID, true);
+            Run("BM_MixBlock/" + to_string(nVoices), [&]()
+                {
+                    game.MixBlock(vecBlock.data(), (unsigned int)vecBlock.size(), 0.0f, 1.0f / 44100.0f);
+                }, (long long)vecBlock.size() * nVoices);
+        }
+        game.ResetAudioVoices();
+
+        // Une seconde de son complte, mixe puis convertie pour la sortie nulle
+        for (int v = 0; v < 16; v++)
+            game.PlaySample(nSampleID, true);
+        Run("BM_AudioPump/Null/16", [&]() { game.PumpAudio(1.0f); }, 44100);
+        game.StopSample(nSampleID);
+        game.DestroyAudio();
+        game.m_bEnableSound = false;
+
+        game.vecAudioSamples.pop_back();
+        delete[] a.fSample;
+
+        // Chargement d'un .wav de 10 s :  la frquence du mixeur, puis rchantillonn
+        vector<short> vecPCM(44100 * 2);
+        for (size_t i = 0; i < vecPCM.size(); i++)
+            vecPCM[i] = (short)(10000.0f * sinf(i * 0.05f));
+        for (unsigned int nRate : { 44100u, 48000u })
+        {
+            const wchar_t* sTmpFile = L"worms_bench_tmp.wav";
+            olcAudioBackendWavFile wav(sTmpFile);
+            wav.Open(nRate, 2, 1, (unsigned int)vecPCM.size());
+            for (int n = 0; n < 5; n++)
+                wav.Write(vecPCM.data(), (unsigned int)vecPCM.size());
+            wav.Close();
+
+            Run("BM_LoadWav/" + to_string(nRate) + "Hz/Stereo/10s", [&]()
+                {
+                    Worms::olcAudioSample s(sTmpFile, 44100);
+                    delete[] s.fSample;
+                }, 10 * (long long)nRate);
+            remove("worms_bench_tmp.wav");
+        }
+
+        vector<float> vecFloat(vecPCM.size());
+        Run("BM_ConvertPCM16/" + to_string(vecPCM.size()), [&]()
+            {
+                Worms::olcAudioSample::ConvertPCM((const uint8_t*)vecPCM.data(), vecFloat.data(), (long)vecPCM.size(), 16);
+            }, (long long)vecPCM.size());
+    }
+
+    // Traitement des entres d'une frame : sans vnement, puis avec un script
+    // qui appuie et relche une touche et bouge la souris  chaque frame
+    void BenchInput()
+    {
+        Run("BM_ProcessInput/Idle", [&]() { game.ProcessInputEvents(); });
+
+        // Une source qui fabrique ses vnements  la vole, quel que soit le numro de frame
+        struct sToggleInput : public olcInputSource
+        {
+            void Poll(uint32_t nFrame, vector<olcInputEvent>& vecEvents) override
+            {
+                olcInputEvent e;
+                e.nType = nFrame % 2 ? olcInputEvent::KEY_UP : olcInputEvent::KEY_DOWN;
+                e.nKey = VK_SPACE;
+                vecEvents.push_back(e);
+                e.nType = olcInputEvent::MOUSE_MOVE;
+                e.x = (int16_t)(nFrame % 256);
+                e.y = (int16_t)(nFrame % 160);
+                vecEvents.push_back(e);
+            }
+        } toggle;
+        game.SetInputSource(&toggle);
+        Run("BM_ProcessInput/Toggle", [&]() { game.ProcessInputEvents(); });
+
+        // La mme chose, enregistre puis rejoue depuis un script
+        olcInputScript script;
+        game.SetInputRecorder(&script);
+        for (int f = 0; f < 1000; f++)
+            game.ProcessInputEvents();
+        game.SetInputRecorder(nullptr);
+        game.SetInputSource(&script);
+        Run("BM_ProcessInput/Script", [&]()
+            {
+                // Relit le mme millier de frames en boucle, dcal sur les frames  venir
+                for (auto& e : script.vecEvents)
+                    e.first += 1000;
+                script.Rewind();
+                for (int f = 0; f < 1000; f++)
+                    game.ProcessInputEvents();
+            }, 1000);
+        game.SetInputSource(nullptr);
+    }
+
+    // Joue des parties entires, IA contre IA, du GS_RESET jusqu'au calme de GS_GAME_OVER2
+    void BenchMatch()
+    {
+        string sName = "BM_Match/" + to_string(nMatchTeams) + "x" + to_string(nMatchWormsPerTeam);
+        if (nMatchMapHeight != 512)
+            sName += "/" + to_string(nMatchMapWidth) + "x" + to_string(nMatchMapHeight);
+        else if (nMatchMapWidth != 1024)
+            sName += "/" + to_string(nMatchMapWidth);
+        if (game.bMapFile)
+            sName += "/file";
+        if (bMatchAIPlanning)
+            sName += "/plan";
+        if (nMatchPhysics == Worms::PHYSICS_SWEPT)
+            sName += "/swept";
+        else if (nMatchPhysics == Worms::PHYSICS_FIXED)
+            sName += "/fixed";
+        if (!bMatchObjectCollisions)
+            sName += "/passthrough";
+        if (!bMatchForces)
+            sName += "/calm";
+        if (!bMatchParticles)
+            sName += "/debris_objects";
+        if (nMatchObjectBudget == 0)
+            sName += "/unbounded";
+        else if (nMatchObjectBudget != 1024)
+            sName += "/budget" + to_string(nMatchObjectBudget);
+        if (nMatchWeapon != 0)
+            sName += string("/") + game.weapons[nMatchWeapon]->sName;
+        if (!sFilter.empty() && sName.find(sFilter) == string::npos)
+            return;
+
+        game.nTeams = nMatchTeams;
+        game.nWormsPerTeam = nMatchWormsPerTeam;
+        ResizeMap(nMatchMapWidth, nMatchMapHeight);
+
+        const long long nMaxFrames = 20000000; // Garde-fou si une partie ne finit jamais
+
+        long long nTotalTurns = 0, nTotalFrames = 0;
+        size_t nPeakObjects = 0;
+        int nUnfinished = 0;
+        double fSeconds = 0.0;
+        clock_t c1 = clock();
+
+        for (int m = 0; m < nMatches; m++)
+        {
+            // Chaque partie est enregistre : BenchReplay rejoue la dernire
+            game.bAllTeamsComputer = true;
+            game.bAIPlanning = bMatchAIPlanning;
+            game.nPhysics = nMatchPhysics;
+            game.bObjectCollisions = bMatchObjectCollisions;
+            game.bForces = bMatchForces;
+            game.nObjectBudget = nMatchObjectBudget;
+            game.bParticles = bMatchParticles;
+            game.nWeapon = nMatchWeapon;
+            game.StartRecording(nSeed + m);
+
+            bool bRecord = m == 0 && !sMatchWavFile.empty();
+            if (bRecord)
+            {
+                game.EnableSound(new olcAudioBackendWavFile(sMatchWavFile));
+                bRecord = game.CreateAudio();
+            }
+
+            long long nFrames = 0, nTurns = 0;
+            auto t1 = chrono::steady_clock::now();
+            while (nFrames < nMaxFrames)
+            {
+                auto nOldState = game.nGameState;
+                game.UpdateSimulation(fMatchElapsedTime);
+                if (bRecord)
+                    game.PumpAudio(fMatchElapsedTime);
+                nFrames++;
+
+                if (game.nGameState == Worms::GS_START_PLAY && nOldState != Worms::GS_START_PLAY)
+                    nTurns++;
+                nPeakObjects = max(nPeakObjects, game.listObjects.size());
+
+                if (game.nGameState == Worms::GS_GAME_OVER2 && game.bGameIsStable)
+                    break;
+            }
+            auto t2 = chrono::steady_clock::now();
+
+            if (bRecord)
+            {
+                game.DestroyAudio();
+                game.m_bEnableSound = false;
+            }
+
+            if (nFrames >= nMaxFrames) nUnfinished++;
+            fSeconds += chrono::duration<double>(t2 - t1).count();
+            nTotalTurns += nTurns;
+            nTotalFrames += nFrames;
+            fprintf(stderr, "  partie %d : %lld tours, %lld frames\n", m, nTurns, nFrames);
+
+            if (m == 0 && !sSaveReplayFile.empty())
+                game.replay.Save(sSaveReplayFile);
+        }
+        game.nReplayMode = Worms::REPLAY_OFF;
+        clock_t c2 = clock();
+        game.bAllTeamsComputer = false;
+        game.nPhysics = nMatchPhysics;
+        game.bObjectCollisions = bMatchObjectCollisions;
+        game.bForces = bMatchForces;
+        game.nObjectBudget = nMatchObjectBudget;
+        game.bParticles = bMatchParticles;
+        ResizeMap(1024, 512);
+        game.CreateMap();
+
+        sBenchResult r;
+        r.sName = sName;
+        r.nIterations = nMatches;
+        r.fRealTime = fSeconds * 1e9 / nMatches;
+        r.fCpuTime = (double)(c2 - c1) / CLOCKS_PER_SEC * 1e9 / nMatches;
+        r.vecCounters.push_back({ "turns_per_second", nTotalTurns / fSeconds });
+        double fSteps = (double)nTotalFrames * game.PhysicsStepsPerFrame(fMatchElapsedTime);
+        r.vecCounters.push_back({ "physics_steps_per_second", fSteps / fSeconds });
+        r.vecCounters.push_back({ "frames", (double)nTotalFrames / nMatches });
+        r.vecCounters.push_back({ "turns", (double)nTotalTurns / nMatches });
+        r.vecCounters.push_back({ "simulated_seconds", nTotalFrames * (double)fMatchElapsedTime / nMatches });
+        r.vecCounters.push_back({ "peak_objects", (double)nPeakObjects });
+        r.vecCounters.push_back({ "peak_rss_bytes", PeakRSS() });
+        r.vecCounters.push_back({ "unfinished_matches", (double)nUnfinished });
+        vecResults.push_back(r);
+        fprintf(stderr, "%-40s %14.0f ns %12d  %.1f tours/s, %.0f pas/s\n", sName.c_str(), r.fRealTime, nMatches,
+            nTotalTurns / fSeconds, fSteps / fSeconds);
+    }
+
+    // Rejoue une vraie partie enregistre, sans rendu et au plus vite, puis mesure
+    // le dplacement dans le replay (retour au keyframe d'un tour, puis resimulation)
+    // et les snapshots d'un tat en pleine partie. Dans ce mme tat, mesure la
+    // planification d'un tir de l'IA
+    void BenchReplay()
+    {
+        string sName = "BM_Replay/" + string(sReplayFile.empty() ? "Match" : "File");
+        bool bWanted = sFilter.empty();
+        for (string s : { sName, string("BM_ReplaySeek/Turn+1000"), string("BM_SaveState/MidMatch"), string("BM_LoadState/MidMatch"),
+            string("BM_AIPlanShot/MidMatch"), string("BM_AIPlanShot/MidMatch/Swept"), string("BM_AIPlanShot/MidMatch/Fixed") })
+            bWanted = bWanted || s.find(sFilter) != string::npos;
+        if (!bWanted)
+            return;
+
+        if (!sReplayFile.empty())
+        {
+            if (!game.replay.Load(sReplayFile))
+            {
+                fprintf(stderr, "Replay illisible\n");
+                return;
+            }
+        }
+        else if (game.replay.nFrames == 0)
+        {
+            // BenchMatch n'a pas tourn (--filter) : on enregistre une partie
+            game.nTeams = nMatchTeams;
+            game.nWormsPerTeam = nMatchWormsPerTeam;
+            ResizeMap(nMatchMapWidth, nMatchMapHeight);
+            game.bAllTeamsComputer = true;
+            game.bAIPlanning = bMatchAIPlanning;
+            game.nPhysics = nMatchPhysics;
+            game.bObjectCollisions = bMatchObjectCollisions;
+            game.bForces = bMatchForces;
+            game.nObjectBudget = nMatchObjectBudget;
+            game.bParticles = bMatchParticles;
+            game.nWeapon = nMatchWeapon;
+            game.StartRecording(nSeed);
+            while (!(game.nGameState == Worms::GS_GAME_OVER2 && game.bGameIsStable) && game.nReplayFrame < 20000000)
+                game.UpdateSimulation(fMatchElapsedTime);
+        }
+
+        if (game.replay.nFrames == 0)
+            return;
+
+        // Relecture complte
+        clock_t c1 = clock();
+        auto t1 = chrono::steady_clock::now();
+        game.StartPlayback();
+        while (game.ReplayStep());
+        auto t2 = chrono::steady_clock::now();
+        clock_t c2 = clock();
+
+        double fSeconds = chrono::duration<double>(t2 - t1).count();
+        uint32_t nFrames = game.replay.nFrames;
+        size_t nStateBytes = 0;
+        for (auto& k : game.vecKeyframes)
+            nStateBytes += k.vecState.size();
+
+        sBenchResult r;
+        r.sName = sName;
+        r.nIterations = 1;
+        r.fRealTime = fSeconds * 1e9;
+        r.fCpuTime = (double)(c2 - c1) / CLOCKS_PER_SEC * 1e9;
+        r.vecCounters.push_back({ "frames", (double)nFrames });
+        r.vecCounters.push_back({ "physics_steps_per_second", nFrames * 10.0 / fSeconds });
+        r.vecCounters.push_back({ "desyncs", (double)game.nReplayDesyncs });
+        r.vecCounters.push_back({ "events", (double)game.replay.vecEvents.size() });
+        r.vecCounters.push_back({ "keyframes", (double)game.vecKeyframes.size() });
+        r.vecCounters.push_back({ "keyframe_bytes", (double)nStateBytes });
+        if (sFilter.empty() || sName.find(sFilter) != string::npos)
+            vecResults.push_back(r);
+        fprintf(stderr, "%-40s %14.0f ns %12d  %u frames, %d divergences, %zu keyframes\n", sName.c_str(), r.fRealTime, 1,
+            nFrames, game.nReplayDesyncs, game.vecKeyframes.size());
+        if (game.nReplayDesyncs > 0)
+            fprintf(stderr, "  premiere divergence a la frame %u\n", game.nReplayFirstDesync);
+
+        // Sauts d'un tour  l'autre, dans le dsordre, 1000 frames aprs son dbut :
+        // un retour au keyframe du tour, puis 1000 frames resimules
+        vector<uint32_t> vecTurns;
+        for (auto& e : game.replay.vecEvents)
+            if (e.nType == sReplayEvent::TURN && e.nFrame + 1001 <= nFrames)
+                vecTurns.push_back(e.nFrame + 1001);
+        size_t nTurn = 0;
+        if (!vecTurns.empty())
+            Run("BM_ReplaySeek/Turn+1000", [&]()
+                {
+                    nTurn = (nTurn + 5) % vecTurns.size();
+                    game.SeekReplay(vecTurns[nTurn]);
+                });
+
+        // Le tour du milieu, 1000 frames aprs son dbut
+        if (!vecTurns.empty())
+        {
+            game.SeekReplay(vecTurns[vecTurns.size() / 2]);
+            vector<uint8_t> vecState;
+            game.SaveState(vecState);
+            double fBytes = (double)vecState.size();
+            double fObjects = (double)game.listObjects.size();
+
+            for (string sState : { "BM_SaveState/MidMatch", "BM_LoadState/MidMatch" })
+            {
+                size_t nResults = vecResults.size();
+                if (sState == "BM_SaveState/MidMatch")
+                    Run(sState, [&]() { game.SaveState(vecState); });
+                else
+                    Run(sState, [&]() { game.LoadState(vecState); });
+                if (vecResults.size() > nResults)
+                {
+                    vecResults.back().vecCounters.push_back({ "bytes", fBytes });
+                    vecResults.back().vecCounters.push_back({ "objects", fObjects });
+                }
+            }
+
+            // Tous les tirs d'essai du premier worm en vie, sur le pool de threads
+            cWorm* pShooter = nullptr;
+            for (auto& p : game.listObjects)
+                if (cWorm* w = dynamic_cast<cWorm*>(p.get()))
+                    if (w->bIsPlayable && pShooter == nullptr)
+                        pShooter = w;
+            if (pShooter != nullptr)
+            {
+                // Dans le champ de distance, avec la sonde balaye (pas longs tous deux),
+                // puis avec les 10 pas fixes d'avant
+                Worms::PHYSICS nPhysics = game.nPhysics;
+                for (Worms::PHYSICS n : { Worms::PHYSICS_DISTANCE, Worms::PHYSICS_SWEPT, Worms::PHYSICS_FIXED })
+                {
+                    Worms::sShotPlan plan;
+                    size_t nResults = vecResults.size();
+                    game.nPhysics = n;
+                    Run(n == Worms::PHYSICS_FIXED ? "BM_AIPlanShot/MidMatch/Fixed" :
+                        n == Worms::PHYSICS_SWEPT ? "BM_AIPlanShot/MidMatch/Swept" : "BM_AIPlanShot/MidMatch",
+                        [&]() { game.PlanShot(pShooter, plan); });
+                    if (vecResults.size() > nResults)
+                    {
+                        vecResults.back().vecCounters.push_back({ "threads", (double)game.pAIPool->Threads() });
+                        vecResults.back().vecCounters.push_back({ "best_score", plan.fScore });
+                        vecResults.back().vecCounters.push_back({ "copied_tiles", (double)plan.nCopiedTiles });
+                    }
+                }
+                game.nPhysics = nPhysics;
+            }
+        }
+
+        game.nReplayMode = Worms::REPLAY_OFF;
+        game.bAllTeamsComputer = false;
+        game.nTeams = 4;
+        game.nWormsPerTeam = 3;
+        ResizeMap(1024, 512);
+        cRandom::Seed(1);
+        game.CreateMap();
+    }
+
+    void WriteJson(FILE* f, const char* sExecutable)
+    {
+        time_t t = time(nullptr);
+        char sDate[64];
+        strftime(sDate, sizeof(sDate), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+
+        fprintf(f, "{\n  \"context\": {\n");
+        fprintf(f, "    \"date\": \"%s\",\n", sDate);
+        fprintf(f, "    \"executable\": \"%s\",\n", sExecutable);
+        fprintf(f, "    \"num_cpus\": %u,\n", thread::hardware_concurrency());
+        fprintf(f, "    \"min_time\": %g\n  },\n", fMinTime);
+        fprintf(f, "  \"benchmarks\": [\n");
+        for (size_t i = 0; i < vecResults.size(); i++)
+        {
+            const sBenchResult& r = vecResults[i];
+            fprintf(f, "    {\n");
+            fprintf(f, "      \"name\": \"%s\",\n", r.sName.c_str());
+            fprintf(f, "      \"run_name\": \"%s\",\n", r.sName.c_str());
+            fprintf(f, "      \"run_type\": \"iteration\",\n");
+            fprintf(f, "      \"iterations\": %lld,\n", r.nIterations);
+            fprintf(f, "      \"real_time\": %.3f,\n", r.fRealTime);
+            fprintf(f, "      \"cpu_time\": %.3f,\n", r.fCpuTime);
+            if (r.fItemsPerSecond > 0.0)
+                fprintf(f, "      \"items_per_second\": %.3f,\n", r.fItemsPerSecond);
+            for (auto& c : r.vecCounters)
+                fprintf(f, "      \"%s\": %.3f,\n", c.first.c_str(), c.second);
+            fprintf(f, "      \"time_unit\": \"ns\"\n");
+            fprintf(f, "    }%s\n", i + 1 < vecResults.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+    }
+};
+
+int main(int argc, char** argv)
+{
+    sWormsBench bench;
+    string sOut;
+    string sWeapon;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string a = argv[i];
+        if (a.rfind("--filter=", 0) == 0) bench.sFilter = a.substr(9);
+        else if (a.rfind("--min_time=", 0) == 0) bench.fMinTime = atof(a.substr(11).c_str());
+        else if (a.rfind("--out=", 0) == 0) sOut = a.substr(6);
+        else if (a.rfind("--matches=", 0) == 0) bench.nMatches = max(1, atoi(a.substr(10).c_str()));
+        else if (a.rfind("--seed=", 0) == 0) bench.nSeed = (unsigned int)atoi(a.substr(7).c_str());
+        else if (a.rfind("--dt=", 0) == 0) bench.fMatchElapsedTime = (float)atof(a.substr(5).c_str());
+        else if (a.rfind("--wav=", 0) == 0) bench.sMatchWavFile = wstring(a.begin() + 6, a.end());
+        else if (a.rfind("--teams=", 0) == 0) bench.nMatchTeams = max(2, atoi(a.substr(8).c_str()));
+        else if (a.rfind("--worms=", 0) == 0) bench.nMatchWormsPerTeam = max(1, atoi(a.substr(8).c_str()));
+        else if (a.rfind("--map_width=", 0) == 0) bench.nMatchMapWidth = max(256, atoi(a.substr(12).c_str()));
+        else if (a.rfind("--map_height=", 0) == 0) bench.nMatchMapHeight = max(256, atoi(a.substr(13).c_str()));
+        else if (a.rfind("--save_replay=", 0) == 0) bench.sSaveReplayFile = wstring(a.begin() + 14, a.end());
+        else if (a.rfind("--replay=", 0) == 0) bench.sReplayFile = wstring(a.begin() + 9, a.end());
+        else if (a == "--ai_plan") bench.bMatchAIPlanning = true;
+        else if (a == "--fixed_steps")   // La physique d'avant : 10 pas fixes, des objets qui se traversent, sans vent ni budget, des dbris objets
+        {
+            bench.SetPhysics("fixed");
+            bench.bMatchObjectCollisions = false;
+            bench.bMatchForces = false;
+            bench.nMatchObjectBudget = 0;
+            bench.bMatchParticles = false;
+        }
+        else if (a == "--no_object_collisions") bench.bMatchObjectCollisions = false;
+        else if (a == "--no_wind") bench.bMatchForces = false;
+        else if (a == "--debris_objects") bench.bMatchParticles = false;
+        else if (a.rfind("--object_budget=", 0) == 0) bench.nMatchObjectBudget = (uint32_t)max(0, atoi(a.substr(16).c_str()));
+        else if (a.rfind("--physics=", 0) == 0)
+        {
+            if (!bench.SetPhysics(a.substr(10)))
+            {
+                fprintf(stderr, "Physique inconnue : %s\n", a.c_str() + 10);
+                return 1;
+            }
+        }
+        else if (a.rfind("--weapon=", 0) == 0) sWeapon = a.substr(9);
+        else if (a.rfind("--weapons=", 0) == 0)
+        {
+            if (!bench.LoadWeapons(a.substr(10)))
+            {
+                fprintf(stderr, "Armes illisibles : %s\n", a.c_str() + 10);
+                return 1;
+            }
+        }
+        else if (a.rfind("--map=", 0) == 0)
+        {
+            if (!bench.LoadMapFile(a.substr(6)))
+            {
+                fprintf(stderr, "Carte illisible : %s\n", a.c_str() + 6);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage : %s [--filter=nom] [--min_time=secondes] [--out=fichier.json]\n"
+                "          [--matches=n] [--seed=graine] [--dt=secondes]\n"
+                "          [--teams=n] [--worms=n] [--map_width=pixels] [--map_height=pixels]\n"
+                "          [--wav=partie.wav] [--save_replay=partie.rpl] [--replay=partie.rpl] [--ai_plan]\n"
+                "          [--map=carte.pbm] [--physics=distance|swept|fixed] [--no_object_collisions]\n"
+                "          [--weapons=armes.txt] [--weapon=nom] [--no_wind] [--object_budget=n] [--debris_objects]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Une fois toutes les armes lues
+    if (!sWeapon.empty() && !bench.SetWeapon(sWeapon))
+    {
+        fprintf(stderr, "Arme inconnue : %s\n", sWeapon.c_str());
+        return 1;
+    }
+
+    // La partie complte d'abord, pour que le pic de mmoire soit le sien
+    bench.BenchMatch();
+    bench.BenchReplay();
+    bench.BenchPhysics();
+    bench.BenchBarrage();
+    bench.BenchTerrain();
+    bench.BenchStreaming();
+    bench.BenchRender();
+    bench.BenchAudio();
+    bench.BenchInput();
+
+    FILE* f = sOut.empty() ? stdout : fopen(sOut.c_str(), "w");
+    if (f == nullptr)
+    {
+        fprintf(stderr, "Impossible d'crire %s\n", sOut.c_str());
+        return 1;
+    }
+    bench.WriteJson(f, argv[0]);
+    if (f != stdout) fclose(f);
+    return 0;
+}
@@ -26,9 +26,153 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <functional>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 
+// Le hasard du jeu. L'tat de rand() ne se sauve pas et change d'une bibliothque C
+//  l'autre : celui-ci fait le mme calcul que le rand() de Visual C++, mais son tat
+// se lit et se restaure, ce qui rend les replays reproductibles partout
+class cRandom
+{
+public:
+    static const int nMax = 0x7FFF;
+    static unsigned int nState;
+
+    static void Seed(unsigned int nSeed)
+    {
+        nState = nSeed;
+    }
+
+    // Entier entre 0 et nMax
+    static int Next()
+    {
+        nState = nState * 214013u + 2531011u;
+        return (int)((nState >> 16) & nMax);
+    }
+
+    // Rel entre 0 et 1
+    static float Unit()
+    {
+        return (float)Next() / (float)nMax;
+    }
+};
+
+unsigned int cRandom::nState = 1;
+
+
+// Une arme, telle que dcrite dans armes.txt (voir cWeapons). Un projectile n'en
+// garde qu'un pointeur : la physique lit ces valeurs  plat, sans une classe par arme
+struct sWeapon
+{
+    // Ce que lance le projectile quand il explose
+    enum SPAWN : uint8_t
+    {
+        SPAWN_NONE = 0,
+        SPAWN_BURST,        // nChildren clats en ventail vers le haut, lancs  fSpread
+        SPAWN_SKY           // nChildren projectiles tombs du ciel, espacs de fSpread
+    };
+
+    char sName[16] = "missile";
+    float fRadius = 2.5f;       // Taille du projectile
+    float fFriction = 0.5f;
+    int nBounces = 1;           // Rebonds avant d'exploser. -1 : seul le dtonateur le fait exploser
+    float fFuse = 0.0f;         // Dtonateur, en secondes de jeu (0 : aucun)
+    int nBlast = 20;            // Rayon de l'explosion (0 : aucune)
+    float fDamage = 0.8f;       // Dommages au centre de l'explosion...
+    float fFalloff = 1.0f;      // ... en (1 - distance / rayon) ^ fFalloff
+    float fKick = 1.0f;         // Vitesse donne par l'onde de choc, en rayons de l'explosion...
+    float fKickFalloff = 0.0f;  // ... en (1 - distance / rayon) ^ fKickFalloff (0 : la mme partout)
+    uint8_t nSpawn = SPAWN_NONE;
+    int nChildren = 0;
+    int nChild = -1;            // L'indice de l'arme des projectiles lancs
+    float fSpread = 0.0f;
+    float fDrag = 0.01f;        // Prise au vent du projectile (voir sForces)
+    float fPush = 0.0f;         // Le souffle de l'explosion, qui pousse un instant les objets lgers
+    const sWeapon* pChild = nullptr;    // Retrouve par cWeapons::Compile
+
+    // Le missile d'origine : celui des replays d'avant les armes et du feu d'artifice de fin
+    static const sWeapon* Missile()
+    {
+        static const sWeapon w;
+        return &w;
+    }
+};
+
+
+// L'air, qui s'ajoute  la gravit : le vent du tour, et les souffles qui suivent
+// un instant certaines explosions. Un objet est entran vers la vitesse de l'air
+// l o il se trouve, d'autant plus que sa trane (fDrag) est grande : les
+// worms n'en ont pas, les dbris beaucoup
+struct sForces
+{
+    // Un souffle : l'air part du centre  fSpeed, en s'affaiblissant jusqu' fRadius,
+    // et retombe en fTime (temps de la physique)
+    struct sBlast
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        float fSpeed = 0.0f;
+        float fRadius = 1.0f;
+        float fTime = 0.0f;
+        float fDuration = 1.0f;
+    };
+
+    float fWind = 0.0f;         // Vitesse du vent, vers la droite si positive
+    vector<sBlast> vecBlasts;
+
+    static const int nMaxBlasts = 16;
+
+    bool IsCalm() const
+    {
+        return fWind == 0.0f && vecBlasts.empty();
+    }
+
+    // Le souffle le plus ancien laisse sa place
+    void AddBlast(float x, float y, float fSpeed, float fRadius, float fDuration)
+    {
+        if ((int)vecBlasts.size() >= nMaxBlasts)
+            vecBlasts.erase(vecBlasts.begin());
+        vecBlasts.push_back({ x, y, fSpeed, fRadius, fDuration, fDuration });
+    }
+
+    void Update(float fElapsedTime)
+    {
+        for (auto& b : vecBlasts)
+            b.fTime -= fElapsedTime;
+        vecBlasts.erase(remove_if(vecBlasts.begin(), vecBlasts.end(), [](const sBlast& b) { return b.fTime <= 0.0f; }), vecBlasts.end());
+    }
+
+    // L'acclration que l'air donne  un objet. Sans branche dans la boucle des
+    // souffles, pour que le compilateur la vectorise ; la physique et la vise de
+    // l'IA passent toutes deux par ici
+    void Acceleration(float x, float y, float vx, float vy, float fDrag, float& ax, float& ay) const
+    {
+        float fAirX = fWind;
+        float fAirY = 0.0f;
+        for (const sBlast& b : vecBlasts)
+        {
+            float dx = x - b.x;
+            float dy = y - b.y;
+            float fDist = sqrtf(dx * dx + dy * dy) + 0.0001f;
+            float fSpeed = b.fSpeed * max(1.0f - fDist / b.fRadius, 0.0f) * (b.fTime / b.fDuration);
+            fAirX += dx / fDist * fSpeed;
+            fAirY += dy / fDist * fSpeed;
+        }
+        ax += fDrag * (fAirX - vx);
+        ay += fDrag * (fAirY - vy);
+    }
+};
+
+
 // La classe dont vont hriter tous les objets, les armes et les worms
 class cPhysicsObject
 {
@@ -39,6 +183,9 @@ public:
         py = y;
     }
 
+    // Les objets sont dtruits par listObjects,  travers un pointeur sur cette classe
+    virtual ~cPhysicsObject() = default;
+
     float px = 0.0f;
     float py = 0.0f;
     float vx = 0.0f;
@@ -58,6 +205,24 @@ public:
 
     bool bDead = false;
 
+    // Les chocs entre objets (Worms::CollideObjects) : un objet heurte ceux dont la
+    // couche est dans son masque nCollideWith. Sans couche, il traverse tout
+    enum LAYER : uint8_t
+    {
+        LAYER_WORM = 1,
+        LAYER_DEBRIS = 2
+    };
+    uint8_t nLayer = 0;
+    uint8_t nCollideWith = 0;
+    float fMass = 1.0f;
+
+    // Prise  l'air (sForces) : 0, l'objet ne sent ni le vent ni les souffles
+    float fDrag = 0.0f;
+
+    // L'arme d'un projectile, et ce qui reste  son dtonateur (en secondes de jeu)
+    const sWeapon* pWeapon = nullptr;
+    float fFuse = 0.0f;
+
     // La classe est abstraite
     virtual void Draw(olcConsoleGameEngine* engine, float fOffsetX, float fOffsetY, bool bPixel = false) = 0;
     virtual int BounceDeathAction() = 0;
@@ -70,16 +235,31 @@ class cDebris : public cPhysicsObject
 public:
     cDebris(float x = 0.0f, float y = 0.0f) : cPhysicsObject(x, y)
     {
-        vx = 10.0f * cosf(((float)rand() / (float)RAND_MAX) * 2.0f * 3.14159);
-        vy = 10.0f * sinf(((float)rand() / (float)RAND_MAX) * 2.0f * 3.14159);
+        vx = 10.0f * cosf(cRandom::Unit() * 2.0f * 3.14159);
+        vy = 10.0f * sinf(cRandom::Unit() * 2.0f * 3.14159);
         radius = 1.0f;
         fFriction = 0.8f;
         nBounceBeforeDeath = 5;
+
+        // Rebondit sur les worms, sans presque les pousser
+        nLayer = LAYER_DEBRIS;
+        fMass = 0.05f;
+
+        // Et volent au vent
+        fDrag = 0.05f;
     }
 
     virtual void Draw(olcConsoleGameEngine* engine, float fOffsetX, float fOffsetY, bool bPixel = false)
     {
-        engine->DrawWireFrameModel(vecModel, px - fOffsetX, py - fOffsetY, atan2f(vy, vx), bPixel ? 0.5f : radius, FG_DARK_GREEN);
+        // Les dbris sont nombreux : on les met de ct pour les dessiner tous d'un coup (DrawBatch)
+        vecBatch.push_back({ px - fOffsetX, py - fOffsetY, atan2f(vy, vx), bPixel ? 0.5f : radius });
+    }
+
+    // Dessine tous les dbris accumuls depuis le dernier appel
+    static void DrawBatch(olcConsoleGameEngine* engine)
+    {
+        engine->DrawWireFrameModels(vecModel, vecBatch, FG_DARK_GREEN);
+        vecBatch.clear(); // Garde la capacit : plus d'allocation une fois la taille atteinte
     }
 
     // Ce qui se passe quand l'objet a fini ses rebonds
@@ -95,6 +275,7 @@ public:
 
 private:
     static vector<pair<float, float>> vecModel;
+    static vector<olcConsoleGameEngine::sWireFrameInstance> vecBatch;
 };
 
 
@@ -109,21 +290,296 @@ vector<pair<float, float>> DefineDebris()
 }
 
 vector<pair<float, float>> cDebris::vecModel = DefineDebris();
+vector<olcConsoleGameEngine::sWireFrameInstance> cDebris::vecBatch;
+
+// Les particules des explosions : dbris, tincelles et fume, pour le dcor
+// seulement. Ce ne sont pas des cPhysicsObject : chaque valeur a son tableau, elles
+// avancent d'un pas par frame, ne testent que la case o elles arrivent, et ne
+// touchent ni aux worms, ni  la stabilit de la partie, ni au hasard du jeu (elles
+// ont le leur). Un anneau de taille fixe : la plus ancienne laisse sa place
+class cParticles
+{
+public:
+    enum KIND : uint8_t
+    {
+        KIND_DEBRIS = 0,    // De la terre, qui retombe et rebondit
+        KIND_SPARK,         // Vite partie, vite teinte
+        KIND_SMOKE          // Monte doucement, emporte par le vent
+    };
+
+    static constexpr uint32_t nCapacity = 16384;   // Une puissance de 2
+
+    cParticles()
+    {
+        for (auto* v : { &vecX, &vecY, &vecVX, &vecVY, &vecLife, &vecWeight, &vecDrag })
+            v->assign(nCapacity, 0.0f);
+        vecColour.assign(nCapacity, 0);
+        Clear();
+    }
+
+    void Clear()
+    {
+        nHead = 0;
+        nCount = 0;
+        fMinX = fMinY = INFINITY;
+        fMaxX = fMaxY = -INFINITY;
+    }
+
+    // Les particules de l'anneau, teintes comprises
+    uint32_t Size() const
+    {
+        return nCount;
+    }
+
+    // Une particule en vie peut-elle se trouver dans le rectangle ? (leur bote englobante
+    // depuis le dernier Update, pour ne pas tracer celles qui sont toutes hors de l'cran)
+    bool Overlaps(float x1, float y1, float x2, float y2) const
+    {
+        return fMaxX >= x1 && fMinX < x2 && fMaxY >= y1 && fMinY < y2;
+    }
+
+    void Emit(float x, float y, float vx, float vy, float fLife, uint8_t nKind)
+    {
+        static const float fWeights[] = { 1.0f, 0.5f, -0.05f };    // Fois la gravit
+        static const float fDrags[] = { 0.05f, 0.02f, 0.3f };
+        uint32_t i = nHead;
+        nHead = (nHead + 1) & (nCapacity - 1);
+        nCount = min(nCount + 1, nCapacity);
+        vecX[i] = x;
+        vecY[i] = y;
+        Enclose(x, y);
+        vecVX[i] = vx;
+        vecVY[i] = vy;
+        vecLife[i] = fLife;
+        vecWeight[i] = fWeights[nKind];
+        vecDrag[i] = fDrags[nKind];
+        vecColour[i] = nKind == KIND_DEBRIS ? FG_DARK_GREEN : nKind == KIND_SMOKE ? (Unit() < 0.5f ? FG_GREY : FG_DARK_GREY) :
+            (Unit() < 0.7f ? FG_YELLOW : FG_RED);
+    }
+
+    // Ce que lance une explosion : un dbris par unit de rayon, comme les cDebris
+    // d'avant les particules, des tincelles et un peu de fume
+    void Explosion(float x, float y, float fRadius)
+    {
+        const float f2Pi = 2.0f * 3.14159f;
+        int n = (int)fRadius;
+        for (int i = 0; i < n; i++)
+        {
+            float a = Unit() * f2Pi;
+            Emit(x, y, 10.0f * cosf(a), 10.0f * sinf(a), 20.0f + 20.0f * Unit(), KIND_DEBRIS);
+        }
+        for (int i = 0; i < n / 2; i++)
+        {
+            float a = Unit() * f2Pi;
+            float v = fRadius * (0.5f + Unit());
+            Emit(x, y, v * cosf(a), v * sinf(a), 2.0f + 3.0f * Unit(), KIND_SPARK);
+        }
+        for (int i = 0; i < n / 4 + 1; i++)
+        {
+            float a = Unit() * f2Pi;
+            float r = fRadius * 0.5f * Unit();
+            Emit(x + r * cosf(a), y + r * sinf(a), cosf(a), sinf(a) - 1.0f, 15.0f + 15.0f * Unit(), KIND_SMOKE);
+        }
+    }
+
+    // Un pas de fElapsedTime (temps de la physique) : gravit, air, puis la case
+    // d'arrive. Sur la terre, la particule reste o elle est et rebondit, amortie
+    template<typename TERRAIN>
+    void Update(TERRAIN& terrain, float fElapsedTime, const sForces& forces)
+    {
+        // Les plus anciennes, teintes, librent l'anneau
+        while (nCount > 0 && vecLife[(nHead - nCount) & (nCapacity - 1)] <= 0.0f)
+            nCount--;
+
+        bool bCalm = forces.IsCalm();
+        float fWidth = (float)terrain.nWidth;
+        float fHeight = (float)terrain.nHeight;
+        fMinX = fMinY = INFINITY;
+        fMaxX = fMaxY = -INFINITY;
+        ForEachRange([&](uint32_t i0, uint32_t i1)
+            {
+                for (uint32_t i = i0; i < i1; i++)
+                {
+                    if (vecLife[i] <= 0.0f)
+                        continue;
+                    vecLife[i] -= fElapsedTime;
+
+                    float ax = 0.0f;
+                    float ay = 2.0f * vecWeight[i];
+                    if (!bCalm)
+                        forces.Acceleration(vecX[i], vecY[i], vecVX[i], vecVY[i], vecDrag[i], ax, ay);
+                    vecVX[i] += ax * fElapsedTime;
+                    vecVY[i] += ay * fElapsedTime;
+                    float x = vecX[i] + vecVX[i] * fElapsedTime;
+                    float y = vecY[i] + vecVY[i] * fElapsedTime;
+
+                    if (vecLife[i] <= 0.0f || !(x >= 0.0f && x < fWidth && y < fHeight))
+                    {
+                        Kill(i);
+                        continue;
+                    }
+                    if (y >= 0.0f && terrain.Get((int)x, (int)y) > 0)
+                    {
+                        vecVX[i] *= 0.5f;
+                        vecVY[i] *= -0.4f;
+                    }
+                    else
+                    {
+                        vecX[i] = x;
+                        vecY[i] = y;
+                    }
+                    Enclose(vecX[i], vecY[i]);
+                }
+            });
+    }
+
+    // D'un seul trac par morceau d'anneau : une particule teinte est hors de l'cran
+    void Draw(olcConsoleGameEngine* engine, float fOffsetX, float fOffsetY, float fScaleX = 1.0f, float fScaleY = 1.0f) const
+    {
+        ForEachRange([&](uint32_t i0, uint32_t i1)
+            {
+                engine->DrawPoints(&vecX[i0], &vecY[i0], &vecColour[i0], i1 - i0, fOffsetX, fOffsetY, fScaleX, fScaleY);
+            });
+    }
+
+private:
+    vector<float> vecX, vecY, vecVX, vecVY;
+    vector<float> vecLife;      // Temps qui reste, en temps de la physique (teinte  0)
+    vector<float> vecWeight;    // La gravit, en fois celle des objets
+    vector<float> vecDrag;      // La prise  l'air (voir sForces)
+    vector<short> vecColour;
+    uint32_t nHead = 0;         // La prochaine place
+    uint32_t nCount = 0;        // Les places occupes, juste avant nHead
+    uint32_t nState = 2463534242u;
+    float fMinX, fMinY, fMaxX, fMaxY;   // La bote englobante des particules en vie
+
+    void Enclose(float x, float y)
+    {
+        fMinX = min(fMinX, x);
+        fMaxX = max(fMaxX, x);
+        fMinY = min(fMinY, y);
+        fMaxY = max(fMaxY, y);
+    }
+
+    // L'anneau en au plus deux morceaux contigus, des plus anciennes aux plus rcentes
+    template<typename F>
+    void ForEachRange(F fn) const
+    {
+        uint32_t nTail = (nHead - nCount) & (nCapacity - 1);
+        if (nTail + nCount <= nCapacity)
+            fn(nTail, nTail + nCount);
+        else
+        {
+            fn(nTail, nCapacity);
+            fn(0, nHead);
+        }
+    }
+
+    void Kill(uint32_t i)
+    {
+        vecLife[i] = 0.0f;
+        vecX[i] = -1.0e6f;
+    }
+
+    // Xorshift : le hasard des particules ne doit rien prendre  cRandom
+    float Unit()
+    {
+        nState ^= nState << 13;
+        nState ^= nState >> 17;
+        nState ^= nState << 5;
+        return (float)(nState >> 8) / 16777216.0f;
+    }
+};
+
+
+// Les chiffres du compteur, en segments comme sur un rveil. Chacun est dcod une
+// fois pour toutes en plages de cases par ligne, que l'interface trace d'un DrawSpan
+class cHudDigits
+{
+public:
+    static const int nWidth = 8;
+    static const int nHeight = 13;
+
+    cHudDigits()
+    {
+        // Les segments de 0  9 : bit 0 en haut, 1 et 2 les cts du haut, 3 au milieu,
+        // 4 et 5 les cts du bas, 6 en bas
+        const wchar_t d[] = L"w$]m.k{\%\x7Fo";
+        for (int n = 0; n < 10; n++)
+            for (int r = 0; r < nHeight; r++)
+            {
+                sRow& row = rows[n][r];
+                row.nSpans = 0;
+                if (!(r % 6))
+                {
+                    if (d[n] & (1 << (r / 2)))
+                        Add(row, 1, 6);
+                }
+                else
+                {
+                    if (d[n] & (1 << (r < 6 ? 1 : 4)))
+                        Add(row, 0, 1);
+                    if (d[n] & (1 << (r < 6 ? 2 : 5)))
+                        Add(row, 6, 7);
+                }
+            }
+    }
+
+    // Un nombre de 0  99, son premier chiffre en (x, y)
+    void Draw(olcConsoleGameEngine* engine, int x, int y, int nNumber, short col) const
+    {
+        if (nNumber >= 10)
+        {
+            DrawDigit(engine, x, y, nNumber / 10, col);
+            x += nWidth;
+        }
+        DrawDigit(engine, x, y, nNumber % 10, col);
+    }
+
+private:
+    struct sRow
+    {
+        int nSpans;
+        int8_t x1[2], x2[2];
+    };
+    sRow rows[10][nHeight];
+
+    static void Add(sRow& row, int x1, int x2)
+    {
+        row.x1[row.nSpans] = (int8_t)x1;
+        row.x2[row.nSpans] = (int8_t)x2;
+        row.nSpans++;
+    }
+
+    void DrawDigit(olcConsoleGameEngine* engine, int x, int y, int nDigit, short col) const
+    {
+        for (int r = 0; r < nHeight; r++)
+        {
+            const sRow& row = rows[nDigit][r];
+            for (int i = 0; i < row.nSpans; i++)
+                engine->DrawSpan(x + row.x1[i], x + row.x2[i], y + r, L'#', col);
+        }
+    }
+};
+
 
 // Un missile
 class cMissile : public cPhysicsObject
 {
 public:
-    cMissile(float x = 0.0f, float y = 0.0f, float _vx = 0.0f, float _vy = 0.0f) : cPhysicsObject(x, y)
+    cMissile(float x = 0.0f, float y = 0.0f, float _vx = 0.0f, float _vy = 0.0f, const sWeapon* w = sWeapon::Missile()) : cPhysicsObject(x, y)
     {
-        radius = 2.5f;
-        fFriction = 0.5f;
+        pWeapon = w;
+        radius = w->fRadius;
+        fFriction = w->fFriction;
+        fFuse = w->fFuse;
+        fDrag = w->fDrag;
         vx = _vx;
         vy = _vy;
         bDead = false;
 
-        //Le missile explose ds contact, aucun rebond
-        nBounceBeforeDeath = 1;
+        //Le missile explose ds contact, aucun rebond. Une grenade attend son dtonateur
+        nBounceBeforeDeath = w->nBounces;
     }
 
     virtual void Draw(olcConsoleGameEngine* engine, float fOffsetX, float fOffsetY, bool bPixel = false)
@@ -133,7 +589,7 @@ public:
 
     virtual int BounceDeathAction()
     {
-        return 20; // Grosse explosion
+        return pWeapon->nBlast; // Grosse explosion (20 pour le missile)
     }
 
     virtual bool Damage(float d)
@@ -171,6 +627,8 @@ vector<pair<float, float>> DefineMissile()
 }
 vector<pair<float, float>> cMissile::vecModel = DefineMissile();
 
+class cTeam;
+
 // Nos petits soldats
 class cWorm : public cPhysicsObject
 {
@@ -181,6 +639,10 @@ public:
         fFriction = 0.2f;
         bDead = false;
 
+        // Se heurtent entre eux (et s'empilent), et arrtent les dbris
+        nLayer = LAYER_WORM;
+        nCollideWith = LAYER_WORM | LAYER_DEBRIS;
+
         //Ne rebondit pas
         nBounceBeforeDeath = -1;
 
@@ -193,7 +655,7 @@ public:
     {
         if (bIsPlayable)
         {
-            engine->DrawPartialSprite(px - fOffsetX - radius, py - fOffsetY - radius, sprWorm, nTeam * 8, 0, 8, 8);
+            engine->DrawPartialSprite(px - fOffsetX - radius, py - fOffsetY - radius, sprWorm, (nTeam % 4) * 8, 0, 8, 8);
 
             // Bar de sant
             for (int i = 0; i < 11 * fHealth; i++)
@@ -204,7 +666,7 @@ public:
         }
         else  // Dessine une tombe
         {
-            engine->DrawPartialSprite(px - fOffsetX - radius, py - fOffsetY - radius, sprWorm, nTeam * 8, 8, 8, 8);
+            engine->DrawPartialSprite(px - fOffsetX - radius, py - fOffsetY - radius, sprWorm, (nTeam % 4) * 8, 8, 8, 8);
         }
     }
 
@@ -213,17 +675,8 @@ public:
         return 0;
     }
 
-    // Calcul des dommages
-    virtual bool Damage(float d)
-    {
-        fHealth -= d;
-        if (fHealth <= 0)
-        {
-            fHealth = 0.0f;
-            bIsPlayable = false;
-        }
-        return fHealth > 0;
-    }
+    // Calcul des dommages (dfini aprs cTeam, dont il tient les compteurs  jour)
+    virtual bool Damage(float d);
 
 public:
     float fShootAngle = 0.0f;
@@ -231,6 +684,9 @@ public:
     int nTeam = 0;	// ID de l'quipe du Worm
     bool bIsPlayable = true;
 
+    cTeam* pTeam = nullptr;     // Son quipe (nullptr hors partie)
+    int nTeamMember = 0;        // Sa place dans pTeam->vecMembers
+
 private:
     static olcSprite* sprWorm;
 };
@@ -245,319 +701,2416 @@ public:
     int nCurrentMember = 0;
     int nTeamSize = 0;
 
+    // Tenus  jour par cWorm::Damage, pour ne pas reparcourir les membres
+    int nAlive = 0;
+    float fTotalHealth = 0.0f;
+
+    // Les membres en vie forment un anneau (suivant/prcdent, par indice)
+    vector<int> vecNextAlive;
+    vector<int> vecPrevAlive;
+
+    void AddMember(cWorm* w)
+    {
+        int n = (int)vecMembers.size();
+        w->pTeam = this;
+        w->nTeamMember = n;
+        vecMembers.push_back(w);
+        nTeamSize = n + 1;
+        nAlive++;
+        fTotalHealth += w->fHealth;
+
+        // S'insre entre le dernier et le premier
+        vecNextAlive.push_back(0);
+        vecPrevAlive.push_back(n == 0 ? 0 : n - 1);
+        vecNextAlive[vecPrevAlive[n]] = n;
+        vecPrevAlive[0] = n;
+    }
+
+    // Un membre vient de mourir : on le sort de l'anneau
+    void RemoveMember(int n)
+    {
+        nAlive--;
+        vecNextAlive[vecPrevAlive[n]] = vecNextAlive[n];
+        vecPrevAlive[vecNextAlive[n]] = vecPrevAlive[n];
+
+        // Si c'tait le membre courant, son prdcesseur prend sa place
+        // pour que le tour suivant tombe bien sur son successeur
+        if (nCurrentMember == n)
+            nCurrentMember = vecPrevAlive[n];
+    }
+
     // L'quipe a-t-elle tjr des membres en vie ?
     bool IsTeamAlive()
     {
-        bool bAllDead = false;
-        for (auto w : vecMembers)
-            bAllDead |= (w->fHealth > 0.0f);
-        return bAllDead;
+        return nAlive > 0;
     }
 
     cWorm* GetNextNumber()
     {
-        // Renvoie un pointer vers l'quipe suivante prte  tre contrle
-        do {
-            nCurrentMember++;
-            if (nCurrentMember >= nTeamSize) nCurrentMember = 0;
-        } while (vecMembers[nCurrentMember]->fHealth <= 0);
+        // Renvoie un pointer vers le prochain membre en vie prt  tre contrl
+        nCurrentMember = vecNextAlive[nCurrentMember];
         return vecMembers[nCurrentMember];
     }
 };
 
+bool cWorm::Damage(float d)
+{
+    float fOldHealth = fHealth;
+    fHealth -= d;
+    if (fHealth <= 0)
+    {
+        fHealth = 0.0f;
+        bIsPlayable = false;
+    }
+
+    if (pTeam != nullptr)
+    {
+        pTeam->fTotalHealth -= fOldHealth - fHealth;
+        if (fOldHealth > 0.0f && fHealth <= 0.0f)
+            pTeam->RemoveMember(nTeamMember);
+    }
+    return fHealth > 0;
+}
+
 
 
-// Le jeu, qui utilise Console Game Engine
-class Worms : public olcConsoleGameEngine
+// Un petit pool de threads, pour les calculs de l'IA. ParallelFor rpartit
+// les indices entre les threads (le thread appelant compris) et attend la fin
+class cThreadPool
 {
 public:
-    Worms()
+    cThreadPool(int nThreads)
     {
-        m_sAppName = L"Worms";
+        for (int i = 0; i < nThreads; i++)
+            vecThreads.push_back(thread(&cThreadPool::Worker, this));
     }
 
-private:
-
-    //Ressources
+    ~cThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(mux);
+            bQuit = true;
+        }
+        cvWork.notify_all();
+        for (auto& t : vecThreads)
+            t.join();
+    }
 
-    //Map
-    int nMapWidth = 1024;
-    int nMapHeight = 512;
-    char* map = nullptr;
+    int Threads() const
+    {
+        return (int)vecThreads.size() + 1;
+    }
 
-    //Camera
-    float fCameraPosX = 0.0f;
-    float fCameraPosY = 0.0f;
-    float fCameraPosXTarget = 0.0f;
-    float fCameraPosYTarget = 0.0f;
+    void ParallelFor(int nCount, const function<void(int)>& fn)
+    {
+        if (vecThreads.empty() || nCount <= 1)
+        {
+            for (int i = 0; i < nCount; i++)
+                fn(i);
+            return;
+        }
 
-    // TOUS les objets du jeu
-    list<unique_ptr<cPhysicsObject>> listObjects;
+        {
+            lock_guard<mutex> lock(mux);
+            pJob = &fn;
+            nJobCount = nCount;
+            nNext = 0;
+            nBusy = (int)vecThreads.size();
+            nGeneration++;
+        }
+        cvWork.notify_all();
 
-    cPhysicsObject* pObjectUnderControl = nullptr;  //pointer vers object contrl par joueur
-    cPhysicsObject* pCameraTrackingObject = nullptr;//Point vers objet film par la camra
+        RunJob();
 
-    bool bZoomOut = false;
-    bool bGameIsStable = false;
-    bool bEnablePlayerControl = true;
-    bool bEnableComputerControl = false;
+        unique_lock<mutex> lock(mux);
+        cvDone.wait(lock, [&] { return nBusy == 0; });
+        pJob = nullptr;
+    }
 
-    bool bEnergising = false;
-    bool bFireWeapon = false;
-    bool bShowCountDown = false;
-    bool bPlayerHasFired = false;
+private:
+    vector<thread> vecThreads;
+    mutex mux;
+    condition_variable cvWork;
+    condition_variable cvDone;
+    const function<void(int)>* pJob = nullptr;
+    int nJobCount = 0;
+    atomic<int> nNext{ 0 };
+    int nBusy = 0;
+    uint64_t nGeneration = 0;
+    bool bQuit = false;
+
+    void RunJob()
+    {
+        int i;
+        while ((i = nNext++) < nJobCount)
+            (*pJob)(i);
+    }
 
-    float fEnergyLevel = 0.0f;
-    float fTurnTime = 0.0f;
+    void Worker()
+    {
+        uint64_t nSeen = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(mux);
+                cvWork.wait(lock, [&] { return bQuit || nGeneration != nSeen; });
+                if (bQuit)
+                    return;
+                nSeen = nGeneration;
+            }
 
-    // Vector contenant les quipes
-    vector<cTeam>vecTeams;
+            RunJob();
 
-    int nCurrentTeam = 0;
+            lock_guard<mutex> lock(mux);
+            if (--nBusy == 0)
+                cvDone.notify_one();
+        }
+    }
+};
 
-    // Pour contrler l'IA
-    bool bAI_Jump = false;          // IA has appuy sur jump
-    bool bAI_AimLeft = false;       // IA vise  gauche etc.
-    bool bAI_AimRight = false;
-    bool bAI_Energise = false;      // Emmagasine la puissance de son tir
 
-    float fAITargetAngle = 0.0f;
-    float fAITargetEnergy = 0.0f;
-    float fAISafePosition = 0.0f;
-    cWorm* pAITargetWorm = nullptr;
-    float fAITargetX = 0.0f;
-    float fAITargetY = 0.0f;
+// Ecriture et lecture binaires  plat, pour les replays et les snapshots.
+// Les entiers de longueur variable prennent un octet sous 128, deux sous 16384...
+struct sByteWriter
+{
+    vector<uint8_t>& vecBytes;
 
-    // Une numration des game states
-    enum GAME_STATE
+    template<typename T>
+    void Put(const T& v)
     {
-        GS_RESET = 0,
-        GS_GENERATE_TERRAIN = 1,
-        GS_GENERATING_TERRAIN,
-        GS_ALLOCATE_UNITS,
-        GS_ALLOCATING_UNITS,
-        GS_START_PLAY,
-        GS_CAMERA_MODE,
-        GS_GAME_OVER1,
-        GS_GAME_OVER2
-    } nGameState, nNextState;
+        const uint8_t* p = (const uint8_t*)&v;
+        vecBytes.insert(vecBytes.end(), p, p + sizeof(T));
+    }
 
-    // Les diffrentes phases du comportement de l'IA
-    enum AI_STATE
+    void PutVarint(uint32_t n)
     {
-        AI_ASSESS_ENVIRONMENT = 0,
-        AI_MOVE,
-        AI_CHOOSE_TARGET,
-        AI_POSITION_FOR_TARGET,
-        AI_AIM,
-        AI_FIRE
-    } nAIState, nAINextState;
+        while (n >= 0x80)
+        {
+            vecBytes.push_back((uint8_t)(n | 0x80));
+            n >>= 7;
+        }
+        vecBytes.push_back((uint8_t)n);
+    }
+};
 
-    // Cration du jeu
+// Toute lecture au-del de la fin met bOk  false et laisse la valeur intacte
+struct sByteReader
+{
+    const uint8_t* p;
+    const uint8_t* pEnd;
+    bool bOk = true;
 
-    virtual bool OnUserCreate()
+    sByteReader(const vector<uint8_t>& vecBytes) : p(vecBytes.data()), pEnd(vecBytes.data() + vecBytes.size()) {}
+
+    template<typename T>
+    void Get(T& v)
     {
-        // Cration map
-        map = new char[nMapWidth * nMapHeight];
-        memset(map, 0, nMapWidth * nMapHeight * sizeof(char));
+        if (p + sizeof(T) > pEnd)
+        {
+            bOk = false;
+            return;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+    }
 
-        // Remet  zro les states
-        nGameState = GS_RESET;
-        nNextState = GS_RESET;
-        nAIState = AI_ASSESS_ENVIRONMENT;
-        nAINextState = AI_ASSESS_ENVIRONMENT;
+    // Un octet quelconque ne fait pas forcment un bool valide
+    void Get(bool& b)
+    {
+        uint8_t n = b ? 1 : 0;
+        Get(n);
+        b = n != 0;
+    }
 
-        bGameIsStable = false;
-        return true;
+    uint32_t GetVarint()
+    {
+        uint32_t n = 0;
+        for (int nShift = 0; nShift < 35 && p < pEnd; nShift += 7)
+        {
+            uint8_t b = *p++;
+            n |= (uint32_t)(b & 0x7F) << nShift;
+            if (!(b & 0x80))
+                return n;
+        }
+        bOk = false;
+        return 0;
+    }
+
+    // Il reste au moins n octets  lire
+    bool Has(size_t n)
+    {
+        bOk = bOk && (size_t)(pEnd - p) >= n;
+        return bOk;
     }
+};
+
+// Un fichier entier, d'un coup
+static bool WriteBytesToFile(const wstring& sFile, const vector<uint8_t>& vecBytes)
+{
+    FILE* f = nullptr;
+    _wfopen_s(&f, sFile.c_str(), L"wb");
+    if (f == nullptr)
+        return false;
+    bool bOk = fwrite(vecBytes.data(), 1, vecBytes.size(), f) == vecBytes.size();
+    fclose(f);
+    return bOk;
+}
+
+static bool ReadBytesFromFile(const wstring& sFile, vector<uint8_t>& vecBytes)
+{
+    FILE* f = nullptr;
+    _wfopen_s(&f, sFile.c_str(), L"rb");
+    if (f == nullptr)
+        return false;
+
+    vecBytes.clear();
+    uint8_t buf[4096];
+    size_t nRead = 0;
+    while ((nRead = fread(buf, 1, sizeof(buf), f)) > 0)
+        vecBytes.insert(vecBytes.end(), buf, buf + nRead);
+    fclose(f);
+    return true;
+}
 
+// Les armes du jeu, lues dans un fichier texte (armes.txt) : une arme par ligne,
+// son nom puis ses valeurs, par exemple
+//     grenade rebonds=-1 detonateur=3 souffle=25
+// Ce qui n'est pas donn garde la valeur du missile. Les armes font partie des
+// replays : une partie se rejoue avec celles qu'elle avait
+class cWeapons
+{
+public:
+    cWeapons() { Reset(); }
+    cWeapons(const cWeapons& o) : vecWeapons(o.vecWeapons) { Compile(); }
+    cWeapons& operator=(const cWeapons& o)
+    {
+        vecWeapons = o.vecWeapons;
+        Compile();
+        return *this;
+    }
 
+    int Size() const { return (int)vecWeapons.size(); }
+    const sWeapon* operator[](int i) const { return &vecWeapons[i]; }
 
-    /*
-    * La boucle de jeu (Game Loop)
-    * "On User Update"
-    */
-    virtual bool OnUserUpdate(float fElapsedTime)
+    // L'indice d'une arme de la table, -1 pour une autre (le missile d'origine)
+    int IndexOf(const sWeapon* w) const
     {
-        // Tab permet de zoomer et dzoomer
-        if (m_keys[VK_TAB].bReleased)
-            bZoomOut = !bZoomOut;
+        return w >= vecWeapons.data() && w < vecWeapons.data() + vecWeapons.size() ? (int)(w - vecWeapons.data()) : -1;
+    }
 
-        // Scroller la carte avec la souris
-        float fMapScrollSpeed = 400.0f;
-        if (m_mousePosX < 20) fCameraPosX -= fMapScrollSpeed * fElapsedTime;
-        if (m_mousePosX > ScreenWidth() - 20) fCameraPosX += fMapScrollSpeed * fElapsedTime;
-        if (m_mousePosY < 20) fCameraPosY -= fMapScrollSpeed * fElapsedTime;
-        if (m_mousePosY > ScreenHeight() - 20) fCameraPosY += fMapScrollSpeed * fElapsedTime;
+    int Find(const string& sName) const
+    {
+        for (int i = 0; i < Size(); i++)
+            if (sName == vecWeapons[i].sName)
+                return i;
+        return -1;
+    }
 
+    // Le missile seul, comme avant les armes
+    void Reset()
+    {
+        vecWeapons.assign(1, *sWeapon::Missile());
+        Compile();
+    }
 
-        // Dfinit les phases (states) du jeu
-        switch (nGameState)
+    // Renvoie false (et garde les armes d'avant) si le fichier est absent ou faux
+    bool Load(const wstring& sFile)
+    {
+        vector<uint8_t> vecFile;
+        if (!ReadBytesFromFile(sFile, vecFile))
+            return false;
+
+        vector<sWeapon> vecLoaded;
+        vector<string> vecChildren;     // Les projectiles lancs, par leur nom
+        string sText(vecFile.begin(), vecFile.end());
+        for (size_t nStart = 0; nStart < sText.size();)
         {
-        case GS_RESET:
+            size_t nEnd = min(sText.find('\n', nStart), sText.size());
+            string sLine = sText.substr(nStart, nEnd - nStart);
+            nStart = nEnd + 1;
+            sLine = sLine.substr(0, sLine.find('#'));
+
+            vector<string> vecWords;
+            for (size_t i = 0; i < sLine.size();)
+            {
+                size_t j = min(sLine.find_first_of(" \t\r", i), sLine.size());
+                if (j > i)
+                    vecWords.push_back(sLine.substr(i, j - i));
+                i = j + 1;
+            }
+            if (vecWords.empty())
+                continue;
+
+            sWeapon w;
+            if (vecWords[0].size() >= sizeof(w.sName))
+                return false;
+            memset(w.sName, 0, sizeof(w.sName));
+            memcpy(w.sName, vecWords[0].data(), vecWords[0].size());
+
+            string sChild;
+            for (size_t i = 1; i < vecWords.size(); i++)
+            {
+                size_t nEqual = vecWords[i].find('=');
+                if (nEqual == string::npos)
+                    return false;
+                string sKey = vecWords[i].substr(0, nEqual);
+                string sValue = vecWords[i].substr(nEqual + 1);
+                char* pEnd = nullptr;
+                float f = strtof(sValue.c_str(), &pEnd);
+                bool bNumber = !sValue.empty() && *pEnd == 0;
+
+                if (sKey == "projectile") sChild = sValue;
+                else if (sKey == "lance")
+                {
+                    if (sValue == "rien") w.nSpawn = sWeapon::SPAWN_NONE;
+                    else if (sValue == "eclats") w.nSpawn = sWeapon::SPAWN_BURST;
+                    else if (sValue == "ciel") w.nSpawn = sWeapon::SPAWN_SKY;
+                    else return false;
+                }
+                else if (!bNumber) return false;
+                else if (sKey == "rayon") w.fRadius = f;
+                else if (sKey == "friction") w.fFriction = f;
+                else if (sKey == "rebonds") w.nBounces = (int)f;
+                else if (sKey == "detonateur") w.fFuse = f;
+                else if (sKey == "souffle") w.nBlast = (int)f;
+                else if (sKey == "degats") w.fDamage = f;
+                else if (sKey == "attenuation") w.fFalloff = f;
+                else if (sKey == "impulsion") w.fKick = f;
+                else if (sKey == "attenuation_impulsion") w.fKickFalloff = f;
+                else if (sKey == "nombre") w.nChildren = (int)f;
+                else if (sKey == "dispersion") w.fSpread = f;
+                else if (sKey == "trainee") w.fDrag = f;
+                else if (sKey == "poussee") w.fPush = f;
+                else return false;
+            }
+            vecLoaded.push_back(w);
+            vecChildren.push_back(sChild);
+        }
+
+        // Un projectile peut tre dcrit plus bas que l'arme qui le lance
+        for (size_t i = 0; i < vecLoaded.size(); i++)
         {
-            bEnablePlayerControl = false;
-            bGameIsStable = false;
-            bPlayerHasFired = false;
-            bShowCountDown = false;
-            nNextState = GS_GENERATE_TERRAIN;
+            if (vecChildren[i].empty())
+                continue;
+            for (size_t j = 0; j < vecLoaded.size(); j++)
+                if (vecChildren[i] == vecLoaded[j].sName)
+                    vecLoaded[i].nChild = (int)j;
+            if (vecLoaded[i].nChild < 0)
+                return false;
         }
-        break;
 
-        case GS_GENERATE_TERRAIN:
+        vecLoaded.swap(vecWeapons);
+        if (Compile())
+            return true;
+        vecLoaded.swap(vecWeapons);
+        Compile();
+        return false;
+    }
+
+    void Write(sByteWriter& w) const
+    {
+        w.PutVarint((uint32_t)vecWeapons.size());
+        for (auto& e : vecWeapons)
         {
-            bZoomOut = false;
-            CreateMap();
-            bGameIsStable = false;
-            bShowCountDown = false;
-            nNextState = GS_GENERATING_TERRAIN;
+            w.Put(e.sName); w.Put(e.fRadius); w.Put(e.fFriction); w.Put(e.nBounces); w.Put(e.fFuse);
+            w.Put(e.nBlast); w.Put(e.fDamage); w.Put(e.fFalloff);
+            w.Put(e.nSpawn); w.Put(e.nChildren); w.Put(e.nChild); w.Put(e.fSpread);
+            w.Put(e.fDrag); w.Put(e.fPush);
+            w.Put(e.fKick); w.Put(e.fKickFalloff);
         }
-        break;
+    }
 
-        case GS_GENERATING_TERRAIN:
+    // Renvoie false, avec le missile seul, si la table est fausse. Les replays de
+    // version 7 n'avaient ni trane ni souffle, ceux d'avant la 9 pas d'impulsion
+    bool Read(sByteReader& r, uint32_t nFileVersion)
+    {
+        uint32_t nCount = r.GetVarint();
+        r.Has((size_t)nCount * 57);
+        vecWeapons.assign(r.bOk && nCount <= nMaxWeapons ? nCount : 0, sWeapon());
+        for (auto& e : vecWeapons)
         {
-            bShowCountDown = false;
-            if (bGameIsStable)
-                nNextState = GS_ALLOCATE_UNITS;
+            r.Get(e.sName); r.Get(e.fRadius); r.Get(e.fFriction); r.Get(e.nBounces); r.Get(e.fFuse);
+            r.Get(e.nBlast); r.Get(e.fDamage); r.Get(e.fFalloff);
+            r.Get(e.nSpawn); r.Get(e.nChildren); r.Get(e.nChild); r.Get(e.fSpread);
+            if (nFileVersion >= 8)
+            {
+                r.Get(e.fDrag); r.Get(e.fPush);
+            }
+            if (nFileVersion >= 9)
+            {
+                r.Get(e.fKick); r.Get(e.fKickFalloff);
+            }
         }
-        break;
+        if (r.bOk && Compile())
+            return true;
+        Reset();
+        return false;
+    }
 
-        case GS_ALLOCATE_UNITS:
+    // Au plus 254 armes : un snapshot les note sur un octet, 255 pour le missile d'origine
+    static const uint32_t nMaxWeapons = 254;
+
+private:
+    vector<sWeapon> vecWeapons;
+
+    // Vrifie les valeurs et relie chaque arme  ses projectiles. Ceux-ci ne lancent
+    // rien  leur tour : une bombe  fragmentation reste  nChildren objets de plus
+    bool Compile()
+    {
+        bool bOk = !vecWeapons.empty() && vecWeapons.size() <= nMaxWeapons;
+        for (auto& e : vecWeapons)
         {
-            // Dployer les quipes
-            int nTeams = 4;
-            int nWormsPerTeam = 3;
+            e.sName[sizeof(e.sName) - 1] = 0;
+            e.pChild = nullptr;
+            bOk = bOk && e.fRadius >= 0.5f && e.fRadius <= 16.0f && e.fFriction >= 0.0f && e.fFriction <= 1.0f;
+            bOk = bOk && e.fFuse >= 0.0f && e.fFuse <= 60.0f && (e.nBounces > 0 || (e.nBounces == -1 && e.fFuse > 0.0f));
+            bOk = bOk && e.nBlast >= 0 && e.nBlast <= 128 && e.fDamage >= 0.0f && e.fDamage <= 10.0f && e.fFalloff > 0.0f && e.fFalloff <= 16.0f;
+            bOk = bOk && e.fDrag >= 0.0f && e.fDrag <= 1.0f && e.fPush >= 0.0f && e.fPush <= 100.0f;
+            bOk = bOk && e.fKick >= 0.0f && e.fKick <= 10.0f && e.fKickFalloff >= 0.0f && e.fKickFalloff <= 16.0f;
+            if (e.nSpawn == sWeapon::SPAWN_NONE)
+                continue;
+            bOk = bOk && e.nSpawn <= sWeapon::SPAWN_SKY && e.nChildren >= 1 && e.nChildren <= 64 && e.fSpread >= 0.0f && e.fSpread <= 100.0f;
+            bOk = bOk && e.nChild >= 0 && e.nChild < (int)vecWeapons.size() && vecWeapons[e.nChild].nSpawn == sWeapon::SPAWN_NONE;
+            if (bOk)
+                e.pChild = &vecWeapons[e.nChild];
+        }
+        return bOk;
+    }
+};
 
-            // Calculer l'espacement
-            float fSpacePerTeam = (float)nMapWidth / (float)nTeams;
-            float fSpacePerWorm = fSpacePerTeam / (nWormsPerTeam * 2.0f);
+// Ce qui fabrique la map  la demande, case par case. Le rsultat ne doit
+// dpendre que de la position : une tuile jete puis refaite est identique
+class cTerrainSource
+{
+public:
+    virtual ~cTerrainSource() {}
+    virtual char Cell(int x, int y) const = 0;
 
-            // Crer les quipes
-            for (int t = 0; t < nTeams; t++)
-            {
-                vecTeams.emplace_back(cTeam());
-                float fTeamMiddle = (fSpacePerTeam / 2.0f) + (t * fSpacePerTeam);
-                for (int w = 0; w < nWormsPerTeam; w++)
-                {
-                    float fWormX = fTeamMiddle - ((fSpacePerWorm * (float)nWormsPerTeam) / 2.0f) + w * fSpacePerWorm;
-                    float fWormY = 0.0f;
+    // Le ciel au-dessus du sol : un dgrad sur le premier tiers de la hauteur
+    static char Sky(int y, int nHeight)
+    {
+        if ((float)y < (float)nHeight / 3.0f)
+            return (char)((-8.0f * ((float)y / (nHeight / 3.0f))) - 1.0f);
+        else
+            return 0;
+    }
+};
 
-                    // Crer les Worms
-                    cWorm* worm = new cWorm(fWormX, fWormY);
-                    worm->nTeam = t;
-                    listObjects.push_back(unique_ptr<cWorm>(worm));
-                    vecTeams[t].vecMembers.push_back(worm);
-                    vecTeams[t].nTeamSize = nWormsPerTeam;
-                }
+// La map de CreateMap : une surface en bruit de Perlin, la terre en dessous
+// et un dgrad en haut du ciel
+class cNoiseTerrain : public cTerrainSource
+{
+public:
+    vector<float> vecSurface;   // Hauteur du sol par colonne, entre 0 et 1
+    int nHeight = 0;
+    uint32_t nSeed = 0;         // L'tat de cRandom qui a donn le bruit
 
-                vecTeams[t].nCurrentMember;
-            }
+    char Cell(int x, int y) const override
+    {
+        if (y >= vecSurface[x] * nHeight)
+            return 1;
+        else
+            return Sky(y, nHeight);
+    }
+};
 
-            // Slectionne le premier Worm a tre jou et film
-            pObjectUnderControl = vecTeams[0].vecMembers[vecTeams[0].nCurrentMember];
-            pCameraTrackingObject = pObjectUnderControl;
-            bShowCountDown = false;
-            nNextState = GS_ALLOCATING_UNITS;
-        }
-        break;
+// Un fichier projet en mmoire, en lecture seule : ses pages ne sont lues
+// qu'au premier accs, et rien n'est copi
+class cMappedFile
+{
+public:
+    ~cMappedFile()
+    {
+        Close();
+    }
 
-        case GS_ALLOCATING_UNITS:
+    bool Open(const wstring& sFile)
+    {
+        Close();
+#ifdef _WIN32
+        HANDLE hFile = CreateFileW(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER nFileSize;
+        if (GetFileSizeEx(hFile, &nFileSize) && nFileSize.QuadPart > 0)
         {
-            if (bGameIsStable)
+            HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (hMapping != nullptr)
             {
-                bEnablePlayerControl = true;
-                bEnableComputerControl = false;
-                fTurnTime = 15.0f;
-                bZoomOut = false;
-                nNextState = GS_START_PLAY;
+                pData = (const uint8_t*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(hMapping);
             }
+            nSize = pData != nullptr ? (size_t)nFileSize.QuadPart : 0;
         }
-        break;
-        // Le joueur contrle le Worm et n'a pas encore tir
-        case GS_START_PLAY:
+        CloseHandle(hFile);
+#else
+        string sName(sFile.begin(), sFile.end());
+        int fd = open(sName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
         {
-            bShowCountDown = true;
-
-            if (bPlayerHasFired || fTurnTime <= 0.0f)
-                nNextState = GS_CAMERA_MODE;
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                pData = (const uint8_t*)p;
+                nSize = (size_t)st.st_size;
+            }
         }
-        break;
-        // Missile tir ! On suit l'action avec la camra
-        case GS_CAMERA_MODE:
-        {
-            bEnablePlayerControl = false;
-            bEnableComputerControl = false;
-            bPlayerHasFired = false;
-            bShowCountDown = false;
-            fEnergyLevel = 0.0f;
+        close(fd);
+#endif
+        return pData != nullptr;
+    }
 
-            // Une fois que tous les objets sont au repos
-            if (bGameIsStable)
-            {
-                // Equipe suivante
-                int nOldTeam = nCurrentTeam;
-                do {
-                    nCurrentTeam++;
-                    nCurrentTeam %= vecTeams.size();
-                } while (!vecTeams[nCurrentTeam].IsTeamAlive());
+    void Close()
+    {
+        if (pData != nullptr)
+#ifdef _WIN32
+            UnmapViewOfFile(pData);
+#else
+            munmap((void*)pData, nSize);
+#endif
+        pData = nullptr;
+        nSize = 0;
+    }
 
-                // Bloque contrle joueur quand l'IA joue
-                if (nCurrentTeam == 0)
-                {
-                    bEnablePlayerControl = true;
-                    bEnableComputerControl = false;
-                }
-                else
-                {
-                    bEnablePlayerControl = false;
-                    bEnableComputerControl = true;
-                }
+    const uint8_t* Data() const { return pData; }
+    size_t Size() const { return nSize; }
 
-                // Contrles et camera
-                pObjectUnderControl = vecTeams[nCurrentTeam].GetNextNumber();
-                pCameraTrackingObject = pObjectUnderControl;
-                fTurnTime = 15.0f;
-                bZoomOut = false;
-                nNextState = GS_START_PLAY;
+private:
+    const uint8_t* pData = nullptr;
+    size_t nSize = 0;
+};
 
-                // S'il n'y a plus d'autres quipes...
-                if (nCurrentTeam == nOldTeam)
-                {
-                    //... Game Over !
-                    nNextState = GS_GAME_OVER1;
-                }
-            }
+// Une map dessine  la main : un masque PBM binaire (P4, un bit par case, noir
+// pour la terre) et,  ct, un PGM (P5) de mme taille qui donne la teinte du
+// sol, s'il existe. Les deux fichiers sont projets en mmoire et lus case par
+// case quand une tuile est fabrique ; les cratres ne touchent qu'aux tuiles
+// (copies  leur premier Prepare), jamais aux fichiers
+class cBitmapTerrain : public cTerrainSource
+{
+public:
+    static const int nShades = 4;   // Teintes du sol, de 1  nShades
+
+    int nWidth = 0;
+    int nHeight = 0;
+
+    bool Open(const wstring& sMaskFile)
+    {
+        Close();
+        int nMaxValue = 1;
+        if (!mask.Open(sMaskFile) || !ReadHeader(mask, "P4", nWidth, nHeight, nMaxValue, pMask) ||
+            mask.Size() - (size_t)(pMask - mask.Data()) < (size_t)nMaskStride() * nHeight)
+        {
+            Close();
+            return false;
         }
-        break;
 
-        case GS_GAME_OVER1: // On dzoome et on clbre a par un grand tir de missiles !
+        // La teinte est facultative, mais doit correspondre au masque
+        size_t nDot = sMaskFile.find_last_of(L'.');
+        wstring sShadeFile = sMaskFile.substr(0, nDot) + L".pgm";
+        int w = 0, h = 0;
+        if (!shade.Open(sShadeFile) || !ReadHeader(shade, "P5", w, h, nMaxValue, pShade) ||
+            w != nWidth || h != nHeight || nMaxValue > 255 ||
+            shade.Size() - (size_t)(pShade - shade.Data()) < (size_t)nWidth * nHeight)
         {
-            bEnableComputerControl = false;
-            bEnablePlayerControl = false;
-            bZoomOut = true;
-            bShowCountDown = false;
+            shade.Close();
+            pShade = nullptr;
+        }
+        nShadeMax = nMaxValue;
+        return true;
+    }
 
-            for (int i = 0; i < 100; i++)
-            {
-                int nBombX = rand() % nMapWidth;
-                int nBombY = rand() % (nMapHeight / 2);
-                listObjects.push_back(unique_ptr<cMissile>(new cMissile(nBombX, nBombY, 0.0f, 0.5f)));
-            }
+    void Close()
+    {
+        mask.Close();
+        shade.Close();
+        pMask = pShade = nullptr;
+        nWidth = nHeight = 0;
+    }
 
-            nNextState = GS_GAME_OVER2;
-        }
-        break;
+    bool IsOpen() const
+    {
+        return pMask != nullptr;
+    }
 
-        case GS_GAME_OVER2: // On attend le retour du calme
+    char Cell(int x, int y) const override
+    {
+        if (!(pMask[(size_t)y * nMaskStride() + (x >> 3)] & (0x80 >> (x & 7))))
+            return Sky(y, nHeight);
+        if (pShade == nullptr)
+            return 1;
+        // Un gris au-del du maximum annonc par l'en-tte compte comme ce maximum
+        int nShade = min((int)pShade[(size_t)y * nWidth + x], nShadeMax);
+        return (char)(1 + nShade * nShades / (nShadeMax + 1));
+    }
+
+    // Ecrit le masque d'une map (Cell > 0 : de la terre) au format que lit Open
+    template<typename MAP>
+    static bool SaveMask(const wstring& sFile, const MAP& map, int w, int h)
+    {
+        string sHeader = "P4\n" + to_string(w) + " " + to_string(h) + "\n";
+        vector<uint8_t> vecFile(sHeader.begin(), sHeader.end());
+        size_t nStride = (size_t)(w + 7) / 8;
+        vecFile.resize(vecFile.size() + nStride * h);
+        uint8_t* pRow = vecFile.data() + sHeader.size();
+        for (int y = 0; y < h; y++, pRow += nStride)
+            for (int x = 0; x < w; x++)
+                if (map.Peek(x, y) > 0)
+                    pRow[x >> 3] |= 0x80 >> (x & 7);
+        return WriteBytesToFile(sFile, vecFile);
+    }
+
+private:
+    cMappedFile mask;
+    cMappedFile shade;
+    const uint8_t* pMask = nullptr;
+    const uint8_t* pShade = nullptr;
+    int nShadeMax = 255;
+
+    int nMaskStride() const
+    {
+        return (nWidth + 7) / 8;
+    }
+
+    // L'en-tte texte des formats Netpbm : le type, la largeur, la hauteur et (sauf
+    // pour P4) la valeur maximale, spars de blancs et de commentaires, puis un
+    // seul blanc avant les donnes
+    static bool ReadHeader(const cMappedFile& f, const char* sType, int& w, int& h, int& nMaxValue, const uint8_t*& pData)
+    {
+        const uint8_t* p = f.Data();
+        const uint8_t* pEnd = p + f.Size();
+        if (f.Size() < 2 || p[0] != sType[0] || p[1] != sType[1])
+            return false;
+        p += 2;
+
+        int nValues[3] = { 0, 0, 1 };
+        int nCount = sType[1] == '4' ? 2 : 3;
+        for (int i = 0; i < nCount; i++)
         {
-            bEnableComputerControl = false;
-            bEnablePlayerControl = false;
-            // Il n'y a pas de sortie de cette phase, le jeu n'a pas de fin en soi
-        }
-        break;
+            while (p < pEnd && (isspace(*p) || *p == '#'))
+                if (*p++ == '#')
+                    while (p < pEnd && *p != '\n')
+                        p++;
+            if (p == pEnd || !isdigit(*p))
+                return false;
+            long long n = 0;
+            while (p < pEnd && isdigit(*p) && n <= 0x100000)
+                n = n * 10 + (*p++ - '0');
+            nValues[i] = (int)min(n, 0x100001LL);
         }
+        if (p == pEnd || !isspace(*p))
+            return false;
+        pData = p + 1;
+        w = nValues[0];
+        h = nValues[1];
+        nMaxValue = nValues[2];
+        return w >= 256 && h >= 160 && w <= 0x100000 && h <= 0x10000 && nMaxValue >= 1;
+    }
+};
 
-        if (bEnableComputerControl)
+// Le champ de distance signe d'une map : pour chaque case, la distance de son
+// centre au bord du terrain, positive dans le ciel, ngative dans la terre, et
+// borne  nRange cases. Une seule lecture donne  un objet sa distance au sol,
+// et la pente du champ la normale du terrain, pour le faire rebondir.
+// Il est fait tuile par tuile (les mmes que cTerrain),  la demande, par une
+// transforme de chanfrein sur la tuile et nRange cases autour ; une tuile n'est
+// refaite que si elle ou l'une de ses voisines a chang (un cratre), ce que dit
+// FieldStamp de la map. Une tuile loin du bord du terrain pointe sur l'une des
+// deux tuiles constantes, et ne cote rien
+class cDistanceField
+{
+public:
+    static const int nTileShift = 6;
+    static const int nTileSize = 1 << nTileShift;
+    static const int nTileMask = nTileSize - 1;
+    static const int nRange = 8;        // Distance maximale, en cases
+    static const int nScale = 4;        // Units (int8_t) par case
+
+    // Les tuiles ne sont alloues qu'au premier champ fait : une copie de la map
+    // pour un tir d'essai n'en a souvent pas besoin
+    void Reset(int nTilesX, int nTilesY)
+    {
+        this->nTilesX = nTilesX;
+        this->nTilesY = nTilesY;
+        vecTiles.clear();
+    }
+
+    // Le champ d'une tuile, refait s'il a chang. TERRAIN donne Get, Prepare,
+    // Generation (change  chaque modification) et FieldStamp (change quand la
+    // tuile ou une voisine change)
+    template<typename TERRAIN>
+    const int8_t* Tile(TERRAIN& terrain, int tx, int ty)
+    {
+        if (vecTiles.empty())
+            vecTiles.resize((size_t)nTilesX * nTilesY);
+        sFieldTile& t = vecTiles[ty * nTilesX + tx];
+        if (t.pCells != nullptr && t.nChecked == terrain.Generation())
+            return t.pCells;
+
+        uint64_t nStamp = terrain.FieldStamp(tx, ty);
+        if (t.pCells == nullptr || t.nStamp != nStamp)
+        {
+            Build(terrain, tx, ty, t);
+            t.nStamp = nStamp;
+        }
+        t.nChecked = terrain.Generation();
+        return t.pCells;
+    }
+
+    // Le champ d'une tuile s'il est  jour, sinon nullptr. Ne modifie rien : les
+    // tirs d'essai de l'IA le lisent depuis plusieurs threads
+    template<typename TERRAIN>
+    const int8_t* ValidTile(const TERRAIN& terrain, int tx, int ty) const
+    {
+        if (vecTiles.empty())
+            return nullptr;
+        const sFieldTile& t = vecTiles[ty * nTilesX + tx];
+        if (t.pCells == nullptr || (t.nChecked != terrain.Generation() && t.nStamp != terrain.FieldStamp(tx, ty)))
+            return nullptr;
+        return t.pCells;
+    }
+
+    // Oublie le champ d'une tuile (il sera refait au besoin)
+    void Release(int i)
+    {
+        if (!vecTiles.empty())
+            vecTiles[i] = sFieldTile();
+    }
+
+    size_t Bytes() const
+    {
+        size_t n = 0;
+        for (auto& t : vecTiles)
+            n += t.pOwned != nullptr ? (size_t)nTileSize * nTileSize : 0;
+        return n;
+    }
+
+    // La distance (en cases) du point (x, y) au terrain, interpole entre les
+    // centres des cases. TERRAIN donne nWidth, nHeight et FieldTile
+    template<typename TERRAIN>
+    static float Distance(TERRAIN& terrain, float x, float y)
+    {
+        // Borne  la map, comme les sondes de collision (NaN compris)
+        float u = x - 0.5f;
+        float v = y - 0.5f;
+        if (!(u >= 0.0f)) u = 0.0f;
+        if (!(v >= 0.0f)) v = 0.0f;
+        if (u > terrain.nWidth - 1) u = (float)(terrain.nWidth - 1);
+        if (v > terrain.nHeight - 1) v = (float)(terrain.nHeight - 1);
+
+        int i = (int)u;
+        int j = (int)v;
+        float fx = u - i;
+        float fy = v - j;
+        int i1 = min(i + 1, terrain.nWidth - 1);
+        int j1 = min(j + 1, terrain.nHeight - 1);
+        float d00, d10, d01, d11;
+        if (((i ^ i1) | (j ^ j1)) >> nTileShift == 0)
+        {
+            // Les quatre cases dans la mme tuile, le plus souvent
+            const int8_t* t = terrain.FieldTile(i >> nTileShift, j >> nTileShift);
+            int k = ((j & nTileMask) << nTileShift) | (i & nTileMask);
+            int di = i1 - i;
+            int dj = (j1 - j) << nTileShift;
+            d00 = t[k]; d10 = t[k + di]; d01 = t[k + dj]; d11 = t[k + di + dj];
+        }
+        else
+        {
+            d00 = Sample(terrain, i, j); d10 = Sample(terrain, i1, j);
+            d01 = Sample(terrain, i, j1); d11 = Sample(terrain, i1, j1);
+        }
+        return ((d00 * (1.0f - fx) + d10 * fx) * (1.0f - fy) + (d01 * (1.0f - fx) + d11 * fx) * fy) / nScale;
+    }
+
+    // La pente du champ en (x, y) : la normale du terrain, tourne vers le ciel, non
+    // norme (nulle loin du terrain)
+    template<typename TERRAIN>
+    static void Gradient(TERRAIN& terrain, float x, float y, float& gx, float& gy)
+    {
+        gx = Distance(terrain, x + 1.0f, y) - Distance(terrain, x - 1.0f, y);
+        gy = Distance(terrain, x, y + 1.0f) - Distance(terrain, x, y - 1.0f);
+    }
+
+private:
+    struct sFieldTile
+    {
+        const int8_t* pCells = nullptr;     // pOwned, ou une tuile constante
+        unique_ptr<int8_t[]> pOwned;
+        uint64_t nStamp = 0;                // FieldStamp de la map quand il a t fait
+        uint32_t nChecked = 0;              // Generation de la map quand il a t vrifi
+    };
+
+    int nTilesX = 0;
+    int nTilesY = 0;
+    vector<sFieldTile> vecTiles;
+
+    template<typename TERRAIN>
+    static float Sample(TERRAIN& terrain, int i, int j)
+    {
+        return terrain.FieldTile(i >> nTileShift, j >> nTileShift)[((j & nTileMask) << nTileShift) | (i & nTileMask)];
+    }
+
+    // Tout le champ  nRange cases de la terre, ou du ciel
+    static const int8_t* Constant(bool bSolid)
+    {
+        static vector<int8_t> vecSky(nTileSize * nTileSize, (int8_t)(nRange * nScale));
+        static vector<int8_t> vecSolid(nTileSize * nTileSize, (int8_t)(-nRange * nScale));
+        return bSolid ? vecSolid.data() : vecSky.data();
+    }
+
+    template<typename TERRAIN>
+    static void Build(TERRAIN& terrain, int tx, int ty, sFieldTile& t)
+    {
+        // La tuile et nRange cases autour, bornes  la map
+        const int nPad = nRange + 1;
+        const int nSize = nTileSize + 2 * nPad;
+        int x0 = (tx << nTileShift) - nPad;
+        int y0 = (ty << nTileShift) - nPad;
+        terrain.Prepare((float)x0, (float)y0, (float)(x0 + nSize - 1), (float)(y0 + nSize - 1));
+
+        vector<uint8_t> vecSolid(nSize * nSize);
+        int nSolid = 0;
+        for (int j = 0; j < nSize; j++)
+        {
+            int y = min(max(y0 + j, 0), terrain.nHeight - 1);
+            for (int i = 0; i < nSize; i++)
+            {
+                int x = min(max(x0 + i, 0), terrain.nWidth - 1);
+                vecSolid[j * nSize + i] = terrain.Get(x, y) > 0;
+                nSolid += vecSolid[j * nSize + i];
+            }
+        }
+
+        if (nSolid == 0 || nSolid == nSize * nSize)
+        {
+            t.pOwned.reset();
+            t.pCells = Constant(nSolid != 0);
+            return;
+        }
+
+        // Chanfrein 3-4 : 3 par case droite, 4 en diagonale. Deux passes donnent la
+        // distance de chaque case  la terre, deux autres celle  la case de ciel la plus proche
+        vector<int16_t> vecToSolid(nSize * nSize), vecToSky(nSize * nSize);
+        Chamfer(vecSolid, 1, vecToSolid, nSize);
+        Chamfer(vecSolid, 0, vecToSky, nSize);
+
+        if (t.pOwned == nullptr)
+            t.pOwned.reset(new int8_t[nTileSize * nTileSize]);
+        for (int j = 0; j < nTileSize; j++)
+            for (int i = 0; i < nTileSize; i++)
+            {
+                int k = (j + nPad) * nSize + i + nPad;
+                float d = vecSolid[k] ? -(vecToSky[k] / 3.0f - 0.5f) : vecToSolid[k] / 3.0f - 0.5f;
+                d = min(max(d, (float)-nRange), (float)nRange);
+                t.pOwned[(j << nTileShift) + i] = (int8_t)lroundf(d * nScale);
+            }
+        t.pCells = t.pOwned.get();
+    }
+
+    // La distance de chanfrein de chaque case  la plus proche valant nTarget
+    static void Chamfer(const vector<uint8_t>& vecSolid, uint8_t nTarget, vector<int16_t>& vecDist, int nSize)
+    {
+        const int16_t nFar = (nRange + 2) * 3;
+        for (size_t k = 0; k < vecDist.size(); k++)
+            vecDist[k] = vecSolid[k] == nTarget ? 0 : nFar;
+
+        for (int j = 0; j < nSize; j++)
+            for (int i = 0; i < nSize; i++)
+            {
+                int16_t& d = vecDist[j * nSize + i];
+                if (i > 0) d = min<int16_t>(d, vecDist[j * nSize + i - 1] + 3);
+                if (j > 0)
+                {
+                    d = min<int16_t>(d, vecDist[(j - 1) * nSize + i] + 3);
+                    if (i > 0) d = min<int16_t>(d, vecDist[(j - 1) * nSize + i - 1] + 4);
+                    if (i < nSize - 1) d = min<int16_t>(d, vecDist[(j - 1) * nSize + i + 1] + 4);
+                }
+            }
+        for (int j = nSize - 1; j >= 0; j--)
+            for (int i = nSize - 1; i >= 0; i--)
+            {
+                int16_t& d = vecDist[j * nSize + i];
+                if (i < nSize - 1) d = min<int16_t>(d, vecDist[j * nSize + i + 1] + 3);
+                if (j < nSize - 1)
+                {
+                    d = min<int16_t>(d, vecDist[(j + 1) * nSize + i] + 3);
+                    if (i < nSize - 1) d = min<int16_t>(d, vecDist[(j + 1) * nSize + i + 1] + 4);
+                    if (i > 0) d = min<int16_t>(d, vecDist[(j + 1) * nSize + i - 1] + 4);
+                }
+            }
+    }
+};
+
+// La map, en tuiles de 64x64. Une tuile d'une seule valeur (ciel uni, terre
+// pleine) n'est qu'un drapeau et cette valeur, et ses cases pointent sur une
+// tuile partage par toutes celles de mme valeur : une bonne partie de la map
+// ne cote rien en mmoire, la lecture d'une case reste sans condition, et la
+// physique comme le rendu traitent ces tuiles d'un bloc.
+// Chaque modification donne  sa tuile une nouvelle gnration : ce qui dpend
+// de la map (rendu, snapshots...) retient celle qu'il a vue et ne refait que les
+// tuiles qui ont chang depuis.
+// Sur une trs grande map, les tuiles ne sont fabriques (par pSource) qu'au
+// premier Prepare qui les touche, et Evict range les moins rcentes : la mmoire
+// reste borne quelle que soit la taille de la map
+class cTerrain
+{
+public:
+    static const int nTileShift = 6;
+    static const int nTileSize = 1 << nTileShift;
+    static const int nTileMask = nTileSize - 1;
+    static const int nTileCells = nTileSize * nTileSize;
+
+    // Une tuile sur disque (WriteTile)
+    enum TILE_KIND
+    {
+        TILE_UNIFORM = 0,       // Une valeur
+        TILE_CELLS = 1,         // Des plages de cases
+        TILE_SOURCE = 2         // Telle que la fait pSource
+    };
+
+    struct sTile
+    {
+        bool bLoaded = true;        // Ses cases sont en mmoire (sinon,  refaire ou  dballer)
+        bool bUniform = true;       // Toute la tuile vaut nValue
+        bool bModified = false;     // Diffre de ce que fait pSource (cratres, snapshot)
+        char nValue = 0;
+        uint32_t nGeneration = 0;
+        uint32_t nLastUse = 0;      // nClock de son dernier Prepare
+        unique_ptr<char[]> pOwned;  // Ses propres cases, si elle n'est pas unie
+        vector<uint8_t> vecPacked;  // Range par Evict alors que modifie, au format WriteTile
+    };
+
+    int nWidth = 0;
+    int nHeight = 0;
+    int nTilesX = 0;
+    int nTilesY = 0;
+    uint32_t nGeneration = 0;       // Celle de la dernire modification, toutes tuiles confondues
+    uint32_t nClock = 0;            // Avance  chaque Evict
+    size_t nMaxLoadedTiles = 4096;  // Tuiles non unies en mmoire au-del desquelles Evict range (16 Mo)
+    const cTerrainSource* pSource = nullptr;    // nullptr : du ciel uni
+    cDistanceField field;                       // Fait au fur et  mesure des collisions
+
+    // Une map de la taille voulue, faite par source (ciel uni s'il n'y en a pas).
+    // Si bLazy, chaque tuile n'est fabrique qu' son premier Prepare
+    void Create(int w, int h, const cTerrainSource* source = nullptr, bool bLazy = false)
+    {
+        nWidth = w;
+        nHeight = h;
+        nTilesX = (w + nTileMask) >> nTileShift;
+        nTilesY = (h + nTileMask) >> nTileShift;
+        pSource = source;
+        nLoadedTiles = 0;
+        vecTiles.clear();
+        vecTiles.resize((size_t)nTilesX * nTilesY);
+        vecCells.assign(vecTiles.size(), UniformCells(0));
+        field.Reset(nTilesX, nTilesY);
+        for (auto& t : vecTiles)
+        {
+            t.nGeneration = ++nGeneration;
+            t.bLoaded = pSource == nullptr;
+            t.bUniform = t.bLoaded;
+        }
+
+        if (pSource != nullptr && !bLazy)
+            for (int ty = 0; ty < nTilesY; ty++)
+                for (int tx = 0; tx < nTilesX; tx++)
+                    LoadTile(tx, ty);
+    }
+
+    char Get(int x, int y) const
+    {
+        return vecCells[(y >> nTileShift) * nTilesX + (x >> nTileShift)][((y & nTileMask) << nTileShift) | (x & nTileMask)];
+    }
+
+    // Le champ de distance (cDistanceField) : la distance au terrain et sa normale
+    float Distance(float x, float y)
+    {
+        return cDistanceField::Distance(*this, x, y);
+    }
+
+    void Gradient(float x, float y, float& gx, float& gy)
+    {
+        cDistanceField::Gradient(*this, x, y, gx, gy);
+    }
+
+    const int8_t* FieldTile(int tx, int ty)
+    {
+        return field.Tile(*this, tx, ty);
+    }
+
+    uint32_t Generation() const
+    {
+        return nGeneration;
+    }
+
+    // Change ds que la tuile ou l'une de ses voisines change : leurs gnrations
+    // ne font que crotre, leur somme aussi
+    uint64_t FieldStamp(int tx, int ty) const
+    {
+        uint64_t n = 0;
+        for (int y = max(ty - 1, 0); y <= min(ty + 1, nTilesY - 1); y++)
+            for (int x = max(tx - 1, 0); x <= min(tx + 1, nTilesX - 1); x++)
+                n += vecTiles[y * nTilesX + x].nGeneration;
+        return n;
+    }
+
+    // Fait le champ de toutes les tuiles en mmoire, avant que les tirs d'essai de
+    // l'IA ne le lisent en parallle (sans quoi chacun referait le sien). Celles
+    // que le champ met en mmoire  son tour (les voisines) n'en ont pas
+    void PrepareField()
+    {
+        vector<int> vecLoaded;
+        for (int i = 0; i < (int)vecTiles.size(); i++)
+            if (vecTiles[i].bLoaded)
+                vecLoaded.push_back(i);
+        for (int i : vecLoaded)
+            FieldTile(i % nTilesX, i / nTilesX);
+    }
+
+    // Comme Get, mais aussi hors des tuiles en mmoire (une tuile range se lit
+    // alors telle que pSource l'a faite, sans ses cratres). Pour les vues d'ensemble
+    char Peek(int x, int y) const
+    {
+        if (vecTiles[(y >> nTileShift) * nTilesX + (x >> nTileShift)].bLoaded)
+            return Get(x, y);
+        return pSource != nullptr ? pSource->Cell(x, y) : 0;
+    }
+
+    const sTile& Tile(int tx, int ty) const
+    {
+        return vecTiles[ty * nTilesX + tx];
+    }
+
+    // Les cases d'une tuile, ligne par ligne (partages si elle est unie)
+    const char* Cells(int tx, int ty) const
+    {
+        return vecCells[ty * nTilesX + tx];
+    }
+
+    // Les tuiles que couvre un rectangle, born  la map comme le sont les sondes de collision
+    void TileRect(float x0, float y0, float x1, float y1, int& tx0, int& ty0, int& tx1, int& ty1) const
+    {
+        tx0 = Clamp(x0, nWidth) >> nTileShift;
+        ty0 = Clamp(y0, nHeight) >> nTileShift;
+        tx1 = Clamp(x1, nWidth) >> nTileShift;
+        ty1 = Clamp(y1, nHeight) >> nTileShift;
+    }
+
+    // Met en mmoire les tuiles du rectangle et les marque comme utilises.
+    // A appeler avant de lire ou de creuser
+    void Prepare(float x0, float y0, float x1, float y1)
+    {
+        int tx0, ty0, tx1, ty1;
+        TileRect(x0, y0, x1, y1, tx0, ty0, tx1, ty1);
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                sTile& t = vecTiles[ty * nTilesX + tx];
+                if (!t.bLoaded)
+                    LoadTile(tx, ty);
+                t.nLastUse = nClock;
+            }
+    }
+
+    // Les cases d'une tuile qui n'est pas en mmoire : dballes, ou refaites par pSource
+    void Rebuild(int tx, int ty, char* pCells) const
+    {
+        const sTile& t = vecTiles[ty * nTilesX + tx];
+        if (!t.vecPacked.empty())
+        {
+            sByteReader r(t.vecPacked);
+            uint8_t nKind = 0;
+            char nValue = 0;
+            ReadTile(r, pCells, nKind, nValue);
+            if (nKind == TILE_UNIFORM)
+                memset(pCells, nValue, nTileCells);
+            return;
+        }
+
+        if (pSource == nullptr)
+        {
+            memset(pCells, 0, nTileCells);
+            return;
+        }
+
+        // Les cases qui dpassent de la map reprennent celles du bord
+        for (int j = 0; j < nTileSize; j++)
+        {
+            int y = min((ty << nTileShift) + j, nHeight - 1);
+            for (int i = 0; i < nTileSize; i++)
+                pCells[(j << nTileShift) + i] = pSource->Cell(min((tx << nTileShift) + i, nWidth - 1), y);
+        }
+    }
+
+    // Remplace une tuile entire (nTileCells cases, ligne par ligne, y compris
+    // celles qui dpassent de la map). Rduite  une valeur si elle le permet
+    void SetTile(int tx, int ty, const char* pCells)
+    {
+        Store(tx, ty, pCells);
+        vecTiles[ty * nTilesX + tx].bModified = true;
+        vecTiles[ty * nTilesX + tx].nGeneration = ++nGeneration;
+    }
+
+    void FillTile(int tx, int ty, char c)
+    {
+        StoreUniform(tx, ty, c);
+        vecTiles[ty * nTilesX + tx].bModified = true;
+        vecTiles[ty * nTilesX + tx].nGeneration = ++nGeneration;
+    }
+
+    // La tuile redevient celle que fait pSource (refaite au prochain Prepare)
+    void ResetTile(int tx, int ty)
+    {
+        sTile& t = vecTiles[ty * nTilesX + tx];
+        if (!t.bModified)
+            return;
+        Unload(ty * nTilesX + tx);
+        t.vecPacked.clear();
+        t.bModified = false;
+        t.nGeneration = ++nGeneration;
+    }
+
+    // Creuse les cases [sx, ex[ de la ligne y (dj bornes  la map, et prpares)
+    void ClearSpan(int sx, int ex, int y)
+    {
+        int ty = y >> nTileShift;
+        while (sx < ex)
+        {
+            int tx = sx >> nTileShift;
+            int nEnd = min(ex, (tx + 1) << nTileShift);
+            sTile& t = vecTiles[ty * nTilesX + tx];
+
+            // Rien  creuser dans le ciel uni
+            if (!t.bUniform || t.nValue != 0)
+            {
+                if (t.bUniform)
+                    memset(OwnCells(t), t.nValue, nTileCells);
+                char* pCells = t.pOwned.get();
+                vecCells[ty * nTilesX + tx] = pCells;
+                memset(pCells + ((y & nTileMask) << nTileShift) + (sx & nTileMask), 0, nEnd - sx);
+                t.bModified = true;
+                t.nGeneration = ++nGeneration;
+            }
+            sx = nEnd;
+        }
+    }
+
+    // Creuse toute une tuile (prpare) : elle devient du ciel uni, sans cases  elle
+    void ClearTile(int tx, int ty)
+    {
+        const sTile& t = vecTiles[ty * nTilesX + tx];
+        if (!t.bUniform || t.nValue != 0)
+            FillTile(tx, ty, 0);
+    }
+
+    // L'indice de la tuile unie, sans terre, qui contient tout le rectangle, ou -1
+    int OpenSkyTile(float x0, float y0, float x1, float y1) const
+    {
+        int tx0, ty0, tx1, ty1;
+        TileRect(x0, y0, x1, y1, tx0, ty0, tx1, ty1);
+        if (tx0 != tx1 || ty0 != ty1)
+            return -1;
+        const sTile& t = vecTiles[ty0 * nTilesX + tx0];
+        return t.bUniform && t.nValue <= 0 ? ty0 * nTilesX + tx0 : -1;
+    }
+
+    bool IsOpenSky(float x0, float y0, float x1, float y1) const
+    {
+        return OpenSkyTile(x0, y0, x1, y1) >= 0;
+    }
+
+    // Range les tuiles les moins rcemment prpares si trop sont en mmoire :
+    // une tuile intacte est jete (pSource la refera), une tuile creuse est
+    // compresse. Appel une fois par frame
+    void Evict()
+    {
+        nClock++;
+        if (nLoadedTiles <= nMaxLoadedTiles)
+            return;
+
+        // Pas celles de la frame qui vient de se jouer
+        vector<int> vecOld;
+        for (int i = 0; i < (int)vecTiles.size(); i++)
+            if (vecTiles[i].pOwned != nullptr && vecTiles[i].nLastUse + 1 < nClock)
+                vecOld.push_back(i);
+        stable_sort(vecOld.begin(), vecOld.end(), [&](int a, int b) { return vecTiles[a].nLastUse < vecTiles[b].nLastUse; });
+
+        for (int i : vecOld)
+        {
+            if (nLoadedTiles <= nMaxLoadedTiles * 3 / 4)
+                break;
+            sTile& t = vecTiles[i];
+            if (t.bModified)
+            {
+                sByteWriter w{ t.vecPacked };
+                WriteCells(w, t);
+            }
+            Unload(i);
+            field.Release(i);
+        }
+    }
+
+    // Tuiles non unies en mmoire
+    size_t LoadedTiles() const
+    {
+        return nLoadedTiles;
+    }
+
+    int UniformTiles() const
+    {
+        int n = 0;
+        for (auto& t : vecTiles)
+            n += t.bLoaded && t.bUniform;
+        return n;
+    }
+
+    // Mmoire occupe par les cases, en mmoire ou ranges
+    size_t CellBytes() const
+    {
+        size_t n = nLoadedTiles * nTileCells;
+        for (auto& t : vecTiles)
+            n += t.vecPacked.size();
+        for (auto& u : vecUniformCells)
+            n += u != nullptr ? nTileCells : 0;
+        return n;
+    }
+
+    // Une tuile sur disque : TILE_SOURCE si elle est telle que pSource la fait,
+    // sinon TILE_UNIFORM et sa valeur, ou TILE_CELLS et ses cases en plages
+    // (valeur, longueur), parcourues 8 cases  la fois
+    void WriteTile(sByteWriter& w, int tx, int ty) const
+    {
+        const sTile& t = vecTiles[ty * nTilesX + tx];
+        if (!t.bModified)
+            w.Put((uint8_t)TILE_SOURCE);
+        else if (!t.bLoaded)
+            w.vecBytes.insert(w.vecBytes.end(), t.vecPacked.begin(), t.vecPacked.end());
+        else
+            WriteCells(w, t);
+    }
+
+    // L'inverse de WriteTile. Seule une tuile TILE_CELLS remplit pCells ; renvoie
+    // false si les plages ne couvrent pas la tuile tout juste
+    static bool ReadTile(sByteReader& r, char* pCells, uint8_t& nKind, char& nValue)
+    {
+        r.Get(nKind);
+        if (nKind == TILE_UNIFORM)
+            r.Get(nValue);
+        if (nKind != TILE_CELLS)
+            return r.bOk && nKind <= TILE_SOURCE;
+
+        int i = 0;
+        while (r.bOk && i < nTileCells)
+        {
+            char c = 0;
+            r.Get(c);
+            uint32_t nLength = r.GetVarint();
+            r.bOk = r.bOk && nLength > 0 && nLength <= (uint32_t)(nTileCells - i);
+            if (r.bOk)
+                memset(pCells + i, c, nLength);
+            i += nLength;
+        }
+        return r.bOk;
+    }
+
+private:
+    vector<sTile> vecTiles;
+    vector<const char*> vecCells;                   // Les cases de chaque tuile,  part pour Get
+    vector<unique_ptr<char[]>> vecUniformCells;     // Une tuile partage par valeur, faite au besoin
+    vector<char> vecScratch;
+    size_t nLoadedTiles = 0;
+
+    static int Clamp(float f, int n)
+    {
+        return f >= n ? n - 1 : f >= 0 ? (int)f : 0;   // NaN compris
+    }
+
+    const char* UniformCells(char c)
+    {
+        if (vecUniformCells.empty())
+            vecUniformCells.resize(256);
+        unique_ptr<char[]>& u = vecUniformCells[(uint8_t)c];
+        if (u == nullptr)
+        {
+            u.reset(new char[nTileCells]);
+            memset(u.get(), c, nTileCells);
+        }
+        return u.get();
+    }
+
+    // La tuile devient modifiable (ses cases restent  remplir)
+    char* OwnCells(sTile& t)
+    {
+        if (t.pOwned == nullptr)
+        {
+            t.pOwned.reset(new char[nTileCells]);
+            nLoadedTiles++;
+        }
+        t.bUniform = false;
+        t.bLoaded = true;
+        return t.pOwned.get();
+    }
+
+    void Store(int tx, int ty, const char* pCells)
+    {
+        if (IsUniform(pCells))
+        {
+            StoreUniform(tx, ty, pCells[0]);
+            return;
+        }
+        sTile& t = vecTiles[ty * nTilesX + tx];
+        memcpy(OwnCells(t), pCells, nTileCells);
+        t.vecPacked.clear();
+        vecCells[ty * nTilesX + tx] = t.pOwned.get();
+    }
+
+    void StoreUniform(int tx, int ty, char c)
+    {
+        sTile& t = vecTiles[ty * nTilesX + tx];
+        Unload(ty * nTilesX + tx);
+        t.vecPacked.clear();
+        t.bLoaded = true;
+        t.bUniform = true;
+        t.nValue = c;
+        vecCells[ty * nTilesX + tx] = UniformCells(c);
+    }
+
+    // Fabrique ou dballe une tuile (son contenu ne change pas)
+    void LoadTile(int tx, int ty)
+    {
+        sTile& t = vecTiles[ty * nTilesX + tx];
+        vecScratch.resize(nTileCells);
+        Rebuild(tx, ty, vecScratch.data());
+        bool bModified = t.bModified;
+        Store(tx, ty, vecScratch.data());
+        t.bModified = bModified;
+    }
+
+    // La tuile quitte la mmoire (vecPacked et bModified restent)
+    void Unload(int i)
+    {
+        sTile& t = vecTiles[i];
+        if (t.pOwned != nullptr)
+        {
+            t.pOwned.reset();
+            nLoadedTiles--;
+        }
+        t.bLoaded = false;
+        t.bUniform = false;
+        vecCells[i] = UniformCells(0);
+    }
+
+    // Une tuile creuse jusqu' n'avoir qu'une valeur s'crit comme une tuile unie :
+    // relue, c'en sera une, et l'criture ne dpend pas de l'histoire de la tuile
+    static void WriteCells(sByteWriter& w, const sTile& t)
+    {
+        if (t.bUniform || IsUniform(t.pOwned.get()))
+        {
+            w.Put((uint8_t)TILE_UNIFORM);
+            w.Put(t.bUniform ? t.nValue : t.pOwned[0]);
+            return;
+        }
+
+        w.Put((uint8_t)TILE_CELLS);
+        const char* pCells = t.pOwned.get();
+        int i = 0;
+        while (i < nTileCells)
+        {
+            char c = pCells[i];
+            uint64_t nRepeated = 0x0101010101010101ull * (uint8_t)c;
+            int j = i + 1;
+            uint64_t nBlock;
+            while (j + 8 <= nTileCells && (memcpy(&nBlock, pCells + j, 8), nBlock == nRepeated))
+                j += 8;
+            while (j < nTileCells && pCells[j] == c)
+                j++;
+            w.Put(c);
+            w.PutVarint((uint32_t)(j - i));
+            i = j;
+        }
+    }
+
+    static bool IsUniform(const char* pCells)
+    {
+        uint64_t nRepeated = 0x0101010101010101ull * (uint8_t)pCells[0];
+        for (int i = 0; i < nTileCells; i += 8)
+        {
+            uint64_t nBlock;
+            memcpy(&nBlock, pCells + i, 8);
+            if (nBlock != nRepeated)
+                return false;
+        }
+        return true;
+    }
+};
+
+// La map d'un tir d'essai de l'IA : elle lit celle du jeu sans la copier et ne
+// duplique une tuile que lorsqu'un cratre la touche. Un tir n'en touche que
+// quelques-unes : un essai cote quelques fois 4 Ko au lieu de toute la map.
+// Une tuile que le jeu n'a pas en mmoire est refaite dans la copie, sans
+// toucher  la map du jeu (les essais tournent en parallle)
+class cTerrainFork
+{
+public:
+    const cTerrain& base;
+    int nWidth;
+    int nHeight;
+
+    cTerrainFork(const cTerrain& t) : base(t), nWidth(t.nWidth), nHeight(t.nHeight)
+    {
+        vecTiles.resize((size_t)t.nTilesX * t.nTilesY);
+        vecGenerations.resize(vecTiles.size());
+        field.Reset(t.nTilesX, t.nTilesY);
+    }
+
+    char Get(int x, int y) const
+    {
+        const char* t = vecTiles[(y >> cTerrain::nTileShift) * base.nTilesX + (x >> cTerrain::nTileShift)].get();
+        return t != nullptr ? t[((y & cTerrain::nTileMask) << cTerrain::nTileShift) | (x & cTerrain::nTileMask)] : base.Get(x, y);
+    }
+
+    void Prepare(float x0, float y0, float x1, float y1)
+    {
+        int tx0, ty0, tx1, ty1;
+        base.TileRect(x0, y0, x1, y1, tx0, ty0, tx1, ty1);
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                unique_ptr<char[]>& t = vecTiles[ty * base.nTilesX + tx];
+                if (t == nullptr && !base.Tile(tx, ty).bLoaded)
+                {
+                    t.reset(new char[cTerrain::nTileCells]);
+                    base.Rebuild(tx, ty, t.get());
+                }
+            }
+    }
+
+    void ClearSpan(int sx, int ex, int y)
+    {
+        while (sx < ex)
+        {
+            int tx = sx >> cTerrain::nTileShift;
+            int nEnd = min(ex, (tx + 1) << cTerrain::nTileShift);
+            char* t = Tile(tx, y >> cTerrain::nTileShift);
+            memset(t + ((y & cTerrain::nTileMask) << cTerrain::nTileShift) + (sx & cTerrain::nTileMask), 0, nEnd - sx);
+            vecGenerations[(y >> cTerrain::nTileShift) * base.nTilesX + tx] = ++nGeneration;
+            sx = nEnd;
+        }
+    }
+
+    void ClearTile(int tx, int ty)
+    {
+        const cTerrain::sTile& t = base.Tile(tx, ty);
+        if (t.bUniform && t.nValue == 0 && vecTiles[ty * base.nTilesX + tx] == nullptr)
+            return;
+        memset(Tile(tx, ty), 0, cTerrain::nTileCells);
+        vecGenerations[ty * base.nTilesX + tx] = ++nGeneration;
+    }
+
+    float Distance(float x, float y)
+    {
+        return cDistanceField::Distance(*this, x, y);
+    }
+
+    void Gradient(float x, float y, float& gx, float& gy)
+    {
+        cDistanceField::Gradient(*this, x, y, gx, gy);
+    }
+
+    // Le champ du jeu tant qu'aucun cratre d'essai n'est pass  ct, sinon le sien
+    const int8_t* FieldTile(int tx, int ty)
+    {
+        if (FieldStamp(tx, ty) == 0)
+            if (const int8_t* p = base.field.ValidTile(base, tx, ty))
+                return p;
+        return field.Tile(*this, tx, ty);
+    }
+
+    uint32_t Generation() const
+    {
+        return nGeneration;
+    }
+
+    // Les cratres d'essai autour de la tuile (la map du jeu ne change pas tant que
+    // la copie existe)
+    uint64_t FieldStamp(int tx, int ty) const
+    {
+        uint64_t n = 0;
+        for (int y = max(ty - 1, 0); y <= min(ty + 1, base.nTilesY - 1); y++)
+            for (int x = max(tx - 1, 0); x <= min(tx + 1, base.nTilesX - 1); x++)
+                n += vecGenerations[y * base.nTilesX + x];
+        return n;
+    }
+
+    bool IsOpenSky(float x0, float y0, float x1, float y1) const
+    {
+        int t = base.OpenSkyTile(x0, y0, x1, y1);
+        return t >= 0 && vecTiles[t] == nullptr;
+    }
+
+    int CopiedTiles() const
+    {
+        int n = 0;
+        for (auto& t : vecTiles)
+            n += t != nullptr;
+        return n;
+    }
+
+private:
+    vector<unique_ptr<char[]>> vecTiles;
+    vector<uint32_t> vecGenerations;    // Dernier cratre d'essai de chaque tuile (0 : aucun)
+    uint32_t nGeneration = 0;
+    cDistanceField field;               // Celui des tuiles que le jeu n'a pas, ou qu'un essai a creuses
+
+    // La copie prive d'une tuile, faite  la premire criture
+    char* Tile(int tx, int ty)
+    {
+        unique_ptr<char[]>& t = vecTiles[ty * base.nTilesX + tx];
+        if (t == nullptr)
+        {
+            t.reset(new char[cTerrain::nTileCells]);
+            memcpy(t.get(), base.Cells(tx, ty), cTerrain::nTileCells);
+        }
+        return t.get();
+    }
+};
+
+// Un vnement du replay : dbut d'un tour ou dcision de l'IA
+struct sReplayEvent
+{
+    enum TYPE : uint8_t
+    {
+        TURN = 0,       // nValue : l'quipe, fA : le membre jou
+        AI_TARGET,      // fA : l'angle vis, fB : la puissance du tir
+        AI_JUMP         // fA : l'angle du saut
+    };
+
+    uint32_t nFrame = 0;
+    uint8_t nType = TURN;
+    int32_t nValue = 0;
+    float fA = 0.0f;
+    float fB = 0.0f;
+};
+
+// Un replay : tout ce qu'il faut pour rejouer une partie  l'identique.
+// Le reste (physique, IA, dbris) est recalcul, il suffit donc de la graine,
+// des pas de temps et des commandes du joueur. Les dcisions de l'IA servent
+//  vrifier que la relecture ne diverge pas (et  la corriger si c'est le cas).
+struct sReplay
+{
+    static const uint32_t nVersion = 11;    // 2 : ajoute bAIPlanning, 3 : bMapFile, 4 : bSweptPhysics, 5 : nPhysics, 6 : bObjectCollisions, 7 : les armes, 8 : bForces, 9 : nObjectBudget et l'impulsion des armes, 10 : bParticles, 11 : bCameraLead
+
+    // La partie
+    uint32_t nSeed = 1;
+    int32_t nTeams = 4;
+    int32_t nWormsPerTeam = 3;
+    int32_t nMapWidth = 1024;
+    int32_t nMapHeight = 512;
+    uint8_t bAllTeamsComputer = 0;
+    uint8_t bAIPlanning = 0;
+    uint8_t bMapFile = 0;           // Joue sur la map charge d'un fichier (de nMapWidth x nMapHeight)
+    uint8_t nPhysics = 0;           // La dtection des collisions (Worms::PHYSICS)
+    uint8_t bObjectCollisions = 0;  // Chocs entre objets (worms, dbris)
+    uint8_t nWeapon = 0;            // L'arme choisie au dbut de la partie
+    cWeapons weapons;               // Les armes de la partie (le missile seul avant la version 7)
+    uint8_t bForces = 0;            // Le vent et la trane (sForces)
+    uint32_t nObjectBudget = 0;     // Objets au-del desquels les dbris se font rares (0 : aucune limite)
+    uint8_t bParticles = 0;         // Les dbris sont des particules (cParticles), pas des objets
+    uint8_t bCameraLead = 0;        // La camra devance les projectiles (Worms::TrackCamera)
+    uint32_t nFrames = 0;
+
+    // Pas de temps : (premire frame, dure), une entre  chaque changement
+    vector<pair<uint32_t, float>> vecTimeSteps;
+
+    // Commandes du joueur : (frame, commandes), une entre  chaque changement
+    vector<pair<uint32_t, uint8_t>> vecControls;
+
+    // Tours et dcisions de l'IA, dans l'ordre des frames
+    vector<sReplayEvent> vecEvents;
+
+    void Clear()
+    {
+        nFrames = 0;
+        vecTimeSteps.clear();
+        vecControls.clear();
+        vecEvents.clear();
+    }
+
+    // Le pas de temps de la frame nFrame
+    float TimeStep(uint32_t nFrame) const
+    {
+        auto it = upper_bound(vecTimeSteps.begin(), vecTimeSteps.end(), make_pair(nFrame, INFINITY));
+        return it == vecTimeSteps.begin() ? 0.0f : (it - 1)->second;
+    }
+
+    // Sur disque : un petit en-tte, puis chaque liste avec ses frames en cart
+    //  l'entre prcdente (entier de longueur variable : 1 octet le plus souvent)
+    bool Save(const wstring& sFile) const
+    {
+        vector<uint8_t> vecFile;
+        sByteWriter w{ vecFile };
+
+        vecFile.insert(vecFile.end(), { 'W', 'R', 'P', 'L' });
+        w.Put((uint32_t)nVersion);
+        w.Put(nSeed); w.Put(nTeams); w.Put(nWormsPerTeam); w.Put(nMapWidth); w.Put(nMapHeight);
+        w.Put(bAllTeamsComputer); w.Put(bAIPlanning); w.Put(bMapFile); w.Put(nPhysics); w.Put(bObjectCollisions);
+        w.Put(nWeapon); weapons.Write(w); w.Put(bForces); w.Put(nObjectBudget); w.Put(bParticles); w.Put(bCameraLead);
+        w.Put(nFrames);
+
+        uint32_t nLast = 0;
+        w.PutVarint((uint32_t)vecTimeSteps.size());
+        for (auto& t : vecTimeSteps)
+        {
+            w.PutVarint(t.first - nLast);
+            w.Put(t.second);
+            nLast = t.first;
+        }
+
+        nLast = 0;
+        w.PutVarint((uint32_t)vecControls.size());
+        for (auto& c : vecControls)
+        {
+            w.PutVarint(c.first - nLast);
+            w.Put(c.second);
+            nLast = c.first;
+        }
+
+        nLast = 0;
+        w.PutVarint((uint32_t)vecEvents.size());
+        for (auto& e : vecEvents)
+        {
+            w.PutVarint(e.nFrame - nLast);
+            w.Put(e.nType);
+            nLast = e.nFrame;
+            switch (e.nType)
+            {
+            case sReplayEvent::TURN: w.PutVarint((uint32_t)e.nValue); w.PutVarint((uint32_t)e.fA); break;
+            case sReplayEvent::AI_TARGET: w.Put(e.fA); w.Put(e.fB); break;
+            case sReplayEvent::AI_JUMP: w.Put(e.fA); break;
+            }
+        }
+
+        return WriteBytesToFile(sFile, vecFile);
+    }
+
+    bool Load(const wstring& sFile)
+    {
+        Clear();
+        vector<uint8_t> vecFile;
+        if (!ReadBytesFromFile(sFile, vecFile))
+            return false;
+
+        sByteReader r(vecFile);
+        char sMagic[4] = {};
+        uint32_t nFileVersion = 0;
+        r.Get(sMagic); r.Get(nFileVersion);
+        r.bOk = r.bOk && memcmp(sMagic, "WRPL", 4) == 0 && nFileVersion >= 1 && nFileVersion <= nVersion;
+
+        r.Get(nSeed); r.Get(nTeams); r.Get(nWormsPerTeam); r.Get(nMapWidth); r.Get(nMapHeight);
+        r.Get(bAllTeamsComputer);
+        bAIPlanning = 0;    // Les replays de version 1 datent d'avant la planification
+        if (nFileVersion >= 2)
+            r.Get(bAIPlanning);
+        bMapFile = 0;
+        if (nFileVersion >= 3)
+            r.Get(bMapFile);
+        nPhysics = 0;       // Avant la version 4, 10 pas fixes par frame. En version 4,
+        if (nFileVersion >= 4)  // 0 ou 1 : les mmes valeurs que nPhysics
+            r.Get(nPhysics);
+        bObjectCollisions = 0;
+        if (nFileVersion >= 6)
+            r.Get(bObjectCollisions);
+        nWeapon = 0;
+        weapons.Reset();
+        if (nFileVersion >= 7)
+        {
+            r.Get(nWeapon);
+            r.bOk = r.bOk && weapons.Read(r, nFileVersion);
+        }
+        bForces = 0;
+        if (nFileVersion >= 8)
+            r.Get(bForces);
+        nObjectBudget = 0;
+        if (nFileVersion >= 9)
+            r.Get(nObjectBudget);
+        bParticles = 0;
+        if (nFileVersion >= 10)
+            r.Get(bParticles);
+        bCameraLead = 0;
+        if (nFileVersion >= 11)
+            r.Get(bCameraLead);
+        r.Get(nFrames);
+
+        // Chaque entre prend au moins un octet : un compte plus grand que le fichier est faux
+        uint32_t nFrame = 0;
+        uint32_t nCount = r.GetVarint();
+        for (uint32_t i = 0; r.Has(nCount - i) && i < nCount; i++)
+        {
+            pair<uint32_t, float> t;
+            nFrame += r.GetVarint();
+            t.first = nFrame;
+            r.Get(t.second);
+            vecTimeSteps.push_back(t);
+        }
+
+        nFrame = 0;
+        nCount = r.GetVarint();
+        for (uint32_t i = 0; r.Has(nCount - i) && i < nCount; i++)
+        {
+            pair<uint32_t, uint8_t> c;
+            nFrame += r.GetVarint();
+            c.first = nFrame;
+            r.Get(c.second);
+            vecControls.push_back(c);
+        }
+
+        nFrame = 0;
+        nCount = r.GetVarint();
+        for (uint32_t i = 0; r.Has(nCount - i) && i < nCount; i++)
+        {
+            sReplayEvent e;
+            nFrame += r.GetVarint();
+            e.nFrame = nFrame;
+            r.Get(e.nType);
+            switch (e.nType)
+            {
+            case sReplayEvent::TURN: e.nValue = (int32_t)r.GetVarint(); e.fA = (float)r.GetVarint(); break;
+            case sReplayEvent::AI_TARGET: r.Get(e.fA); r.Get(e.fB); break;
+            case sReplayEvent::AI_JUMP: r.Get(e.fA); break;
+            default: r.bOk = false; break;
+            }
+            vecEvents.push_back(e);
+        }
+
+        // Une partie doit au moins avoir deux quipes et une map o les poser
+        bool bOk = r.bOk && nTeams >= 2 && nWormsPerTeam >= 1 && nMapWidth >= 256 && nMapHeight >= 128 && nPhysics <= 2 && nWeapon < weapons.Size() && !vecTimeSteps.empty();
+        if (!bOk)
+            Clear();
+        return bOk;
+    }
+};
+
+
+// Le jeu, qui utilise Console Game Engine
+class Worms : public olcConsoleGameEngine
+{
+public:
+    Worms()
+    {
+        m_sAppName = L"Worms";
+    }
+
+    // Charge un replay, qui sera rejou au lieu d'une nouvelle partie
+    bool LoadReplay(const wstring& sFile)
+    {
+        return replay.Load(sFile);
+    }
+
+    // Charge les armes des parties suivantes (cWeapons). Sinon, le missile seul
+    bool LoadWeapons(const wstring& sFile)
+    {
+        nWeapon = 0;
+        return weapons.Load(sFile);
+    }
+
+    // Charge une map dessine (cBitmapTerrain), qui remplace celle de CreateMap
+    // pour les parties suivantes. Rien n'est lu avant que la partie n'en ait besoin
+    bool LoadMapFile(const wstring& sFile)
+    {
+        bMapFile = bitmap.Open(sFile);
+        if (bMapFile)
+        {
+            nMapWidth = bitmap.nWidth;
+            nMapHeight = bitmap.nHeight;
+        }
+        return bMapFile;
+    }
+
+    // Le replay charg demande une map dessine, et ce n'est pas celle qui l'est
+    bool ReplayNeedsMapFile() const
+    {
+        return replay.bMapFile && (!bitmap.IsOpen() || bitmap.nWidth != replay.nMapWidth || bitmap.nHeight != replay.nMapHeight);
+    }
+
+    // Les benchmarks (Worms Bench.cpp) pilotent directement la simulation et le rendu
+    friend struct sWormsBench;
+
+private:
+
+    //Ressources
+
+    //Map
+    int nMapWidth = 1024;
+    int nMapHeight = 512;
+    cTerrain terrain;
+    cNoiseTerrain noise;            // Ce qui fabrique la map de CreateMap
+    cBitmapTerrain bitmap;          // La map charge par LoadMapFile
+    bool bMapFile = false;          // CreateMap utilise bitmap au lieu du bruit
+
+    // Au-del de ce nombre de cases, la map n'est fabrique qu'au fur et  mesure
+    // que les objets et la camra la parcourent
+    static const int64_t nStreamingCells = 4096 * 1024;
+
+    //Camera
+    float fCameraPosX = 0.0f;
+    float fCameraPosY = 0.0f;
+    float fCameraPosXTarget = 0.0f;
+    float fCameraPosYTarget = 0.0f;
+
+    // La camra devance les projectiles (TrackCamera). Faux pour rejouer les replays
+    // d'avant (version 10 et moins), o elle les suivait  la trane
+    bool bCameraLead = true;
+
+    // Ce que montre l'cran, en coordonnes de la map
+    struct sView
+    {
+        float x1, y1, x2, y2;
+
+        // Un dessin qui dborde de fMargin autour de (x, y) y parat-il ?
+        bool Sees(float x, float y, float fMargin) const
+        {
+            return x + fMargin >= x1 && x - fMargin < x2 && y + fMargin >= y1 && y - fMargin < y2;
+        }
+    };
+
+    // TOUS les objets du jeu
+    list<unique_ptr<cPhysicsObject>> listObjects;
+
+    cPhysicsObject* pObjectUnderControl = nullptr;  //pointer vers object contrl par joueur
+    cPhysicsObject* pCameraTrackingObject = nullptr;//Point vers objet film par la camra
+
+    bool bZoomOut = false;
+    bool bGameIsStable = false;
+    bool bEnablePlayerControl = true;
+    bool bEnableComputerControl = false;
+    bool bAllTeamsComputer = false;     // L'quipe 0 est aussi joue par l'IA (benchmarks, tournois)
+
+    bool bEnergising = false;
+    bool bFireWeapon = false;
+    bool bShowCountDown = false;
+    bool bPlayerHasFired = false;
+
+    float fEnergyLevel = 0.0f;
+    float fTurnTime = 0.0f;
+
+    // Les calques de l'cran, du fond vers l'avant. Chacun a sa signature (LayerStamp) ; une
+    // frame o aucune n'a chang ne touche  aucune case de l'cran. Le terrain, qui couvre
+    // tout l'cran, est gard  part (SetDrawTarget) tant que la camra ne bouge pas : les
+    // objets, les particules et l'interface, quelques centaines de cases, se redessinent
+    // alors sur une simple copie
+    enum LAYER
+    {
+        LAYER_TERRAIN = 0,
+        LAYER_OBJECTS,          // Worms, projectiles, vise
+        LAYER_PARTICLES,
+        LAYER_HUD,
+        LAYER_COUNT
+    };
+    uint64_t nLayerStamp[LAYER_COUNT] = {};
+    vector<CHAR_INFO> vecTerrainLayer;
+    uint64_t nTerrainLayerStamp = 0;    // La signature du terrain qu'il contient
+    bool bLayers = true;                // Faux : tout se redessine  mme l'cran  chaque frame
+    uint64_t nSceneFrame = 0;
+    vector<char> vecZoomOutRow;         // Une ligne de la vue dzoome, avant d'tre trace par plages
+    cHudDigits hudDigits;
+
+    // Vector contenant les quipes
+    vector<cTeam>vecTeams;
+
+    // Taille des parties
+    int nTeams = 4;
+    int nWormsPerTeam = 3;
+
+    int nCurrentTeam = 0;
+
+    // Pour contrler l'IA
+    bool bAI_Jump = false;          // IA has appuy sur jump
+    bool bAI_AimLeft = false;       // IA vise  gauche etc.
+    bool bAI_AimRight = false;
+    bool bAI_Energise = false;      // Emmagasine la puissance de son tir
+
+    float fAITargetAngle = 0.0f;
+    float fAITargetEnergy = 0.0f;
+    float fAISafePosition = 0.0f;
+    cWorm* pAITargetWorm = nullptr;
+    float fAITargetX = 0.0f;
+    float fAITargetY = 0.0f;
+
+    // La dtection des collisions (PhysicsStep). Sauf PHYSICS_FIXED, celle des replays
+    // d'avant la version 4, le dplacement est parcouru jusqu'au premier contact : une
+    // frame se joue alors en pas d'au plus fMaxPhysicsStep, au lieu de 10 pas fixes
+    enum PHYSICS
+    {
+        PHYSICS_FIXED = 0,      // La sonde en demi-cercle,  la position d'arrive
+        PHYSICS_SWEPT,          // La sonde, promene case par case le long du dplacement
+        PHYSICS_DISTANCE        // Par bonds dans le champ de distance, normale par son gradient
+    } nPhysics = PHYSICS_DISTANCE;
+
+    // Les objets se heurtent entre eux (CollideObjects). Faux pour rejouer les
+    // replays d'avant (version 5 et moins)
+    bool bObjectCollisions = true;
+
+    // Les armes, et celle que l'quipe en cours va tirer (touche A pour changer)
+    cWeapons weapons;
+    int nWeapon = 0;
+
+    // Le vent, tir  chaque tour, et la trane des objets (sForces). Faux pour
+    // rejouer les replays d'avant (version 7 et moins)
+    bool bForces = true;
+    sForces forces;
+    const float fMaxWind = 10.0f;
+
+    // Les objets en vie au-del desquels une explosion lance de moins en moins de
+    // dbris (DebrisCount). 0 : sans limite, pour rejouer les replays d'avant (version 8 et moins)
+    uint32_t nObjectBudget = 1024;
+
+    // Les dbris, tincelles et fumes des explosions, hors de la physique (cParticles).
+    // Faux pour rejouer les replays d'avant (version 9 et moins) : les dbris y sont
+    // des objets, qui heurtent les worms et retardent la fin des tours
+    bool bParticles = true;
+    cParticles particles;
+
+    // Au-del, un worm pos au sol rebondirait  chaque pas sans jamais tre stable
+    const float fMaxPhysicsStep = 1.0f / 30.0f;
+
+    // L'IA planifie ses tirs : elle joue des tirs d'essai sur des copies de la
+    // partie et garde le meilleur. Sinon, elle vise une quipe au hasard
+    bool bAIPlanning = true;
+    unique_ptr<cThreadPool> pAIPool;    // Cr au premier tir planifi
+
+    // Un tir d'essai et son bilan
+    struct sShotPlan
+    {
+        float fAngle = 0.0f;
+        float fEnergy = 0.0f;
+        float fScore = 0.0f;
+        int nCopiedTiles = 0;   // Tuiles de la map dupliques par ses cratres
+    };
+    sShotPlan lastPlan;         // Le dernier tir retenu (benchmarks)
+
+    // Bruitages (identifiants du mixeur)
+    int nSoundBoom = 0;
+    int nSoundFire = 0;
+    int nSoundBounce = 0;
+
+    // Les commandes du joueur qui comptent pour la simulation (bits)
+    enum CONTROL
+    {
+        CTRL_JUMP = 1,          // Z appuy
+        CTRL_AIM_LEFT = 2,      // Q maintenu
+        CTRL_AIM_RIGHT = 4,     // D maintenu
+        CTRL_FIRE_PRESS = 8,    // Espace appuy...
+        CTRL_FIRE_HOLD = 16,    // ... maintenu ...
+        CTRL_FIRE_RELEASE = 32, // ... relch
+        CTRL_NEXT_WEAPON = 64   // A appuy
+    };
+
+    // Le replay de la partie en cours : enregistr pendant qu'on joue, ou relu
+    enum REPLAY_MODE
+    {
+        REPLAY_OFF = 0,
+        REPLAY_RECORD,
+        REPLAY_PLAY
+    } nReplayMode = REPLAY_OFF;
+
+    sReplay replay;
+    uint32_t nReplayFrame = 0;      // La prochaine frame  simuler
+    size_t nReplayControl = 0;      // Curseurs de relecture
+    size_t nReplayEvent = 0;
+    int nReplayDesyncs = 0;         // Evnements qui ne correspondaient pas au replay
+    uint32_t nReplayFirstDesync = 0;
+    float fReplaySpeed = 1.0f;      // Vitesse de relecture dans la fentre
+    float fReplayTime = 0.0f;       // Temps rel pas encore simul
+
+    // Un keyframe au dbut de chaque tour : l'tat complet du jeu, pour se dplacer
+    // dans le replay sans tout resimuler depuis le dbut
+    struct sKeyframe
+    {
+        uint32_t nFrame = 0;
+        vector<uint8_t> vecState;
+    };
+    vector<sKeyframe> vecKeyframes;
+
+    // Une numration des game states
+    enum GAME_STATE
+    {
+        GS_RESET = 0,
+        GS_GENERATE_TERRAIN = 1,
+        GS_GENERATING_TERRAIN,
+        GS_ALLOCATE_UNITS,
+        GS_ALLOCATING_UNITS,
+        GS_START_PLAY,
+        GS_CAMERA_MODE,
+        GS_GAME_OVER1,
+        GS_GAME_OVER2
+    } nGameState, nNextState;
+
+    // Les diffrentes phases du comportement de l'IA
+    enum AI_STATE
+    {
+        AI_ASSESS_ENVIRONMENT = 0,
+        AI_MOVE,
+        AI_CHOOSE_TARGET,
+        AI_POSITION_FOR_TARGET,
+        AI_AIM,
+        AI_FIRE
+    } nAIState, nAINextState;
+
+    // Cration du jeu
+
+    virtual bool OnUserCreate()
+    {
+        // Cration map
+        terrain.Create(nMapWidth, nMapHeight);
+
+        // Remet  zro les states
+        nGameState = GS_RESET;
+        nNextState = GS_RESET;
+        nAIState = AI_ASSESS_ENVIRONMENT;
+        nAINextState = AI_ASSESS_ENVIRONMENT;
+
+        bGameIsStable = false;
+
+        CreateSounds();
+
+        // Un replay a t charg (voir main) : on le rejoue. Sinon la partie est enregistre
+        if (!replay.vecTimeSteps.empty())
+            StartPlayback();
+        else
+            StartRecording(1);
+        return true;
+    }
+
+    // Les bruitages sont synthtiss au lancement : pas de fichiers .wav  livrer
+    void CreateSounds()
+    {
+        const float fRate = 44100.0f;
+        const float fPi = 3.14159f;
+
+        // Gnrateur de bruit  part, pour ne pas toucher  la suite de rand() du jeu
+        unsigned int nNoise = 12345;
+        auto Noise = [&]()
+            {
+                nNoise = nNoise * 1664525 + 1013904223;
+                return (float)(nNoise >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+            };
+
+        // Explosion : bruit filtr (passe-bas) qui s'teint en presque une seconde
+        vector<float> vecBoom((size_t)(0.9f * fRate));
+        float fLow = 0.0f;
+        for (size_t i = 0; i < vecBoom.size(); i++)
+        {
+            float t = i / fRate;
+            fLow += 0.08f * (Noise() - fLow);
+            vecBoom[i] = 1.2f * fLow * expf(-5.0f * t);
+        }
+        nSoundBoom = AddAudioSample(vecBoom);
+
+        // Tir : un sifflement qui monte vite
+        vector<float> vecFire((size_t)(0.25f * fRate));
+        float fPhase = 0.0f;
+        for (size_t i = 0; i < vecFire.size(); i++)
+        {
+            float t = i / fRate;
+            fPhase += 2.0f * fPi * (300.0f + 1500.0f * t) / fRate;
+            vecFire[i] = 0.3f * sinf(fPhase) * expf(-8.0f * t);
+        }
+        nSoundFire = AddAudioSample(vecFire);
+
+        // Rebond : un petit choc sourd
+        vector<float> vecBounce((size_t)(0.08f * fRate));
+        for (size_t i = 0; i < vecBounce.size(); i++)
+        {
+            float t = i / fRate;
+            vecBounce[i] = 0.5f * sinf(2.0f * fPi * 110.0f * t) * expf(-50.0f * t);
+        }
+        nSoundBounce = AddAudioSample(vecBounce);
+    }
+
+
+
+    /*
+    * La boucle de jeu (Game Loop)
+    * "On User Update"
+    */
+    virtual bool OnUserUpdate(float fElapsedTime)
+    {
+        if (nReplayMode == REPLAY_PLAY)
+            UpdateReplay(fElapsedTime);
+        else
+            UpdateSimulation(fElapsedTime);
+
+        // R : sauve le replay de la partie en cours
+        if (nReplayMode == REPLAY_RECORD && m_keys[L'R'].bReleased)
+            replay.Save(L"worms.rpl");
+
+        // S : sauvegarde la partie, L : la recharge
+        if (nReplayMode != REPLAY_PLAY && m_keys[L'S'].bReleased)
+            SaveSnapshot(L"worms.snp");
+        if (nReplayMode != REPLAY_PLAY && m_keys[L'L'].bReleased)
+            LoadSnapshot(L"worms.snp");
+
+        DrawScene();
+        return true;
+    }
+
+    // Relecture dans la fentre, au rythme rel multipli par fReplaySpeed.
+    // Haut/bas : acclre ou ralentit. Gauche/droite : tour prcdent ou suivant
+    void UpdateReplay(float fElapsedTime)
+    {
+        if (m_keys[VK_TAB].bReleased) bZoomOut = !bZoomOut;
+        if (m_keys[VK_UP].bPressed && fReplaySpeed < 64.0f) fReplaySpeed *= 2.0f;
+        if (m_keys[VK_DOWN].bPressed && fReplaySpeed > 0.25f) fReplaySpeed /= 2.0f;
+
+        if (m_keys[VK_RIGHT].bPressed || m_keys[VK_LEFT].bPressed)
+        {
+            // Les dbuts de tours qui encadrent la frame courante
+            uint32_t nPrevious = 0, nCurrent = 0, nNext = replay.nFrames;
+            for (auto& e : replay.vecEvents)
+                if (e.nType == sReplayEvent::TURN)
+                {
+                    uint32_t nStart = e.nFrame + 1; // La frame de son keyframe
+                    if (nStart <= nReplayFrame)
+                    {
+                        nPrevious = nCurrent;
+                        nCurrent = nStart;
+                    }
+                    else
+                    {
+                        nNext = nStart;
+                        break;
+                    }
+                }
+            SeekReplay(m_keys[VK_RIGHT].bPressed ? nNext : nPrevious);
+            fReplayTime = 0.0f;
+        }
+
+        // Pas plus d'un dixime de seconde de retard : au-del, la relecture ralentit
+        fReplayTime += fElapsedTime * fReplaySpeed;
+        if (fReplayTime > 0.1f * fReplaySpeed) fReplayTime = 0.1f * fReplaySpeed;
+
+        while (nReplayFrame < replay.nFrames)
+        {
+            float fStep = replay.TimeStep(nReplayFrame);
+            if (fReplayTime < fStep)
+                break;
+            fReplayTime -= fStep;
+            ReplayStep();
+        }
+    }
+
+    // Toute la logique d'une frame, sans rien dessiner : phases du jeu, IA,
+    // contrles, camra et physique. Les benchmarks l'appellent directement.
+    void UpdateSimulation(float fElapsedTime)
+    {
+        // Tab permet de zoomer et dzoomer (en relecture, UpdateReplay s'en charge)
+        if (m_keys[VK_TAB].bReleased && nReplayMode != REPLAY_PLAY)
+            bZoomOut = !bZoomOut;
+
+        // Le replay garde chaque changement de pas de temps
+        if (nReplayMode == REPLAY_RECORD && (replay.vecTimeSteps.empty() || replay.vecTimeSteps.back().second != fElapsedTime))
+            replay.vecTimeSteps.push_back({ nReplayFrame, fElapsedTime });
+
+        // Les commandes du joueur : au clavier, ou relues dans le replay
+        uint8_t nControls = ReadControls();
+
+        // Scroller la carte avec la souris
+        float fMapScrollSpeed = 400.0f;
+        if (m_mousePosX < 20) fCameraPosX -= fMapScrollSpeed * fElapsedTime;
+        if (m_mousePosX > ScreenWidth() - 20) fCameraPosX += fMapScrollSpeed * fElapsedTime;
+        if (m_mousePosY < 20) fCameraPosY -= fMapScrollSpeed * fElapsedTime;
+        if (m_mousePosY > ScreenHeight() - 20) fCameraPosY += fMapScrollSpeed * fElapsedTime;
+
+
+        // Dfinit les phases (states) du jeu
+        switch (nGameState)
+        {
+        case GS_RESET:
+        {
+            // Repart d'une partie vierge
+            listObjects.clear();
+            particles.Clear();
+            vecTeams.clear();
+            pObjectUnderControl = nullptr;
+            pCameraTrackingObject = nullptr;
+            pAITargetWorm = nullptr;
+            nCurrentTeam = 0;
+
+            bEnablePlayerControl = false;
+            bGameIsStable = false;
+            bPlayerHasFired = false;
+            bShowCountDown = false;
+            nNextState = GS_GENERATE_TERRAIN;
+        }
+        break;
+
+        case GS_GENERATE_TERRAIN:
+        {
+            bZoomOut = false;
+            CreateMap();
+            bGameIsStable = false;
+            bShowCountDown = false;
+            nNextState = GS_GENERATING_TERRAIN;
+        }
+        break;
+
+        case GS_GENERATING_TERRAIN:
+        {
+            bShowCountDown = false;
+            if (bGameIsStable)
+                nNextState = GS_ALLOCATE_UNITS;
+        }
+        break;
+
+        case GS_ALLOCATE_UNITS:
+        {
+            // Dployer les quipes (nTeams x nWormsPerTeam)
+            // Calculer l'espacement
+            float fSpacePerTeam = (float)nMapWidth / (float)nTeams;
+            float fSpacePerWorm = fSpacePerTeam / (nWormsPerTeam * 2.0f);
+
+            // Crer les quipes. Les worms pointent vers leur quipe :
+            // le vector est dimensionn une fois pour toutes
+            vecTeams.resize(nTeams);
+            for (int t = 0; t < nTeams; t++)
+            {
+                float fTeamMiddle = (fSpacePerTeam / 2.0f) + (t * fSpacePerTeam);
+                for (int w = 0; w < nWormsPerTeam; w++)
+                {
+                    float fWormX = fTeamMiddle - ((fSpacePerWorm * (float)nWormsPerTeam) / 2.0f) + w * fSpacePerWorm;
+                    float fWormY = 0.0f;
+
+                    // Crer les Worms
+                    cWorm* worm = new cWorm(fWormX, fWormY);
+                    worm->nTeam = t;
+                    listObjects.push_back(unique_ptr<cWorm>(worm));
+                    vecTeams[t].AddMember(worm);
+                }
+            }
+
+            // Slectionne le premier Worm a tre jou et film
+            pObjectUnderControl = vecTeams[0].vecMembers[vecTeams[0].nCurrentMember];
+            pCameraTrackingObject = pObjectUnderControl;
+            bShowCountDown = false;
+            nNextState = GS_ALLOCATING_UNITS;
+        }
+        break;
+
+        case GS_ALLOCATING_UNITS:
+        {
+            if (bGameIsStable)
+            {
+                bEnablePlayerControl = !bAllTeamsComputer;
+                bEnableComputerControl = bAllTeamsComputer;
+                fTurnTime = 15.0f;
+                ChangeWind();
+                bZoomOut = false;
+                nNextState = GS_START_PLAY;
+            }
+        }
+        break;
+        // Le joueur contrle le Worm et n'a pas encore tir
+        case GS_START_PLAY:
+        {
+            bShowCountDown = true;
+
+            if (bPlayerHasFired || fTurnTime <= 0.0f)
+                nNextState = GS_CAMERA_MODE;
+        }
+        break;
+        // Missile tir ! On suit l'action avec la camra
+        case GS_CAMERA_MODE:
+        {
+            bEnablePlayerControl = false;
+            bEnableComputerControl = false;
+            bPlayerHasFired = false;
+            bShowCountDown = false;
+            fEnergyLevel = 0.0f;
+
+            // Une fois que tous les objets sont au repos
+            if (bGameIsStable)
+            {
+                // S'il ne reste plus d'autres quipes... Game Over !
+                // (la dernire quipe adverse a pu se faire sauter toute seule)
+                int nTeamsAlive = 0;
+                for (auto& t : vecTeams)
+                    if (t.IsTeamAlive())
+                        nTeamsAlive++;
+
+                if (nTeamsAlive < 2)
+                {
+                    nNextState = GS_GAME_OVER1;
+                    break;
+                }
+
+                // Equipe suivante
+                do {
+                    nCurrentTeam++;
+                    nCurrentTeam %= vecTeams.size();
+                } while (!vecTeams[nCurrentTeam].IsTeamAlive());
+
+                // Bloque contrle joueur quand l'IA joue
+                if (nCurrentTeam == 0 && !bAllTeamsComputer)
+                {
+                    bEnablePlayerControl = true;
+                    bEnableComputerControl = false;
+                }
+                else
+                {
+                    bEnablePlayerControl = false;
+                    bEnableComputerControl = true;
+                }
+
+                // L'IA reprend sa rflexion depuis le dbut, mme si le tour
+                // prcdent s'est termin avant qu'elle n'ait tir
+                nAIState = AI_ASSESS_ENVIRONMENT;
+                nAINextState = AI_ASSESS_ENVIRONMENT;
+                bAI_Jump = false;
+                bAI_AimLeft = false;
+                bAI_AimRight = false;
+                bAI_Energise = false;
+
+                // Contrles et camera
+                pObjectUnderControl = vecTeams[nCurrentTeam].GetNextNumber();
+                pCameraTrackingObject = pObjectUnderControl;
+                fTurnTime = 15.0f;
+                ChangeWind();
+                bZoomOut = false;
+                nNextState = GS_START_PLAY;
+            }
+        }
+        break;
+
+        case GS_GAME_OVER1: // On dzoome et on clbre a par un grand tir de missiles !
+        {
+            bEnableComputerControl = false;
+            bEnablePlayerControl = false;
+            bZoomOut = true;
+            bShowCountDown = false;
+
+            for (int i = 0; i < 100; i++)
+            {
+                int nBombX = cRandom::Next() % nMapWidth;
+                int nBombY = cRandom::Next() % (nMapHeight / 2);
+                listObjects.push_back(unique_ptr<cMissile>(new cMissile(nBombX, nBombY, 0.0f, 0.5f)));
+            }
+
+            nNextState = GS_GAME_OVER2;
+        }
+        break;
+
+        case GS_GAME_OVER2: // On attend le retour du calme
+        {
+            bEnableComputerControl = false;
+            bEnablePlayerControl = false;
+            // Il n'y a pas de sortie de cette phase, le jeu n'a pas de fin en soi
+        }
+        break;
+        }
+
+        if (bEnableComputerControl)
         {
             // PHASES DE L'IA
             switch (nAIState)
@@ -566,616 +3119,2016 @@ private:
             case AI_ASSESS_ENVIRONMENT:
             {
                 // Choisit alatoirement entre trois options
-                int nAction = rand() % 3;
+                int nAction = cRandom::Next() % 3;
                 if (nAction == 0)
                 // On va la jouer dfensif : le Worm s'loigne de ses allis
                 // pour augmenter leur chance de survie
                 {
-                    // Prend son alli le plus proche
-                    float fNearestAllyDistance = INFINITY; float fDirection = 0;
-                    cWorm* origin = (cWorm*)pObjectUnderControl;
+                    // Prend son alli le plus proche
+                    float fNearestAllyDistance = INFINITY; float fDirection = 0;
+                    cWorm* origin = (cWorm*)pObjectUnderControl;
+
+                    for (auto w : vecTeams[nCurrentTeam].vecMembers)
+                    {
+                        if (w != pObjectUnderControl)
+                        {
+                            if (fabs(w->px - origin->px) < fNearestAllyDistance)
+                            {
+                                fNearestAllyDistance = fabs(w->px - origin->px);
+                                fDirection = (w->px - origin->px) < 0.0f ? 1.0f : -1.0f;
+                            }
+                        }
+                    }
+
+                    // Calcule o il doit aller se placer pour tre  une distance safe
+                    if (fNearestAllyDistance < 50.f)
+                        fAISafePosition = origin->px + fDirection * 80.0f;
+                    else
+                        fAISafePosition = origin->px;
+                }
+
+                if (nAction == 1)
+                // Offensif ! Le Worm va au milieu de l'cran, l d'o il peut toucher tout le monde
+               
+                {
+                    cWorm* origin = (cWorm*)pObjectUnderControl;
+                    float fDirection = ((float)(nMapWidth / 2.0f) - origin->px) < 0.0f ? -1.0f : 1.0f;
+                    fAISafePosition = origin->px + fDirection * 200.0f;
+                }
+
+                if (nAction == 2)  // Fait le mort. Neutre. Ne bouge pas.
+                {
+                    cWorm* origin = (cWorm*)pObjectUnderControl;
+                    fAISafePosition = origin->px;
+                }
+
+                // Empche les Worms de quitter la map
+                if (fAISafePosition <= 20.0f) fAISafePosition = 20.0f;
+                if (fAISafePosition >= nMapWidth - 20.0f) fAISafePosition = nMapWidth - 20.0f;
+
+                nAINextState = AI_MOVE;
+            }
+            break;
+
+            // L'IA se met en mouvement
+            case AI_MOVE:
+            {
+                cWorm* origin = (cWorm*)pObjectUnderControl;
+                if (fTurnTime >= 8.0f && origin->px != fAISafePosition)
+                {
+                    // Sautille jusqu' la position calcule prcdemment
+                    if (fAISafePosition < origin->px && bGameIsStable)
+                    {
+                        origin->fShootAngle = -3.14159f * 0.6f;
+                        bAI_Jump = true;
+                        nAINextState = AI_MOVE;
+                    }
+               
+                    if (fAISafePosition > origin->px && bGameIsStable)
+                    {
+                        origin->fShootAngle = -3.14159 * 0.04f;
+                        bAI_Jump = true;
+                        nAINextState = AI_MOVE;
+                    }
+                }
+                else
+                    nAINextState = AI_CHOOSE_TARGET;
+            }
+            break;
+
+            // Le Worm a fini de bouger, il choisit sa cible
+            case AI_CHOOSE_TARGET:  
+            {
+                bAI_Jump = false;
+
+                // En mode planification, l'IA essaie ses tirs avant de choisir
+                cWorm* origin = (cWorm*)pObjectUnderControl;
+                if (bAIPlanning && PlanShot(origin, lastPlan))
+                {
+                    SetAITarget(lastPlan.fAngle, lastPlan.fEnergy);
+                    break;
+                }
+
+                // Choisit une autre quipe que la sienne
+                int nCurrentTeam = origin->nTeam;
+                int nTargetTeam = 0;
+                do {
+                    nTargetTeam = cRandom::Next() % vecTeams.size();
+                } while (nTargetTeam == nCurrentTeam || !vecTeams[nTargetTeam].IsTeamAlive());
+
+                // Il va choisir le Worm adversaire avec la bar de sant la plus forte	
+                cWorm* mostHealthyWorm = vecTeams[nTargetTeam].vecMembers[0];
+                for (auto w : vecTeams[nTargetTeam].vecMembers)
+                    if (w->fHealth > mostHealthyWorm->fHealth)
+                        mostHealthyWorm = w;
+
+                pAITargetWorm = mostHealthyWorm;
+                fAITargetX = mostHealthyWorm->px;
+                fAITargetY = mostHealthyWorm->py;
+                nAINextState = AI_POSITION_FOR_TARGET;
+            }
+            break;
+
+            // Calcule la position adapte pour tirer sur sa cible.
+            // S'il doit bouger de nouveau, il le fait
+            case AI_POSITION_FOR_TARGET:
+            {
+                cWorm* origin = (cWorm*)pObjectUnderControl;
+                float dy = -(fAITargetY - origin->py);
+                float dx = -(fAITargetX - origin->px);
+                float fSpeed = 30.0f;
+                float fGravity = 2.0f;
+
+                bAI_Jump = false;
+
+                float a = fSpeed * fSpeed * fSpeed * fSpeed - fGravity * (fGravity * dx * dx + 2.0f * dy * fSpeed * fSpeed);
+
+                if (a < 0)   // La cible est trop loin
+                {
+                    // Il y a encore le temps. Le Worm va bouger.
+                    if (fTurnTime >= 5.0f)
+                    {
+                        if (pAITargetWorm->px < origin->px && bGameIsStable)
+                        {
+                            origin->fShootAngle = -3.14159f * 0.6f;
+                            bAI_Jump = true;
+                            nAINextState = AI_POSITION_FOR_TARGET;
+                        }
+
+                        if (pAITargetWorm->px > origin->px && bGameIsStable)
+                        {
+                            origin->fShootAngle = -3.14159f * 0.4f;
+                            bAI_Jump = true;
+                            nAINextState = AI_POSITION_FOR_TARGET;
+                        }
+                    }
+                    else  // Il n'y a plus assez de temps. Le Worm va tirer malgr tout.
+                    {
+                        fAITargetAngle = origin->fShootAngle;
+                        fAITargetEnergy = 0.75f;
+                        nAINextState = AI_AIM;
+                    }
+                }
+                else
+                {
+                    // Le Worm est assez prs de sa cible. Calcul de la trajectoire
+                    float b1 = fSpeed * fSpeed + sqrtf(a);
+                    float b2 = fSpeed * fSpeed - sqrtf(a);
+
+                    // Deux hauteurs permettent de toucher un point, en ballistique
+                    float fTheta1 = atanf(b1 / (fGravity * dx));  //Hauteur la plus grande
+                    float fTheta2 = atanf(b2 / (fGravity * dx));  //Hauteur la plus petite
+
+                    // La hauteur max a plus de chance de faire passer
+                    // le missile au-dessus des obstacles.
+                    // Le Worm choisit celle-ci et calcule l'angle.
+                    fAITargetAngle = fTheta1 - (dx > 0 ? 3.14159f : 0.0f);
+                    float fFireX = cosf(fAITargetAngle);
+                    float fFireY = sinf(fAITargetAngle);
+
+                    fAITargetEnergy = 0.75f;
+
+                    // Le vent et la trane faussent la formule : la vise est corrige
+                    // en simulant le tir dans le mme air que la physique
+                    if (bForces)
+                        fAITargetAngle = CorrectAim(origin->px, origin->py, fAITargetAngle, fAITargetEnergy, fAITargetX, fAITargetY);
+                    nAINextState = AI_AIM;
+                }
+
+                if (nAINextState == AI_AIM)
+                    SetAITarget(fAITargetAngle, fAITargetEnergy);
+            }
+            break;
+
+            case AI_AIM:  // Le Worm vise
+            {
+                cWorm* worm = (cWorm*)pObjectUnderControl;
+
+                bAI_AimLeft = false;
+                bAI_AimRight = false;
+                bAI_Jump = false;
+
+                if (worm->fShootAngle < fAITargetAngle)
+                    bAI_AimRight = true;
+                else
+                    bAI_AimLeft = true;
+
+                // Il a trouv le bon angle
+                if (fabs(worm->fShootAngle - fAITargetAngle) <= 0.001f)
+                {
+                    bAI_AimLeft = false;
+                    bAI_AimRight = false;
+                    fEnergyLevel = 0.0f;
+                    nAINextState = AI_FIRE;
+                }
+                else
+                    nAINextState = AI_AIM;
+
+            }
+            break;
+
+            // L'IA tire
+            case AI_FIRE:
+            {
+                bAI_Energise = true;
+                bFireWeapon = false;
+                bEnergising = true;
+
+                if (fEnergyLevel >= fAITargetEnergy)
+                {
+                    bFireWeapon = true;
+                    bAI_Energise = false;
+                    bEnergising = false;
+                    bEnableComputerControl = false;
+                    nAINextState = AI_ASSESS_ENVIRONMENT;
+                }
+            }
+            break;
+            }
+        }
+
+        fTurnTime -= fElapsedTime;
+
+        if (pObjectUnderControl != nullptr)
+        {
+            pObjectUnderControl->ax = 0.0f;
+
+            // A : passe  l'arme suivante, tant que le tir n'est pas en train de se charger
+            if (bEnablePlayerControl && (nControls & CTRL_NEXT_WEAPON) && !bEnergising)
+                nWeapon = (nWeapon + 1) % weapons.Size();
+
+            if (pObjectUnderControl->bStable)
+            {
+                // Contrle les dplacemnets joueur ET l'IA par la mme occasion
+
+                // Saute
+                if ((bEnablePlayerControl && (nControls & CTRL_JUMP)) || (bEnableComputerControl && bAI_Jump))
+                {
+                    float a = ((cWorm*)pObjectUnderControl)->fShootAngle;
 
-                    for (auto w : vecTeams[nCurrentTeam].vecMembers)
+                    // Les sauts de l'IA vont dans le replay
+                    if (bEnableComputerControl)
+                        if (const sReplayEvent* e = ReplayEvent({ nReplayFrame, sReplayEvent::AI_JUMP, 0, a, 0.0f }))
+                            ((cWorm*)pObjectUnderControl)->fShootAngle = a = e->fA;
+
+                    pObjectUnderControl->vx = 4.0f * cosf(a);
+                    pObjectUnderControl->vy = 8.0f * sinf(a);
+                    pObjectUnderControl->bStable = false;
+
+                    bAI_Jump = false;
+                }
+
+                // Vise vers la gauche
+                if ((bEnablePlayerControl && (nControls & CTRL_AIM_LEFT)) || (bEnableComputerControl && bAI_AimLeft))
+                {
+                    cWorm* worm = (cWorm*)pObjectUnderControl;
+                    worm->fShootAngle -= 1.0f * fElapsedTime;
+                    if (worm->fShootAngle < -3.14159f) worm->fShootAngle += 3.14159f * 2.0f;
+                }
+
+                // Vise vers la droite
+                if ((bEnablePlayerControl && (nControls & CTRL_AIM_RIGHT)) || (bEnableComputerControl && bAI_AimRight))
+                {
+                    cWorm* worm = (cWorm*)pObjectUnderControl;
+                    worm->fShootAngle += 1.0f * fElapsedTime;
+                    if (worm->fShootAngle > 3.14159f) worm->fShootAngle -= 3.14159f * 2.0f;
+                }
+
+                // Espace : emmagasine puissance du tir
+                if (bEnablePlayerControl && (nControls & CTRL_FIRE_PRESS))
+                {
+                    bEnergising = true;
+                    fEnergyLevel = 0.0f;
+                    bFireWeapon = false;
+                }
+
+                if ((bEnablePlayerControl && (nControls & CTRL_FIRE_HOLD)) || (bEnableComputerControl && bAI_Energise))
+                {
+                    if (bEnergising)
                     {
-                        if (w != pObjectUnderControl)
+                        fEnergyLevel += 0.75f * fElapsedTime;
+                        if (fEnergyLevel >= 1.0f)
                         {
-                            if (fabs(w->px - origin->px) < fNearestAllyDistance)
-                            {
-                                fNearestAllyDistance = fabs(w->px - origin->px);
-                                fDirection = (w->px - origin->px) < 0.0f ? 1.0f : -1.0f;
-                            }
+                            fEnergyLevel = 1.0f;
+                            bFireWeapon = true;
                         }
                     }
+                }
+                // Tire !
+                if (bEnablePlayerControl && (nControls & CTRL_FIRE_RELEASE))
+                {
+                    if (bEnergising)
+                    {
+                        bFireWeapon = true;
+                    }
 
-                    // Calcule o il doit aller se placer pour tre  une distance safe
-                    if (fNearestAllyDistance < 50.f)
-                        fAISafePosition = origin->px + fDirection * 80.0f;
-                    else
-                        fAISafePosition = origin->px;
+                    bEnergising = false;
                 }
+            }
 
-                if (nAction == 1)
-                // Offensif ! Le Worm va au milieu de l'cran, l d'o il peut toucher tout le monde
-               
+            // La camra
+            if (pCameraTrackingObject != nullptr)
+                TrackCamera(pCameraTrackingObject, fElapsedTime);
+
+            if (bFireWeapon)
+            {
+                cWorm* worm = (cWorm*)pObjectUnderControl;
+
+                //Origine du tir
+                float ox = worm->px;
+                float oy = worm->py;
+
+                //Direction du tir
+                float dx = cosf(worm->fShootAngle);
+                float dy = sinf(worm->fShootAngle);
+
+                //Cre le projectile de l'arme choisie
+                cMissile* m = new cMissile(ox, oy, dx * 40.0f * fEnergyLevel, dy * 40.0f * fEnergyLevel, weapons[nWeapon]);
+                listObjects.push_back(unique_ptr<cMissile>(m));
+                PlaySample(nSoundFire);
+
+                //Attache la camra au missile
+                pCameraTrackingObject = m;
+
+                bFireWeapon = false;
+                fEnergyLevel = 0.0f;
+                bEnergising = false;
+
+                bPlayerHasFired = true;
+
+                if (cRandom::Next() % 100 >= 50)
+                    bZoomOut = true;
+            }
+        }
+
+
+        // Bloque la camra dans les limites de la map
+        if (fCameraPosX < 0) fCameraPosX = 0;
+        if (fCameraPosX >= nMapWidth - ScreenWidth()) fCameraPosX = nMapWidth - ScreenWidth();
+        if (fCameraPosY < 0) fCameraPosY = 0;
+        if (fCameraPosY >= nMapHeight - ScreenHeight()) fCameraPosY = nMapHeight - ScreenHeight();
+
+
+        //On rpte 10 itrations par frames (ncessaire pour le gameplay). Avec le
+        //balayage des collisions, le mme temps de jeu se fait en moins de pas, plus longs
+        int nSteps = PhysicsStepsPerFrame(fElapsedTime);
+        float fStep = nPhysics != PHYSICS_FIXED ? 10.0f * fElapsedTime / nSteps : fElapsedTime;
+        for (int z = 0; z < nSteps; z++)
+            PhysicsStep(fStep);
+
+        // Le dcor, en un pas pour toute la frame
+        particles.Update(terrain, 10.0f * fElapsedTime, forces);
+
+        // Sur une grande map, range les tuiles qui ne servent plus
+        terrain.Evict();
+
+        // Vrifie si le jeu est "stable" (cad les objets au repos)
+        bGameIsStable = true;
+        for (auto& p : listObjects)
+            if (!p->bStable)
+            {
+                bGameIsStable = false;
+                break;
+            }
+
+        // State Machine
+        bool bNewTurn = nNextState == GS_START_PLAY && nGameState != GS_START_PLAY;
+        nGameState = nNextState;
+        nAIState = nAINextState;
+
+        if (nReplayMode != REPLAY_OFF)
+        {
+            // Chaque tour commence par un vnement, puis un keyframe avant sa premire frame
+            if (bNewTurn)
+                ReplayEvent({ nReplayFrame, sReplayEvent::TURN, nCurrentTeam, (float)vecTeams[nCurrentTeam].nCurrentMember, 0.0f });
+
+            nReplayFrame++;
+            if (nReplayMode == REPLAY_RECORD)
+                replay.nFrames = nReplayFrame;
+
+            if (bNewTurn)
+            {
+                if (vecKeyframes.empty() || vecKeyframes.back().nFrame < nReplayFrame)
                 {
-                    cWorm* origin = (cWorm*)pObjectUnderControl;
-                    float fDirection = ((float)(nMapWidth / 2.0f) - origin->px) < 0.0f ? -1.0f : 1.0f;
-                    fAISafePosition = origin->px + fDirection * 200.0f;
+                    vecKeyframes.push_back({ nReplayFrame, {} });
+                    SaveState(vecKeyframes.back().vecState);
                 }
+            }
+        }
+    }
 
-                if (nAction == 2)  // Fait le mort. Neutre. Ne bouge pas.
+    // Les commandes du joueur pour la frame  simuler : lues au clavier (et
+    // enregistres quand elles changent), ou reprises du replay en relecture
+    uint8_t ReadControls()
+    {
+        if (nReplayMode == REPLAY_PLAY)
+        {
+            while (nReplayControl < replay.vecControls.size() && replay.vecControls[nReplayControl].first <= nReplayFrame)
+                nReplayControl++;
+            return nReplayControl == 0 ? 0 : replay.vecControls[nReplayControl - 1].second;
+        }
+
+        uint8_t nControls = 0;
+        if (m_keys[L'Z'].bPressed) nControls |= CTRL_JUMP;
+        if (m_keys[L'Q'].bHeld) nControls |= CTRL_AIM_LEFT;
+        if (m_keys[L'D'].bHeld) nControls |= CTRL_AIM_RIGHT;
+        if (m_keys[VK_SPACE].bPressed) nControls |= CTRL_FIRE_PRESS;
+        if (m_keys[VK_SPACE].bHeld) nControls |= CTRL_FIRE_HOLD;
+        if (m_keys[VK_SPACE].bReleased) nControls |= CTRL_FIRE_RELEASE;
+        if (m_keys[L'A'].bPressed) nControls |= CTRL_NEXT_WEAPON;
+
+        if (nReplayMode == REPLAY_RECORD)
+        {
+            uint8_t nLast = replay.vecControls.empty() ? 0 : replay.vecControls.back().second;
+            if (nControls != nLast)
+                replay.vecControls.push_back({ nReplayFrame, nControls });
+        }
+        return nControls;
+    }
+
+    // Enregistre un vnement, ou le compare  celui attendu en relecture. Renvoie
+    // alors l'vnement du replay, dont les valeurs remplacent celles recalcules :
+    // une petite divergence (un atanf un peu diffrent d'une machine  l'autre)
+    // est compte mais ne fait pas drailler la suite
+    const sReplayEvent* ReplayEvent(const sReplayEvent& e)
+    {
+        if (nReplayMode == REPLAY_RECORD)
+            replay.vecEvents.push_back(e);
+
+        if (nReplayMode != REPLAY_PLAY)
+            return nullptr;
+
+        // Des vnements attendus plus tt ne sont jamais venus
+        while (nReplayEvent < replay.vecEvents.size() && replay.vecEvents[nReplayEvent].nFrame < e.nFrame)
+        {
+            if (nReplayDesyncs++ == 0)
+                nReplayFirstDesync = replay.vecEvents[nReplayEvent].nFrame;
+            nReplayEvent++;
+        }
+
+        const sReplayEvent* r = nullptr;
+        if (nReplayEvent < replay.vecEvents.size())
+        {
+            r = &replay.vecEvents[nReplayEvent];
+            if (r->nFrame != e.nFrame || r->nType != e.nType)
+                r = nullptr;
+        }
+
+        if (r == nullptr || r->nValue != e.nValue || r->fA != e.fA || r->fB != e.fB)
+        {
+            if (nReplayDesyncs++ == 0)
+                nReplayFirstDesync = nReplayFrame;
+        }
+
+        if (r != nullptr)
+            nReplayEvent++;
+        return r;
+    }
+
+    // Remet le jeu au tout dbut d'une partie, avec cette graine
+    void RestartMatch(uint32_t nSeed)
+    {
+        cRandom::Seed(nSeed);
+        nGameState = nNextState = GS_RESET;
+        nAIState = nAINextState = AI_ASSESS_ENVIRONMENT;
+        bAI_Jump = bAI_AimLeft = bAI_AimRight = bAI_Energise = false;
+        bEnergising = bFireWeapon = false;
+        fEnergyLevel = 0.0f;
+        fTurnTime = 0.0f;
+        forces = sForces();
+
+        nReplayFrame = 0;
+        nReplayControl = 0;
+        nReplayEvent = 0;
+    }
+
+    // L'IA a choisi sa vise : elle va dans le replay, puis le Worm vise
+    void SetAITarget(float fAngle, float fEnergy)
+    {
+        fAITargetAngle = fAngle;
+        fAITargetEnergy = fEnergy;
+        if (const sReplayEvent* e = ReplayEvent({ nReplayFrame, sReplayEvent::AI_TARGET, 0, fAITargetAngle, fAITargetEnergy }))
+        {
+            fAITargetAngle = e->fA;
+            fAITargetEnergy = e->fB;
+        }
+        nAINextState = AI_AIM;
+    }
+
+    // Commence une partie neuve, enregistre dans le replay
+    void StartRecording(uint32_t nSeed)
+    {
+        replay.Clear();
+        replay.nSeed = nSeed;
+        replay.nTeams = nTeams;
+        replay.nWormsPerTeam = nWormsPerTeam;
+        replay.nMapWidth = nMapWidth;
+        replay.nMapHeight = nMapHeight;
+        replay.bAllTeamsComputer = bAllTeamsComputer ? 1 : 0;
+        replay.bAIPlanning = bAIPlanning ? 1 : 0;
+        replay.bMapFile = bMapFile ? 1 : 0;
+        replay.nPhysics = (uint8_t)nPhysics;
+        replay.bObjectCollisions = bObjectCollisions ? 1 : 0;
+        replay.nWeapon = (uint8_t)nWeapon;
+        replay.weapons = weapons;
+        replay.bForces = bForces ? 1 : 0;
+        replay.nObjectBudget = nObjectBudget;
+        replay.bParticles = bParticles ? 1 : 0;
+        replay.bCameraLead = bCameraLead ? 1 : 0;
+        vecKeyframes.clear();
+
+        RestartMatch(nSeed);
+        nReplayMode = REPLAY_RECORD;
+    }
+
+    // Rejoue le replay charg, depuis le dbut
+    void StartPlayback()
+    {
+        nTeams = replay.nTeams;
+        nWormsPerTeam = replay.nWormsPerTeam;
+        bAllTeamsComputer = replay.bAllTeamsComputer != 0;
+        bAIPlanning = replay.bAIPlanning != 0;
+        bMapFile = replay.bMapFile != 0 && bitmap.IsOpen();
+        nPhysics = (PHYSICS)replay.nPhysics;
+        bObjectCollisions = replay.bObjectCollisions != 0;
+
+        // Les projectiles pointent dans la table des armes : la partie en cours part avec elle
+        listObjects.clear();
+        vecTeams.clear();
+        pObjectUnderControl = pCameraTrackingObject = pAITargetWorm = nullptr;
+        weapons = replay.weapons;
+        nWeapon = replay.nWeapon;
+        bForces = replay.bForces != 0;
+        nObjectBudget = replay.nObjectBudget;
+        bParticles = replay.bParticles != 0;
+        bCameraLead = replay.bCameraLead != 0;
+        particles.Clear();
+        if (nMapWidth != replay.nMapWidth || nMapHeight != replay.nMapHeight)
+        {
+            nMapWidth = replay.nMapWidth;
+            nMapHeight = replay.nMapHeight;
+            terrain.Create(nMapWidth, nMapHeight);
+        }
+        vecKeyframes.clear();
+        nReplayDesyncs = 0;
+        nReplayFirstDesync = 0;
+        fReplayTime = 0.0f;
+
+        RestartMatch(replay.nSeed);
+        nReplayMode = REPLAY_PLAY;
+    }
+
+    // Simule la frame suivante du replay. Renvoie false une fois le replay termin
+    bool ReplayStep()
+    {
+        if (nReplayMode != REPLAY_PLAY || nReplayFrame >= replay.nFrames)
+            return false;
+        UpdateSimulation(replay.TimeStep(nReplayFrame));
+        return true;
+    }
+
+    // Se place  la frame nFrame du replay : repart du dernier keyframe qui la prcde
+    // (ou du dbut de la partie), puis simule le reste sans rien dessiner
+    void SeekReplay(uint32_t nFrame)
+    {
+        if (nReplayMode != REPLAY_PLAY)
+            return;
+        if (nFrame > replay.nFrames)
+            nFrame = replay.nFrames;
+
+        auto it = upper_bound(vecKeyframes.begin(), vecKeyframes.end(), nFrame,
+            [](uint32_t f, const sKeyframe& k) { return f < k.nFrame; });
+
+        // Revenir en arrire, ou sauter par-dessus des tours dj connus
+        if (nFrame < nReplayFrame || (it != vecKeyframes.begin() && (it - 1)->nFrame > nReplayFrame))
+        {
+            if (it == vecKeyframes.begin())
+                RestartMatch(replay.nSeed);
+            else
+                LoadKeyframe(*(it - 1));
+        }
+
+        while (nReplayFrame < nFrame)
+            ReplayStep();
+    }
+
+    void LoadKeyframe(const sKeyframe& k)
+    {
+        LoadState(k.vecState);
+        nReplayFrame = k.nFrame;
+
+        // Les curseurs se replacent sur la premire entre  partir de cette frame
+        nReplayControl = lower_bound(replay.vecControls.begin(), replay.vecControls.end(), make_pair(k.nFrame, (uint8_t)0)) - replay.vecControls.begin();
+        nReplayEvent = lower_bound(replay.vecEvents.begin(), replay.vecEvents.end(), k.nFrame,
+            [](const sReplayEvent& e, uint32_t f) { return e.nFrame < f; }) - replay.vecEvents.begin();
+    }
+
+    // Snapshot : l'tat complet du jeu,  plat. Un en-tte versionn, la map tuile
+    // par tuile (rien pour une tuile intacte, que le bruit de la map refera, une
+    // valeur pour une tuile unie, des plages de cases identiques pour les autres :
+    // une map 1024x512 tient en quelques Ko), puis tout ce qui pilote
+    // la partie, les objets et les quipes. Les pointeurs deviennent des indices
+    // dans listObjects. Sert aux keyframes des replays et aux sauvegardes.
+    static const uint32_t nSnapshotVersion = 5;     // 2 : la map en tuiles, 3 : tuiles refaites par la source, 4 : les armes, 5 : l'air
+
+    // D'o viennent les tuiles intactes de la map
+    enum MAP_SOURCE
+    {
+        SOURCE_NONE = 0,
+        SOURCE_NOISE = 1,
+        SOURCE_FILE = 2
+    };
+
+    // Les tuiles dj encodes, avec la gnration qu'elles avaient : d'un
+    // keyframe  l'autre, seules celles qu'un cratre a touches sont refaites
+    struct sEncodedTile
+    {
+        uint32_t nGeneration = 0;
+        vector<uint8_t> vecBytes;
+    };
+    vector<sEncodedTile> vecEncodedTiles;
+
+    void SaveState(vector<uint8_t>& vecState)
+    {
+        vecState.clear();
+        sByteWriter w{ vecState };
+
+        vecState.insert(vecState.end(), { 'W', 'S', 'N', 'P' });
+        w.Put((uint32_t)nSnapshotVersion);
+        w.Put(cRandom::nState);
+        w.Put(nMapWidth); w.Put(nMapHeight);
+        w.Put((uint8_t)(terrain.pSource == &noise ? SOURCE_NOISE : terrain.pSource == &bitmap ? SOURCE_FILE : SOURCE_NONE)); w.Put(noise.nSeed);
+
+        // La map, tuile par tuile
+        vecEncodedTiles.resize((size_t)terrain.nTilesX * terrain.nTilesY);
+        for (int ty = 0; ty < terrain.nTilesY; ty++)
+            for (int tx = 0; tx < terrain.nTilesX; tx++)
+            {
+                sEncodedTile& e = vecEncodedTiles[ty * terrain.nTilesX + tx];
+                if (e.nGeneration != terrain.Tile(tx, ty).nGeneration)
                 {
-                    cWorm* origin = (cWorm*)pObjectUnderControl;
-                    fAISafePosition = origin->px;
+                    e.vecBytes.clear();
+                    sByteWriter wTile{ e.vecBytes };
+                    terrain.WriteTile(wTile, tx, ty);
+                    e.nGeneration = terrain.Tile(tx, ty).nGeneration;
                 }
+                vecState.insert(vecState.end(), e.vecBytes.begin(), e.vecBytes.end());
+            }
 
-                // Empche les Worms de quitter la map
-                if (fAISafePosition <= 20.0f) fAISafePosition = 20.0f;
-                if (fAISafePosition >= nMapWidth - 20.0f) fAISafePosition = nMapWidth - 20.0f;
+        w.Put(fCameraPosX); w.Put(fCameraPosY); w.Put(fCameraPosXTarget); w.Put(fCameraPosYTarget);
+        w.Put(bZoomOut); w.Put(bGameIsStable); w.Put(bEnablePlayerControl); w.Put(bEnableComputerControl);
+        w.Put(bAllTeamsComputer); w.Put(bEnergising); w.Put(bFireWeapon); w.Put(bShowCountDown); w.Put(bPlayerHasFired);
+        w.Put(fEnergyLevel); w.Put(fTurnTime);
+        w.Put(nTeams); w.Put(nWormsPerTeam); w.Put(nCurrentTeam); w.Put(nWeapon);
+        w.Put(forces.fWind);
+        w.PutVarint((uint32_t)forces.vecBlasts.size());
+        for (auto& b : forces.vecBlasts)
+        {
+            w.Put(b.x); w.Put(b.y); w.Put(b.fSpeed); w.Put(b.fRadius); w.Put(b.fTime); w.Put(b.fDuration);
+        }
 
-                nAINextState = AI_MOVE;
+        w.Put(bAI_Jump); w.Put(bAI_AimLeft); w.Put(bAI_AimRight); w.Put(bAI_Energise);
+        w.Put(fAITargetAngle); w.Put(fAITargetEnergy); w.Put(fAISafePosition); w.Put(fAITargetX); w.Put(fAITargetY);
+        w.Put((uint8_t)nGameState); w.Put((uint8_t)nNextState); w.Put((uint8_t)nAIState); w.Put((uint8_t)nAINextState);
+
+        // Les objets : un type, l'tat commun, puis ce qui est propre aux worms ou
+        // aux projectiles (leur arme, par son indice dans la table des armes).
+        // Les membres des quipes se retrouvent  partir des worms (nTeam, nTeamMember)
+        uint32_t nControlled = 0, nTracked = 0, nTarget = 0; // Indice + 1, 0 pour nullptr
+        uint32_t nIndex = 0;
+        w.PutVarint((uint32_t)listObjects.size());
+        for (auto& p : listObjects)
+        {
+            nIndex++;
+            if (p.get() == pObjectUnderControl) nControlled = nIndex;
+            if (p.get() == pCameraTrackingObject) nTracked = nIndex;
+            if (p.get() == pAITargetWorm) nTarget = nIndex;
+
+            cWorm* worm = dynamic_cast<cWorm*>(p.get());
+            uint8_t nType = worm != nullptr ? 2 : dynamic_cast<cMissile*>(p.get()) != nullptr ? 1 : 0;
+            w.Put(nType);
+            w.Put(p->px); w.Put(p->py); w.Put(p->vx); w.Put(p->vy); w.Put(p->ax); w.Put(p->ay);
+            w.Put(p->radius); w.Put(p->bStable); w.Put(p->fFriction); w.Put(p->nBounceBeforeDeath); w.Put(p->bDead); w.Put(p->fDrag);
+            if (worm != nullptr)
+            {
+                w.Put(worm->fShootAngle); w.Put(worm->fHealth); w.Put(worm->nTeam); w.Put(worm->bIsPlayable);
+                w.Put(worm->nTeamMember); w.Put((uint8_t)(worm->pTeam != nullptr));
             }
-            break;
+            else if (nType == 1)
+            {
+                int nIndex = weapons.IndexOf(p->pWeapon);
+                w.Put((uint8_t)(nIndex < 0 ? 255 : nIndex)); w.Put(p->fFuse);
+            }
+        }
+        w.PutVarint(nControlled);
+        w.PutVarint(nTracked);
+        w.PutVarint(nTarget);
 
-            // L'IA se met en mouvement
-            case AI_MOVE:
+        w.PutVarint((uint32_t)vecTeams.size());
+        for (auto& t : vecTeams)
+        {
+            w.Put(t.nCurrentMember); w.Put(t.nTeamSize); w.Put(t.nAlive); w.Put(t.fTotalHealth);
+            w.PutVarint((uint32_t)t.vecMembers.size());
+            for (size_t m = 0; m < t.vecMembers.size(); m++)
             {
-                cWorm* origin = (cWorm*)pObjectUnderControl;
-                if (fTurnTime >= 8.0f && origin->px != fAISafePosition)
-                {
-                    // Sautille jusqu' la position calcule prcdemment
-                    if (fAISafePosition < origin->px && bGameIsStable)
-                    {
-                        origin->fShootAngle = -3.14159f * 0.6f;
-                        bAI_Jump = true;
-                        nAINextState = AI_MOVE;
-                    }
-               
-                    if (fAISafePosition > origin->px && bGameIsStable)
-                    {
-                        origin->fShootAngle = -3.14159 * 0.04f;
-                        bAI_Jump = true;
-                        nAINextState = AI_MOVE;
-                    }
-                }
+                w.PutVarint((uint32_t)t.vecNextAlive[m]);
+                w.PutVarint((uint32_t)t.vecPrevAlive[m]);
+            }
+        }
+    }
+
+    // L'inverse de SaveState. Si le snapshot est illisible (autre version, fichier
+    // tronqu), renvoie false et le jeu repart d'une partie neuve
+    bool LoadState(const vector<uint8_t>& vecState)
+    {
+        sByteReader r(vecState);
+
+        char sMagic[4] = {};
+        uint32_t nVersion = 0, nRandomState = 0;
+        int nWidth = 0, nHeight = 0;
+        uint8_t nMapSource = SOURCE_NONE;
+        uint32_t nMapSeed = 0;
+        r.Get(sMagic); r.Get(nVersion); r.Get(nRandomState); r.Get(nWidth); r.Get(nHeight);
+        r.Get(nMapSource); r.Get(nMapSeed);
+        if (!r.bOk || memcmp(sMagic, "WSNP", 4) != 0 || nVersion != nSnapshotVersion ||
+            nWidth <= 0 || nHeight <= 0 || nWidth > 0x100000 || nHeight > 0x10000 || nMapSource > SOURCE_FILE)
+            return RestartAfterBadState();
+
+        // Les tuiles intactes d'une map dessine se relisent dans son fichier
+        if (nMapSource == SOURCE_FILE && (!bitmap.IsOpen() || bitmap.nWidth != nWidth || bitmap.nHeight != nHeight))
+            return RestartAfterBadState();
+
+        // Toutes les tuiles doivent tre compltes, avant de toucher  quoi que ce soit
+        int nTilesX = (nWidth + cTerrain::nTileMask) >> cTerrain::nTileShift;
+        int nTilesY = (nHeight + cTerrain::nTileMask) >> cTerrain::nTileShift;
+        vector<char> vecCells(cTerrain::nTileCells);
+        uint8_t nKind = 0;
+        char nValue = 0;
+        sByteReader rMap = r;
+        for (int t = 0; t < nTilesX * nTilesY && rMap.bOk; t++)
+            cTerrain::ReadTile(rMap, vecCells.data(), nKind, nValue);
+        if (!rMap.bOk)
+            return RestartAfterBadState();
+
+        // Une autre map : le bruit est refait  partir de sa graine, et les tuiles
+        // intactes le seront au besoin
+        const cTerrainSource* pSource = nullptr;
+        if (nMapSource == SOURCE_NOISE) pSource = &noise;
+        if (nMapSource == SOURCE_FILE) pSource = &bitmap;
+        bool bSameNoise = noise.nSeed == nMapSeed && (int)noise.vecSurface.size() == nWidth && noise.nHeight == nHeight;
+        if (nWidth != nMapWidth || nHeight != nMapHeight || terrain.pSource != pSource || (nMapSource == SOURCE_NOISE && !bSameNoise))
+        {
+            nMapWidth = nWidth;
+            nMapHeight = nHeight;
+            if (nMapSource == SOURCE_NOISE && !bSameNoise)
+            {
+                cRandom::Seed(nMapSeed);
+                CreateNoise();
+            }
+            terrain.Create(nMapWidth, nMapHeight, pSource, true);
+        }
+
+        for (int ty = 0; ty < nTilesY; ty++)
+            for (int tx = 0; tx < nTilesX; tx++)
+            {
+                cTerrain::ReadTile(r, vecCells.data(), nKind, nValue);
+                if (nKind == cTerrain::TILE_SOURCE)
+                    terrain.ResetTile(tx, ty);
+                else if (nKind == cTerrain::TILE_UNIFORM)
+                    terrain.FillTile(tx, ty, nValue);
                 else
-                    nAINextState = AI_CHOOSE_TARGET;
+                    terrain.SetTile(tx, ty, vecCells.data());
             }
-            break;
 
-            // Le Worm a fini de bouger, il choisit sa cible
-            case AI_CHOOSE_TARGET:  
+        r.Get(fCameraPosX); r.Get(fCameraPosY); r.Get(fCameraPosXTarget); r.Get(fCameraPosYTarget);
+        r.Get(bZoomOut); r.Get(bGameIsStable); r.Get(bEnablePlayerControl); r.Get(bEnableComputerControl);
+        r.Get(bAllTeamsComputer); r.Get(bEnergising); r.Get(bFireWeapon); r.Get(bShowCountDown); r.Get(bPlayerHasFired);
+        r.Get(fEnergyLevel); r.Get(fTurnTime);
+        r.Get(nTeams); r.Get(nWormsPerTeam); r.Get(nCurrentTeam); r.Get(nWeapon);
+        r.bOk = r.bOk && nWeapon >= 0 && nWeapon < weapons.Size();
+        r.Get(forces.fWind);
+        uint32_t nBlasts = r.GetVarint();
+        r.bOk = r.bOk && nBlasts <= (uint32_t)sForces::nMaxBlasts && fabsf(forces.fWind) <= fMaxWind;
+        forces.vecBlasts.assign(r.bOk ? nBlasts : 0, sForces::sBlast());
+        for (auto& b : forces.vecBlasts)
+        {
+            r.Get(b.x); r.Get(b.y); r.Get(b.fSpeed); r.Get(b.fRadius); r.Get(b.fTime); r.Get(b.fDuration);
+            r.bOk = r.bOk && fabsf(b.x) < 1e7f && fabsf(b.y) < 1e7f && fabsf(b.fSpeed) <= 100.0f &&
+                b.fRadius > 0.0f && b.fRadius < 1e7f && b.fDuration > 0.0f && b.fTime <= b.fDuration;
+        }
+
+        r.Get(bAI_Jump); r.Get(bAI_AimLeft); r.Get(bAI_AimRight); r.Get(bAI_Energise);
+        r.Get(fAITargetAngle); r.Get(fAITargetEnergy); r.Get(fAISafePosition); r.Get(fAITargetX); r.Get(fAITargetY);
+        uint8_t nStates[4] = {};
+        r.Get(nStates);
+        nGameState = (GAME_STATE)nStates[0];
+        nNextState = (GAME_STATE)nStates[1];
+        nAIState = (AI_STATE)nStates[2];
+        nAINextState = (AI_STATE)nStates[3];
+        r.bOk = r.bOk && nStates[0] <= GS_GAME_OVER2 && nStates[1] <= GS_GAME_OVER2 && nStates[2] <= AI_FIRE && nStates[3] <= AI_FIRE;
+
+        // Chaque objet prend au moins 30 octets : un compte plus grand que le snapshot est faux
+        uint32_t nObjects = r.GetVarint();
+        r.Has((size_t)nObjects * 30);
+        listObjects.clear();
+        particles.Clear();   // Le dcor n'est pas dans les snapshots
+        vector<cPhysicsObject*> vecObjects;
+        vector<cWorm*> vecWorms;
+        vecObjects.reserve(r.bOk ? nObjects : 0);
+        for (uint32_t n = 0; r.bOk && n < nObjects; n++)
+        {
+            uint8_t nType = 0;
+            r.Get(nType);
+            cPhysicsObject* o = nType == 2 ? (cPhysicsObject*)new cWorm() : nType == 1 ? (cPhysicsObject*)new cMissile() : (cPhysicsObject*)new cDebris();
+            listObjects.push_back(unique_ptr<cPhysicsObject>(o));
+            vecObjects.push_back(o);
+
+            r.Get(o->px); r.Get(o->py); r.Get(o->vx); r.Get(o->vy); r.Get(o->ax); r.Get(o->ay);
+            r.Get(o->radius); r.Get(o->bStable); r.Get(o->fFriction); r.Get(o->nBounceBeforeDeath); r.Get(o->bDead); r.Get(o->fDrag);
+            r.bOk = r.bOk && !o->bDead;     // Retirs de la liste avant tout snapshot
+            r.bOk = r.bOk && o->fDrag >= 0.0f && o->fDrag <= 1.0f;
+            if (nType == 2)
+            {
+                cWorm* worm = (cWorm*)o;
+                uint8_t bInTeam = 0;
+                r.Get(worm->fShootAngle); r.Get(worm->fHealth); r.Get(worm->nTeam); r.Get(worm->bIsPlayable);
+                r.Get(worm->nTeamMember); r.Get(bInTeam);
+                if (bInTeam)
+                    vecWorms.push_back(worm);
+            }
+            else if (nType == 1)
+            {
+                uint8_t nIndex = 255;
+                r.Get(nIndex); r.Get(o->fFuse);
+                r.bOk = r.bOk && (nIndex == 255 || nIndex < weapons.Size());
+                o->pWeapon = nIndex < weapons.Size() ? weapons[nIndex] : sWeapon::Missile();
+            }
+        }
+
+        auto ObjectAt = [&](uint32_t n) { return n > 0 && n <= vecObjects.size() ? vecObjects[n - 1] : nullptr; };
+        pObjectUnderControl = ObjectAt(r.GetVarint());
+        pCameraTrackingObject = ObjectAt(r.GetVarint());
+        pAITargetWorm = dynamic_cast<cWorm*>(ObjectAt(r.GetVarint()));
+        r.bOk = r.bOk && (pObjectUnderControl == nullptr || dynamic_cast<cWorm*>(pObjectUnderControl) != nullptr);
+
+        uint32_t nTeamCount = r.GetVarint();
+        r.Has(nTeamCount);
+        vecTeams.clear();
+        vecTeams.resize(r.bOk ? nTeamCount : 0);
+        for (auto& t : vecTeams)
+        {
+            r.Get(t.nCurrentMember); r.Get(t.nTeamSize); r.Get(t.nAlive); r.Get(t.fTotalHealth);
+            uint32_t nMembers = r.GetVarint();
+            if (!r.Has((size_t)nMembers * 2))
+                break;
+            t.vecMembers.assign(nMembers, nullptr);
+            t.vecNextAlive.resize(nMembers);
+            t.vecPrevAlive.resize(nMembers);
+            for (uint32_t m = 0; m < nMembers; m++)
             {
-                bAI_Jump = false;
+                t.vecNextAlive[m] = (int)r.GetVarint();
+                t.vecPrevAlive[m] = (int)r.GetVarint();
+                r.bOk = r.bOk && (uint32_t)t.vecNextAlive[m] < nMembers && (uint32_t)t.vecPrevAlive[m] < nMembers;
+            }
+            r.bOk = r.bOk && t.nCurrentMember >= 0 && (uint32_t)t.nCurrentMember < nMembers;
+        }
+        r.bOk = r.bOk && (vecTeams.empty() || (nCurrentTeam >= 0 && nCurrentTeam < (int)vecTeams.size()));
 
-                // Choisit une autre quipe que la sienne
-                cWorm* origin = (cWorm*)pObjectUnderControl;
-                int nCurrentTeam = origin->nTeam;
-                int nTargetTeam = 0;
-                do {
-                    nTargetTeam = rand() % vecTeams.size();
-                } while (nTargetTeam == nCurrentTeam || !vecTeams[nTargetTeam].IsTeamAlive());
+        // Les worms reprennent leur place dans leur quipe
+        for (auto worm : vecWorms)
+        {
+            if (worm->nTeam < 0 || worm->nTeam >= (int)vecTeams.size() ||
+                worm->nTeamMember < 0 || worm->nTeamMember >= (int)vecTeams[worm->nTeam].vecMembers.size())
+            {
+                r.bOk = false;
+                break;
+            }
+            worm->pTeam = &vecTeams[worm->nTeam];
+            worm->pTeam->vecMembers[worm->nTeamMember] = worm;
+        }
+        for (auto& t : vecTeams)
+            for (auto worm : t.vecMembers)
+                r.bOk = r.bOk && worm != nullptr;
 
-                // Il va choisir le Worm adversaire avec la bar de sant la plus forte	
-                cWorm* mostHealthyWorm = vecTeams[nTargetTeam].vecMembers[0];
-                for (auto w : vecTeams[nTargetTeam].vecMembers)
-                    if (w->fHealth > mostHealthyWorm->fHealth)
-                        mostHealthyWorm = w;
+        if (!r.bOk)
+            return RestartAfterBadState();
 
-                pAITargetWorm = mostHealthyWorm;
-                fAITargetX = mostHealthyWorm->px;
-                fAITargetY = mostHealthyWorm->py;
-                nAINextState = AI_POSITION_FOR_TARGET;
-            }
-            break;
+        // En dernier : le constructeur des dbris vient de tirer au hasard
+        cRandom::nState = nRandomState;
+        return true;
+    }
 
-            // Calcule la position adapte pour tirer sur sa cible.
-            // S'il doit bouger de nouveau, il le fait
-            case AI_POSITION_FOR_TARGET:
-            {
-                cWorm* origin = (cWorm*)pObjectUnderControl;
-                float dy = -(fAITargetY - origin->py);
-                float dx = -(fAITargetX - origin->px);
-                float fSpeed = 30.0f;
-                float fGravity = 2.0f;
+    bool RestartAfterBadState()
+    {
+        listObjects.clear();
+        particles.Clear();
+        vecTeams.clear();
+        pObjectUnderControl = nullptr;
+        pCameraTrackingObject = nullptr;
+        pAITargetWorm = nullptr;
+        RestartMatch(replay.nSeed);
+        return false;
+    }
 
-                bAI_Jump = false;
+    // Sauvegarde et chargement d'une partie en cours. Une partie charge
+    // ne peut plus tre enregistre dans le replay, qui part du dbut
+    bool SaveSnapshot(const wstring& sFile)
+    {
+        vector<uint8_t> vecState;
+        SaveState(vecState);
+        return WriteBytesToFile(sFile, vecState);
+    }
 
-                float a = fSpeed * fSpeed * fSpeed * fSpeed - fGravity * (fGravity * dx * dx + 2.0f * dy * fSpeed * fSpeed);
+    bool LoadSnapshot(const wstring& sFile)
+    {
+        vector<uint8_t> vecState;
+        if (!ReadBytesFromFile(sFile, vecState))
+            return false;
 
-                if (a < 0)   // La cible est trop loin
-                {
-                    // Il y a encore le temps. Le Worm va bouger.
-                    if (fTurnTime >= 5.0f)
-                    {
-                        if (pAITargetWorm->px < origin->px && bGameIsStable)
-                        {
-                            origin->fShootAngle = -3.14159f * 0.6f;
-                            bAI_Jump = true;
-                            nAINextState = AI_POSITION_FOR_TARGET;
-                        }
+        if (!LoadState(vecState))
+        {
+            StartRecording(replay.nSeed);
+            return false;
+        }
+        nReplayMode = REPLAY_OFF;
+        return true;
+    }
 
-                        if (pAITargetWorm->px > origin->px && bGameIsStable)
-                        {
-                            origin->fShootAngle = -3.14159f * 0.4f;
-                            bAI_Jump = true;
-                            nAINextState = AI_POSITION_FOR_TARGET;
-                        }
-                    }
-                    else  // Il n'y a plus assez de temps. Le Worm va tirer malgr tout.
-                    {
-                        fAITargetAngle = origin->fShootAngle;
-                        fAITargetEnergy = 0.75f;
-                        nAINextState = AI_AIM;
-                    }
-                }
-                else
-                {
-                    // Le Worm est assez prs de sa cible. Calcul de la trajectoire
-                    float b1 = fSpeed * fSpeed + sqrtf(a);
-                    float b2 = fSpeed * fSpeed - sqrtf(a);
+    // Rapproche la camra de l'objet suivi, de 5 fois l'cart par seconde : un objet
+    // rapide la laisse derrire lui de sa vitesse / 5, soit 2 v en vitesse de la physique
+    // (qui va dix fois plus vite que le jeu). Elle vise donc d'autant devant un projectile,
+    // sans le perdre de vue, et met ds maintenant en mmoire les tuiles vers o elle va
+    void TrackCamera(const cPhysicsObject* p, float fElapsedTime)
+    {
+        float fLeadX = 0.0f;
+        float fLeadY = 0.0f;
+        if (bCameraLead && p->pWeapon != nullptr)
+        {
+            float fMaxX = ScreenWidth() / 4.0f;
+            float fMaxY = ScreenHeight() / 4.0f;
+            fLeadX = max(-fMaxX, min(2.0f * p->vx, fMaxX));
+            fLeadY = max(-fMaxY, min(2.0f * p->vy, fMaxY));
+        }
+        fCameraPosXTarget = p->px + fLeadX - ScreenWidth() / 2;
+        fCameraPosYTarget = p->py + fLeadY - ScreenHeight() / 2;
+        fCameraPosX += (fCameraPosXTarget - fCameraPosX) * 5.0f * fElapsedTime;
+        fCameraPosY += (fCameraPosYTarget - fCameraPosY) * 5.0f * fElapsedTime;
+
+        if (fLeadX != 0.0f || fLeadY != 0.0f)
+            terrain.Prepare(fCameraPosXTarget, fCameraPosYTarget,
+                fCameraPosXTarget + ScreenWidth() - 1, fCameraPosYTarget + ScreenHeight() - 1);
+    }
 
-                    // Deux hauteurs permettent de toucher un point, en ballistique
-                    float fTheta1 = atanf(b1 / (fGravity * dx));  //Hauteur la plus grande
-                    float fTheta2 = atanf(b2 / (fGravity * dx));  //Hauteur la plus petite
+    // Ce que montre l'cran : la vue de la camra, ou toute la map dzoome
+    sView View()
+    {
+        if (bZoomOut)
+            return { 0.0f, 0.0f, (float)nMapWidth, (float)nMapHeight };
+        return { fCameraPosX, fCameraPosY, fCameraPosX + ScreenWidth(), fCameraPosY + ScreenHeight() };
+    }
 
-                    // La hauteur max a plus de chance de faire passer
-                    // le missile au-dessus des obstacles.
-                    // Le Worm choisit celle-ci et calcule l'angle.
-                    fAITargetAngle = fTheta1 - (dx > 0 ? 3.14159f : 0.0f);
-                    float fFireX = cosf(fAITargetAngle);
-                    float fFireY = sinf(fAITargetAngle);
+    // Un objet peut-il toucher l'cran ? Sa forme tient dans son rayon ; ses barres
+    // de vie et d'nergie et la vise dbordent d'au plus 13 cases
+    static bool Visible(const sView& view, const cPhysicsObject* p)
+    {
+        return view.Sees(p->px, p->py, p->radius + 16.0f);
+    }
 
-                    fAITargetEnergy = 0.75f;
-                    nAINextState = AI_AIM;
-                }
-            }
-            break;
+    bool ParticlesVisible(const sView& view) const
+    {
+        return particles.Size() > 0 && particles.Overlaps(view.x1, view.y1, view.x2, view.y2);
+    }
 
-            case AI_AIM:  // Le Worm vise
-            {
-                cWorm* worm = (cWorm*)pObjectUnderControl;
+    // Une signature de 64 bits (FNV-1a) de ce que montre un calque
+    struct sStamp
+    {
+        uint64_t n = 14695981039346656037ull;
 
-                bAI_AimLeft = false;
-                bAI_AimRight = false;
-                bAI_Jump = false;
+        void Add(uint64_t v)
+        {
+            n = (n ^ v) * 1099511628211ull;
+        }
 
-                if (worm->fShootAngle < fAITargetAngle)
-                    bAI_AimRight = true;
-                else
-                    bAI_AimLeft = true;
+        void Add(float f)
+        {
+            uint32_t u;
+            memcpy(&u, &f, sizeof(u));
+            Add((uint64_t)u);
+        }
+    };
 
-                // Il a trouv le bon angle
-                if (fabs(worm->fShootAngle - fAITargetAngle) <= 0.001f)
-                {
-                    bAI_AimLeft = false;
-                    bAI_AimRight = false;
-                    fEnergyLevel = 0.0f;
-                    nAINextState = AI_FIRE;
-                }
-                else
-                    nAINextState = AI_AIM;
+    // Ce dont dpend le dessin du calque : s'il n'a pas chang, le calque non plus
+    uint64_t LayerStamp(int nLayer)
+    {
+        sStamp h;
+        h.Add((uint64_t)ScreenWidth() << 32 | (uint32_t)ScreenHeight());
+        h.Add((uint64_t)bZoomOut);
+        if (nLayer != LAYER_HUD)
+        {
+            h.Add(fCameraPosX);
+            h.Add(fCameraPosY);
+        }
 
-            }
+        sView view = View();
+        switch (nLayer)
+        {
+        case LAYER_TERRAIN:
+            h.Add((uint64_t)terrain.Generation());
             break;
 
-            // L'IA tire
-            case AI_FIRE:
+        case LAYER_OBJECTS:
+            // La position exacte (le dessin arrondit px - camra, pas px), la vitesse
+            // qui oriente les projectiles ; pour un worm, aussi sa vie et son tat.
+            // Ceux hors de l'cran n'y changent rien
+            for (auto& p : listObjects)
             {
-                bAI_Energise = true;
-                bFireWeapon = false;
-                bEnergising = true;
-
-                if (fEnergyLevel >= fAITargetEnergy)
+                if (!Visible(view, p.get()))
+                    continue;
+                h.Add(p->px);
+                h.Add(p->py);
+                h.Add(p->vx);
+                h.Add(p->vy);
+                if (p->nLayer == cPhysicsObject::LAYER_WORM)
                 {
-                    bFireWeapon = true;
-                    bAI_Energise = false;
-                    bEnergising = false;
-                    bEnableComputerControl = false;
-                    nAINextState = AI_ASSESS_ENVIRONMENT;
+                    const cWorm* w = (const cWorm*)p.get();
+                    h.Add(w->fHealth);
+                    h.Add((uint64_t)w->bIsPlayable);
                 }
             }
+            h.Add((uint64_t)(uintptr_t)pObjectUnderControl);
+            if (pObjectUnderControl != nullptr)
+                h.Add(((const cWorm*)pObjectUnderControl)->fShootAngle);
+            h.Add(fEnergyLevel);
+            break;
+
+        case LAYER_PARTICLES:
+            // Elles bougent tant qu'il y en a
+            h.Add(ParticlesVisible(view) ? nSceneFrame : 0);
+            break;
+
+        case LAYER_HUD:
+            h.Add((uint64_t)vecTeams.size());
+            for (auto& t : vecTeams)
+                h.Add(t.fTotalHealth);
+            h.Add((uint64_t)nWeapon << 32 | weapons.Size());
+            h.Add((uint64_t)bForces);
+            h.Add(forces.fWind);
+            h.Add((uint64_t)bShowCountDown);
+            if (bShowCountDown)
+                h.Add((uint64_t)CountDown());
             break;
-            }
         }
+        return h.n;
+    }
 
-        fTurnTime -= fElapsedTime;
+    // Dessine la scne : le terrain depuis son calque, puis les objets, les particules et
+    // l'interface par-dessus, si l'un d'eux a chang
+    void DrawScene()
+    {
+        nSceneFrame++;
+        if (!bLayers)
+        {
+            for (int l = 0; l < LAYER_COUNT; l++)
+                DrawLayerContents(l);
+            return;
+        }
 
-        if (pObjectUnderControl != nullptr)
+        bool bChanged = false;
+        bool bTerrain = false;
+        for (int l = 0; l < LAYER_COUNT; l++)
         {
-            pObjectUnderControl->ax = 0.0f;
+            uint64_t nStamp = LayerStamp(l);
+            if (nStamp == nLayerStamp[l])
+                continue;
+            nLayerStamp[l] = nStamp;
+            bChanged = true;
+            if (l == LAYER_TERRAIN)
+                bTerrain = true;
+        }
+        if (!bChanged)
+            return;
 
-            if (pObjectUnderControl->bStable)
+        if (bTerrain)
+        {
+            // La camra bouge : le terrain se dessine  mme l'cran, et ne sera gard
+            // que quand il restera en place
+            DrawTerrain();
+        }
+        else
+        {
+            size_t nCells = (size_t)ScreenWidth() * ScreenHeight();
+            if (vecTerrainLayer.size() != nCells || nTerrainLayerStamp != nLayerStamp[LAYER_TERRAIN])
             {
-                // Contrle les dplacemnets joueur ET l'IA par la mme occasion
+                CHAR_INFO blank;
+                blank.Char.UnicodeChar = L' ';
+                blank.Attributes = 0;
+                vecTerrainLayer.assign(nCells, blank);
+                SetDrawTarget(vecTerrainLayer.data());
+                DrawTerrain();
+                SetDrawTarget(nullptr);
+                nTerrainLayerStamp = nLayerStamp[LAYER_TERRAIN];
+            }
+            DrawLayer(vecTerrainLayer.data());
+        }
+        for (int l = LAYER_TERRAIN + 1; l < LAYER_COUNT; l++)
+            DrawLayerContents(l);
+    }
 
-                // Saute
-                if ((bEnablePlayerControl && m_keys[L'Z'].bPressed) || (bEnableComputerControl && bAI_Jump))
+    void DrawLayerContents(int nLayer)
+    {
+        switch (nLayer)
+        {
+        case LAYER_TERRAIN: DrawTerrain(); break;
+        case LAYER_OBJECTS: DrawObjects(); break;
+        case LAYER_PARTICLES: DrawParticles(); break;
+        case LAYER_HUD: DrawHUD(); break;
+        }
+    }
+
+    void DrawObjects()
+    {
+        // Ici, vue proche.
+        if (!bZoomOut)
+        {
+            //Dessine les objets  l'cran
+            sView view = View();
+            for (auto& p : listObjects)
+            {
+                if (!Visible(view, p.get()))
+                    continue;
+                p->Draw(this, fCameraPosX, fCameraPosY);
+
+                // Dessine une cible selon l'angle
+                cWorm* worm = (cWorm*)pObjectUnderControl;
+                if (p.get() == worm)
                 {
-                    float a = ((cWorm*)pObjectUnderControl)->fShootAngle;
+                    float cx = worm->px + 12.0f * cosf(worm->fShootAngle) - fCameraPosX;
+                    float cy = worm->py + 12.0f * sinf(worm->fShootAngle) - fCameraPosY;
 
-                    pObjectUnderControl->vx = 4.0f * cosf(a);
-                    pObjectUnderControl->vy = 8.0f * sinf(a);
-                    pObjectUnderControl->bStable = false;
+                    DrawSpan(cx - 1, cx + 2, cy, PIXEL_SOLID, FG_BLACK);
+                    Draw(cx, cy + 1, PIXEL_SOLID, FG_BLACK);
+                    Draw(cx, cy - 1, PIXEL_SOLID, FG_BLACK);
 
-                    bAI_Jump = false;
+                    int nEnergy = (int)ceilf(11 * fEnergyLevel);
+                    int ex = worm->px - 5 - fCameraPosX;
+                    DrawSpan(ex, ex + nEnergy, worm->py - 12 - fCameraPosY, PIXEL_SOLID, FG_GREEN);
+                    DrawSpan(ex, ex + nEnergy, worm->py - 11 - fCameraPosY, PIXEL_SOLID, FG_RED);
                 }
+            }
+        }
+        else // Le cas o l'on a dzoom sur la vue globale
+        {
+            for (auto& p : listObjects)
+                p->Draw(this, p->px - (p->px / (float)nMapWidth) * (float)ScreenWidth(),
+                    p->py - (p->py / (float)nMapHeight) * (float)ScreenHeight(), true);
+        }
+        cDebris::DrawBatch(this);
+    }
 
-                // Vise vers la gauche
-                if ((bEnablePlayerControl && m_keys[L'Q'].bHeld) || (bEnableComputerControl && bAI_AimLeft))
-                {
-                    cWorm* worm = (cWorm*)pObjectUnderControl;
-                    worm->fShootAngle -= 1.0f * fElapsedTime;
-                    if (worm->fShootAngle < -3.14159f) worm->fShootAngle += 3.14159f * 2.0f;
-                }
+    void DrawParticles()
+    {
+        if (!bZoomOut)
+        {
+            if (ParticlesVisible(View()))
+                particles.Draw(this, fCameraPosX, fCameraPosY);
+        }
+        else
+            particles.Draw(this, 0.0f, 0.0f, (float)ScreenWidth() / (float)nMapWidth, (float)ScreenHeight() / (float)nMapHeight);
+    }
 
-                // Vise vers la droite
-                if ((bEnablePlayerControl && m_keys[L'D'].bHeld) || (bEnableComputerControl && bAI_AimRight))
-                {
-                    cWorm* worm = (cWorm*)pObjectUnderControl;
-                    worm->fShootAngle += 1.0f * fElapsedTime;
-                    if (worm->fShootAngle > 3.14159f) worm->fShootAngle -= 3.14159f * 2.0f;
-                }
+    // Les secondes qu'affiche le compteur, arrondies vers le bas : 0 une fois le temps coul
+    int CountDown() const
+    {
+        return fTurnTime <= 0.0f ? 0 : min((int)fTurnTime, 99);
+    }
 
-                // Espace : emmagasine puissance du tir
-                if (bEnablePlayerControl && m_keys[VK_SPACE].bPressed)
-                {
-                    bEnergising = true;
-                    fEnergyLevel = 0.0f;
-                    bFireWeapon = false;
-                }
+    void DrawHUD()
+    {
+        // Dessine les bars de sant de chaque quipe. Elles s'affinent quand
+        // il y a beaucoup d'quipes, jusqu' une ligne sans espace, pour tenir dans
+        // le quart haut de l'cran ; au-del, les dernires quipes n'ont pas de barre
+        int nQuarter = max(ScreenHeight() / 4, 1);
+        int nBarPitch = vecTeams.empty() ? 4 : nQuarter / (int)vecTeams.size();
+        if (nBarPitch > 4) nBarPitch = 4;
+        if (nBarPitch < 1) nBarPitch = 1;
+        int nBarHeight = max(nBarPitch - 1, 1);
+        int nBars = min((int)vecTeams.size(), nQuarter / nBarPitch);
+        int nHudY = nBars * nBarPitch + 8;     // Sous les barres : l'arme, le vent, le compteur
+
+        for (int t = 0; t < nBars; t++)
+        {
+            float fMaxHealth = (float)vecTeams[t].nTeamSize;
 
-                if ((bEnablePlayerControl && m_keys[VK_SPACE].bHeld) || (bEnableComputerControl && bAI_Energise))
-                {
-                    if (bEnergising)
-                    {
-                        fEnergyLevel += 0.75f * fElapsedTime;
-                        if (fEnergyLevel >= 1.0f)
-                        {
-                            fEnergyLevel = 1.0f;
-                            bFireWeapon = true;
-                        }
-                    }
-                }
-                // Tire !
-                if (bEnablePlayerControl && m_keys[VK_SPACE].bReleased)
-                {
-                    if (bEnergising)
-                    {
-                        bFireWeapon = true;
-                    }
+            int cols[] =
+            { 
+                FG_RED,
+                FG_BLUE,
+                FG_MAGENTA,
+                FG_GREEN,
+                FG_DARK_RED,
+                FG_DARK_BLUE,
+                FG_DARK_MAGENTA,
+                FG_DARK_GREEN,
+                FG_YELLOW,
+                FG_CYAN,
+                FG_DARK_YELLOW,
+                FG_DARK_CYAN,
+                FG_GREY,
+                FG_DARK_GREY,
+                FG_WHITE,
+                FG_BLACK
+            };
+
+            Fill(4, 4 + t * nBarPitch,
+                (vecTeams[t].fTotalHealth / fMaxHealth)* (float)(ScreenWidth() - 8) + 4,
+                4 + t * nBarPitch + nBarHeight, PIXEL_SOLID, cols[t % 16]);
+        }
+
+        // L'arme choisie, en haut  droite, quand il y a le choix
+        if (weapons.Size() > 1)
+        {
+            const char* sName = weapons[nWeapon]->sName;
+            wstring sWeaponName(sName, sName + strlen(sName));
+            DrawStringAlpha(ScreenWidth() - 4 - (int)sWeaponName.size(), nHudY, sWeaponName, FG_BLACK);
+        }
+
+        // Le vent : une barre qui part du milieu, dans son sens et selon sa force
+        if (bForces)
+        {
+            int cx = ScreenWidth() / 2;
+            int cy = nHudY;
+            int nLength = (int)(forces.fWind / fMaxWind * 20.0f);
+            Fill(min(cx, cx + nLength), cy, max(cx, cx + nLength) + 1, cy + 2, PIXEL_SOLID, FG_WHITE);
+            Fill(cx, cy - 1, cx + 1, cy + 3, PIXEL_SOLID, FG_BLACK);
+        }
 
-                    bEnergising = false;
-                }
-            }
+        // Compteur du temps restant
+        if (bShowCountDown)
+            hudDigits.Draw(this, 4, nHudY, CountDown(), FG_BLACK);
+    }
 
-            // La camra
-            if (pCameraTrackingObject != nullptr)
-            {
-                fCameraPosXTarget = pCameraTrackingObject->px - ScreenWidth() / 2;
-                fCameraPosYTarget = pCameraTrackingObject->py - ScreenHeight() / 2;
-                fCameraPosX += (fCameraPosXTarget - fCameraPosX) * 5.0f * fElapsedTime;
-                fCameraPosY += (fCameraPosYTarget - fCameraPosY) * 5.0f * fElapsedTime;
-            }
+    // O retombe un tir de l'arme choisie, en plein ciel : l'intgration de PhysicsStep,
+    // dans le mme air (sForces::Acceleration). Renvoie l'abscisse o il redescend 
+    // la hauteur fTargetY, ou NAN s'il n'y arrive pas
+    float PredictShot(float x, float y, float fAngle, float fEnergy, float fTargetY) const
+    {
+        const float fStep = fMaxPhysicsStep;
+        float fDrag = weapons[nWeapon]->fDrag;
+        float vx = cosf(fAngle) * 40.0f * fEnergy;
+        float vy = sinf(fAngle) * 40.0f * fEnergy;
+        sForces air = forces;
+        for (int i = 0; i < (int)(80.0f / fStep); i++)
+        {
+            float ax = 0.0f;
+            float ay = 0.0f;
+            air.Acceleration(x, y, vx, vy, fDrag, ax, ay);
+            air.Update(fStep);
+            ay += 2.0f;
+            vx += ax * fStep;
+            vy += ay * fStep;
+            float fNextX = x + vx * fStep;
+            float fNextY = y + vy * fStep;
+            if (vy > 0.0f && y < fTargetY && fNextY >= fTargetY)
+                return x + (fNextX - x) * (fTargetY - y) / (fNextY - y);
+            x = fNextX;
+            y = fNextY;
+        }
+        return NAN;
+    }
 
-            if (bFireWeapon)
+    // Corrige l'angle d'un tir (par la mthode de la scante) pour qu'il retombe
+    // sur la cible malgr l'air. Garde le meilleur angle essay
+    float CorrectAim(float x, float y, float fAngle, float fEnergy, float fTargetX, float fTargetY) const
+    {
+        auto Error = [&](float a) { return PredictShot(x, y, a, fEnergy, fTargetY) - fTargetX; };
+        float a0 = fAngle, e0 = Error(a0);
+        float a1 = fAngle + 0.05f, e1 = Error(a1);
+        float fBestAngle = fAngle;
+        float fBestError = isfinite(e0) ? fabsf(e0) : INFINITY;
+        for (int i = 0; i < 8 && isfinite(e0) && isfinite(e1) && e0 != e1 && fBestError >= 1.0f; i++)
+        {
+            if (fabsf(e1) < fBestError)
             {
-                cWorm* worm = (cWorm*)pObjectUnderControl;
-
-                //Origine du tir
-                float ox = worm->px;
-                float oy = worm->py;
+                fBestAngle = a1;
+                fBestError = fabsf(e1);
+            }
+            float a2 = min(max(a1 - e1 * (a1 - a0) / (e1 - e0), fAngle - 0.5f), fAngle + 0.5f);
+            a0 = a1; e0 = e1;
+            a1 = a2; e1 = Error(a1);
+        }
+        if (isfinite(e1) && fabsf(e1) < fBestError)
+            fBestAngle = a1;
+        return fBestAngle;
+    }
 
-                //Direction du tir
-                float dx = cosf(worm->fShootAngle);
-                float dy = sinf(worm->fShootAngle);
+    // Un nouveau vent pour le tour qui commence
+    void ChangeWind()
+    {
+        forces.fWind = bForces ? (cRandom::Unit() * 2.0f - 1.0f) * fMaxWind : 0.0f;
+    }
 
-                //Cre un missile
-                cMissile* m = new cMissile(ox, oy, dx * 40.0f * fEnergyLevel, dy * 40.0f * fEnergyLevel);
-                listObjects.push_back(unique_ptr<cMissile>(m));
+    // Le nombre de pas de physique d'une frame
+    int PhysicsStepsPerFrame(float fElapsedTime) const
+    {
+        return nPhysics != PHYSICS_FIXED ? max(1, (int)ceilf(10.0f * fElapsedTime / fMaxPhysicsStep)) : 10;
+    }
 
-                //Attache la camra au missile
-                pCameraTrackingObject = m;
+    // Une itration de la physique : intgration, collisions avec la map et rebonds
+    void PhysicsStep(float fElapsedTime)
+    {
+        PhysicsStep(terrain, listObjects, fElapsedTime, this, nPhysics, bObjectCollisions, forces);
+    }
 
-                bFireWeapon = false;
-                fEnergyLevel = 0.0f;
-                bEnergising = false;
+    // Un objet, copi  plat pour les chocs entre objets
+    struct sBody
+    {
+        float x0;                   // Bord gauche, qui donne sa colonne
+        float px, py, vx, vy;
+        float radius;
+        float fInvMass;             // 0 : ne bouge pas (cal contre le terrain)
+        float fFriction;
+        uint8_t nLayer;
+        uint8_t nCollideWith;
+        bool bTouched;
+        cPhysicsObject* p;
+    };
+
+    // Les chocs entre objets, aprs leur dplacement. Les objets qui ont une couche
+    // sont copis  plat, et ceux qui en heurtent d'autres (les worms, peu nombreux)
+    // sont rangs par colonnes de la largeur d'un worm : chaque objet ne cherche que
+    // dans les deux ou trois colonnes qui recouvrent son intervalle en x. Les dbris,
+    // qui ne se cherchent pas entre eux, ne cotent ainsi que quelques lectures chacun,
+    // mme par milliers. Les contacts sont trouvs et rsolus dans l'ordre de la liste
+    // (et des colonnes) : le rsultat ne dpend que d'elle, les replays restent exacts
+    template<typename TERRAIN>
+    static void CollideObjects(TERRAIN& terrain, list<unique_ptr<cPhysicsObject>>& listObjects)
+    {
+        // Propres  chaque thread : les tirs d'essai de l'IA passent aussi par l
+        thread_local vector<sBody> vecBodiesTLS;
+        thread_local vector<int> vecSeekersTLS;
+        thread_local vector<int> vecSortedTLS;
+        thread_local vector<int> vecColumnsTLS;
+        thread_local vector<int> vecNextTLS;
+        thread_local vector<pair<int, int>> vecContactsTLS;
+        vector<sBody>& vecBodies = vecBodiesTLS;
+        vector<int>& vecSeekers = vecSeekersTLS;
+        vector<int>& vecSorted = vecSortedTLS;
+        vector<int>& vecColumns = vecColumnsTLS;
+        vector<int>& vecNext = vecNextTLS;
+        vector<pair<int, int>>& vecContacts = vecContactsTLS;
+        vecBodies.clear();
+        vecSeekers.clear();
+        vecContacts.clear();
+
+        float fMaxRadius = 0.0f;
+        float fMinX = 0.0f;
+        float fMaxX = 0.0f;
+        for (auto& p : listObjects)
+        {
+            // Une position absurde (tat charg corrompu) fausserait les colonnes
+            if (p->nLayer == 0 || p->bDead || !(fabsf(p->px) < 1e7f && fabsf(p->py) < 1e7f))
+                continue;
+            float x0 = p->px - p->radius;
+            if (p->nCollideWith != 0)
+            {
+                fMinX = vecSeekers.empty() ? x0 : min(fMinX, x0);
+                fMaxX = vecSeekers.empty() ? x0 : max(fMaxX, x0);
+                fMaxRadius = max(fMaxRadius, p->radius);
+                vecSeekers.push_back((int)vecBodies.size());
+            }
+            vecBodies.push_back({ x0, p->px, p->py, p->vx, p->vy, p->radius,
+                p->fMass > 0.0f ? 1.0f / p->fMass : 0.0f, p->fFriction, p->nLayer, p->nCollideWith, false, p.get() });
+        }
+        if (vecSeekers.empty() || vecBodies.size() < 2)
+            return;
+
+        // Les colonnes, par leur bord gauche : au moins la largeur d'un worm, et pas plus
+        // de colonnes que quelques fois le nombre de worms (tri par comptage, dans l'ordre
+        // de la liste). vecColumns donne le dbut de chaque colonne dans vecSorted
+        int nColumns = min((int)vecSeekers.size() * 4 + 16, 65536);
+        float fColumn = max(max(2.0f * fMaxRadius, 1.0f), (fMaxX - fMinX) / (nColumns - 1));
+        nColumns = min(nColumns, (int)((fMaxX - fMinX) / fColumn) + 1);
+        auto Column = [&](float x) { return min(max((int)((x - fMinX) / fColumn), 0), nColumns - 1); };
+
+        vecColumns.assign(nColumns + 1, 0);
+        for (int i : vecSeekers)
+            vecColumns[Column(vecBodies[i].x0) + 1]++;
+        for (int c = 0; c < nColumns; c++)
+            vecColumns[c + 1] += vecColumns[c];
+        vecNext.assign(vecColumns.begin(), vecColumns.end() - 1);
+        vecSorted.resize(vecSeekers.size());
+        for (int i : vecSeekers)
+            vecSorted[vecNext[Column(vecBodies[i].x0)]++] = i;
+
+        for (int j = 0; j < (int)vecBodies.size(); j++)
+        {
+            const sBody& b = vecBodies[j];
+
+            // Les worms dont le bord gauche est dans ]b.x0 - 2 fMaxRadius, b.x0 + 2 b.radius[
+            float fFrom = b.x0 - 2.0f * fMaxRadius;
+            float fTo = b.x0 + 2.0f * b.radius;
+            if (fTo < fMinX || fFrom > fMaxX)
+                continue;
+            for (int k = vecColumns[Column(fFrom)]; k < vecColumns[Column(fTo) + 1]; k++)
+            {
+                int i = vecSorted[k];
+                const sBody& a = vecBodies[i];
+                if (i == j || (b.nLayer & a.nCollideWith) == 0)
+                    continue;
+
+                // Deux objets qui se cherchent l'un l'autre : un seul contact
+                if ((a.nLayer & b.nCollideWith) != 0 && i > j)
+                    continue;
+
+                float dx = b.px - a.px;
+                float dy = b.py - a.py;
+                float r = a.radius + b.radius;
+                if (dx * dx + dy * dy < r * r)
+                    vecContacts.push_back({ i, j });
+            }
+        }
 
-                bPlayerHasFired = true;
+        // Un seul passage : un contact dj rsolu par un prcdent est saut
+        for (auto& c : vecContacts)
+        {
+            sBody& a = vecBodies[c.first];
+            sBody& b = vecBodies[c.second];
+            float dx = b.px - a.px;
+            float dy = b.py - a.py;
+            float r = a.radius + b.radius;
+            float d = sqrtf(dx * dx + dy * dy);
+            if (d >= r)
+                continue;
+
+            // La normale de a vers b. Confondus, b passe dessus
+            float nx = 0.0f;
+            float ny = -1.0f;
+            if (d > 1e-4f)
+            {
+                nx = dx / d;
+                ny = dy / d;
+            }
 
-                if (rand() % 100 >= 50)
-                    bZoomOut = true;
+            // Celui qui serait pouss dans le terrain ne bouge pas : l'autre prend tout
+            float fOverlap = r - d;
+            float wa = a.fInvMass;
+            float wb = b.fInvMass;
+            if (wa + wb <= 0.0f)
+                continue;
+            if (wa > 0.0f && IntoTerrain(terrain, a, -nx * fOverlap * wa / (wa + wb), -ny * fOverlap * wa / (wa + wb)))
+                wa = 0.0f;
+            if (wb > 0.0f && IntoTerrain(terrain, b, nx * fOverlap * wb / (wa + wb), ny * fOverlap * wb / (wa + wb)))
+                wb = 0.0f;
+            if (wa + wb <= 0.0f)
+                continue;
+
+            // Spare les deux objets, puis l'impulsion, s'ils se rapprochent
+            a.px -= nx * fOverlap * wa / (wa + wb);
+            a.py -= ny * fOverlap * wa / (wa + wb);
+            b.px += nx * fOverlap * wb / (wa + wb);
+            b.py += ny * fOverlap * wb / (wa + wb);
+
+            float fApproach = (b.vx - a.vx) * nx + (b.vy - a.vy) * ny;
+            if (fApproach < 0.0f)
+            {
+                float j = -(1.0f + min(a.fFriction, b.fFriction)) * fApproach / (wa + wb);
+                a.vx -= j * wa * nx;
+                a.vy -= j * wa * ny;
+                b.vx += j * wb * nx;
+                b.vy += j * wb * ny;
             }
+            a.bTouched = true;
+            b.bTouched = true;
         }
 
+        // Comme contre le terrain, un objet qui en touche un autre est stable : un dbris
+        // pos sur un worm ne tiendrait pas la partie en haleine
+        for (auto& b : vecBodies)
+            if (b.bTouched)
+            {
+                b.p->bStable = true;
+                b.p->px = b.px;
+                b.p->py = b.py;
+                b.p->vx = b.vx;
+                b.p->vy = b.vy;
+            }
+    }
 
-        // Bloque la camra dans les limites de la map
-        if (fCameraPosX < 0) fCameraPosX = 0;
-        if (fCameraPosX >= nMapWidth - ScreenWidth()) fCameraPosX = nMapWidth - ScreenWidth();
-        if (fCameraPosY < 0) fCameraPosY = 0;
-        if (fCameraPosY >= nMapHeight - ScreenHeight()) fCameraPosY = nMapHeight - ScreenHeight();
+    // Dplac de (dx, dy), l'objet entrerait-il plus avant dans le terrain ?
+    template<typename TERRAIN>
+    static bool IntoTerrain(TERRAIN& terrain, const sBody& b, float dx, float dy)
+    {
+        float fAfter = terrain.Distance(b.px + dx, b.py + dy);
+        return fAfter < b.radius && fAfter < terrain.Distance(b.px, b.py);
+    }
+
+    // La sonde de collision : un demi-cercle du rayon de l'objet, tourn dans la
+    // direction du mouvement (fAngle), autour de (fPosX, fPosY). Renvoie true si
+    // elle touche le terrain, et accumule dans fResponse de quoi faire rebondir l'objet
+    template<typename TERRAIN>
+    static bool Probe(TERRAIN& terrain, float fPosX, float fPosY, float fRadius, float fAngle, float& fResponseX, float& fResponseY)
+    {
+        int nMapWidth = terrain.nWidth;
+        int nMapHeight = terrain.nHeight;
+        bool bCollision = false;
 
+        // Au milieu d'une tuile de ciel uni, aucune sonde ne peut toucher
+        terrain.Prepare(fPosX - fRadius, fPosY - fRadius, fPosX + fRadius, fPosY + fRadius);
+        if (terrain.IsOpenSky(fPosX - fRadius, fPosY - fRadius, fPosX + fRadius, fPosY + fRadius))
+            return false;
 
-        //On rpte 10 itrations par frames (ncessaire pour le gameplay)
-        for (int z = 0; z < 10; z++)
+        for (float r = fAngle - 3.14159f / 2.0f; r < fAngle + 3.14159f / 2.0f; r += 3.14159f / 8.0f)
         {
-            //Update les objets
-            for (auto& p : listObjects)
+            float fTestPosX = fRadius * cosf(r) + fPosX;
+            float fTestPosY = fRadius * sinf(r) + fPosY;
+
+            // On ne sort pas de la map
+            if (fTestPosX >= nMapWidth) fTestPosX = nMapWidth - 1;
+            if (fTestPosY >= nMapHeight) fTestPosY = nMapHeight - 1;
+            if (!(fTestPosX >= 0)) fTestPosX = 0; // NaN compris (tat charg corrompu)
+            if (!(fTestPosY >= 0)) fTestPosY = 0;
+
+            // Teste si l'un des points du demi-cercle touche le terrain
+            if (terrain.Get((int)fTestPosX, (int)fTestPosY) > 0)
+                // si ce n'est pas 1 = le ciel, c'est tout le reste !
             {
-                // Applique la gravit
-                p->ay += 2.0f;
-
-                // L'acclration agit sur la vitesse
-                p->vx += p->ax * fElapsedTime;
-                p->vy += p->ay * fElapsedTime;
-
-                // La vitesse agit sur la position des objets
-                float fPotentialX = p->px + p->vx * fElapsedTime;
-                float fPotentialY = p->py + p->vy * fElapsedTime;
+                //Accumule les points de collisions pour trouver
+                //comment l'objet va rebondir
+                fResponseX += fPosX - fTestPosX;
+                fResponseY += fPosY - fTestPosY;
+                bCollision = true;
+            }
+        }
+        return bCollision;
+    }
 
-                // Reset l'acclration
-                p->ax = 0.0f;
-                p->ay = 0.0f;
-                p->bStable = false;
+    // Le mme calcul sur n'importe quelle map et liste d'objets : celles du jeu, ou
+    // celles d'un tir d'essai de l'IA (pGame vaut alors nullptr : ni son, ni camra,
+    // ni dbris, et rien qui ne touche au jeu depuis un autre thread)
+    template<typename TERRAIN>
+    static void PhysicsStep(TERRAIN& terrain, list<unique_ptr<cPhysicsObject>>& listObjects, float fElapsedTime, Worms* pGame, int nPhysics, bool bObjects,
+        sForces& forces)
+    {
+        // L'air d'abord, en une passe sur tous les objets : les acclrations
+        // s'ajoutent  celles que la gravit leur donnera. Un objet pos au sol
+        // (stable au dernier pas) n'a pas de prise : le vent ne fait pas rouler les grenades
+        if (!forces.IsCalm())
+        {
+            for (auto& p : listObjects)
+                if (p->fDrag > 0.0f && !p->bStable)
+                    forces.Acceleration(p->px, p->py, p->vx, p->vy, p->fDrag, p->ax, p->ay);
+            forces.Update(fElapsedTime);
+        }
 
-                // Dtection des collisions avec la map
+        //Update les objets
+        for (auto& p : listObjects)
+        {
+            // Applique la gravit
+            p->ay += 2.0f;
+
+            // L'acclration agit sur la vitesse
+            p->vx += p->ax * fElapsedTime;
+            p->vy += p->ay * fElapsedTime;
+
+            // La vitesse agit sur la position des objets
+            float fPotentialX = p->px + p->vx * fElapsedTime;
+            float fPotentialY = p->py + p->vy * fElapsedTime;
+
+            // Reset l'acclration
+            p->ax = 0.0f;
+            p->ay = 0.0f;
+            p->bStable = false;
+
+            // Dtection des collisions avec la map. Un objet rapide (un missile  pleine
+            // puissance, un grand pas de temps) avance de plusieurs cases par pas : le
+            // dplacement est alors parcouru, et l'objet s'arrte juste avant le premier
+            // contact au lieu de traverser une crte
+            float fMoveX = fPotentialX - p->px;
+            float fMoveY = fPotentialY - p->py;
+            float fMove = sqrtf(fMoveX * fMoveX + fMoveY * fMoveY);
+            float fNormalX = 0.0f;      // La normale du terrain au contact, tourne vers le ciel
+            float fNormalY = 0.0f;
+            bool bCollision = false;
+
+            if (nPhysics == PHYSICS_DISTANCE)
+            {
+                // Par bonds, avec le champ de distance : tant que le terrain est  plus
+                // d'un rayon, l'objet peut avancer d'autant sans rien toucher
+                float fStartX = p->px;
+                float fStartY = p->py;
+                float fDone = 0.0f;
+                float fMargin = p->radius + 1.0f;
+                bool bOpenSky = terrain.IsOpenSky(min(p->px, fPotentialX) - fMargin, min(p->py, fPotentialY) - fMargin,
+                    max(p->px, fPotentialX) + fMargin, max(p->py, fPotentialY) + fMargin);
+                float fDistance = bOpenSky ? 0.0f : terrain.Distance(p->px, p->py);
+                for (int i = 0; i < 1024 && !bOpenSky; i++)
+                {
+                    fDone = min(fMove, fDone + max(fDistance - p->radius, 0.5f));
+                    float fSampleX = fDone < fMove ? fStartX + fMoveX * (fDone / fMove) : fPotentialX;
+                    float fSampleY = fDone < fMove ? fStartY + fMoveY * (fDone / fMove) : fPotentialY;
+                    fDistance = terrain.Distance(fSampleX, fSampleY);
+
+                    // Au contact, et en s'enfonant (un objet qui s'loigne du sol repart).
+                    // Loin de tout bord (enfoui), le champ est plat : l'objet est repouss vers le haut
+                    if (fDistance < p->radius)
+                    {
+                        float gx, gy;
+                        terrain.Gradient(fSampleX, fSampleY, gx, gy);
+                        float fMagGradient = sqrtf(gx * gx + gy * gy);
+                        if (fMagGradient < 1e-4f)
+                        {
+                            gx = 0.0f;
+                            gy = -1.0f;
+                            fMagGradient = 1.0f;
+                        }
+                        if (gx * p->vx + gy * p->vy < 0.0f || fDistance < 0.0f)
+                        {
+                            fNormalX = gx / fMagGradient;
+                            fNormalY = gy / fMagGradient;
+                            bCollision = true;
+                            break;
+                        }
+                    }
+                    p->px = fSampleX;
+                    p->py = fSampleY;
+                    if (fDone >= fMove)
+                        break;
+                }
+            }
+            else
+            {
+                // Avec la sonde en demi-cercle, tourne dans la direction du mouvement et
+                // promene case par case le long du dplacement
                 float fAngle = atan2f(p->vy, p->vx);
                 float fResponseX = 0;
                 float fResponseY = 0;
-                bool bCollision = false;
-
-                // Cherche  travers un demi-cercle du rayon de l'objet tourn dans la direction du mouvement
-                for (float r = fAngle - 3.14159f / 2.0f; r < fAngle + 3.14159f / 2.0f; r += 3.14159f / 8.0f)
+                int nSamples = nPhysics == PHYSICS_SWEPT && fMove > 1.0f ? (int)min(ceilf(fMove), 4096.0f) : 1;
+                float fFreeX = p->px;
+                float fFreeY = p->py;
+                for (int i = 1; i <= nSamples; i++)
                 {
-                    float fTestPosX = (p->radius) * cosf(r) + fPotentialX;
-                    float fTestPosY = (p->radius) * sinf(r) + fPotentialY;
-
-                    // On ne sort pas de la map
-                    if (fTestPosX >= nMapWidth) fTestPosX = nMapWidth - 1;
-                    if (fTestPosY >= nMapHeight) fTestPosY = nMapHeight - 1;
-                    if (fTestPosX < 0) fTestPosX = 0;
-                    if (fTestPosY < 0) fTestPosY = 0;
-
-                    // Teste si l'un des points du demi-cercle touche le terrain
-          
-                    if (map[(int)fTestPosY * nMapWidth + (int)fTestPosX] > 0)
-                        // si ce n'est pas 1 = le ciel, c'est tout le reste !
+                    float fSampleX = i < nSamples ? p->px + fMoveX * ((float)i / (float)nSamples) : fPotentialX;
+                    float fSampleY = i < nSamples ? p->py + fMoveY * ((float)i / (float)nSamples) : fPotentialY;
+                    bCollision = Probe(terrain, fSampleX, fSampleY, p->radius, fAngle, fResponseX, fResponseY);
+                    if (bCollision)
                     {
-                        //Accumule les points de collisions pour trouver
-                        //comment l'objet va rebondir
-                        fResponseX += fPotentialX - fTestPosX;
-                        fResponseY += fPotentialY - fTestPosY;
-                        bCollision = true;
+                        p->px = fFreeX;
+                        p->py = fFreeY;
+                        break;
                     }
+                    fFreeX = fSampleX;
+                    fFreeY = fSampleY;
                 }
 
-                float fMagVelocity = sqrtf(p->vx * p->vx + p->vy * p->vy);
+                // Les points touchs peuvent se compenser : l'objet repart alors d'o il vient
                 float fMagResponse = sqrtf(fResponseX * fResponseX + fResponseY * fResponseY);
-
-                // Trouve l'angle de collision
-                if (bCollision)
+                float fMagMove = sqrtf(p->vx * p->vx + p->vy * p->vy);
+                if (fMagResponse > 0.0f)
+                {
+                    fNormalX = fResponseX / fMagResponse;
+                    fNormalY = fResponseY / fMagResponse;
+                }
+                else if (fMagMove > 0.0f)
                 {
-                    p->bStable = true;
+                    fNormalX = -p->vx / fMagMove;
+                    fNormalY = -p->vy / fMagMove;
+                }
+            }
 
-                    // Vecteur de rflexion du vector de vlocit de l'objet
-                    float dot = p->vx * (fResponseX / fMagResponse) + p->vy * (fResponseY / fMagResponse);
+            float fMagVelocity = sqrtf(p->vx * p->vx + p->vy * p->vy);
 
-                    // Fait appel au coefficient de friction
-                    p->vx = p->fFriction * (-2.0f * dot * (fResponseX / fMagResponse) + p->vx);
-                    p->vy = p->fFriction * (-2.0f * dot * (fResponseY / fMagResponse) + p->vy);
+            // Trouve l'angle de collision
+            if (bCollision)
+            {
+                p->bStable = true;
 
-                    // Met  jour le nombre de rebonds de l'objet avant la fin
-                    if (p->nBounceBeforeDeath > 0)
-                    {
-                        p->nBounceBeforeDeath--;
-                        p->bDead = p->nBounceBeforeDeath == 0;
+                // Vecteur de rflexion du vector de vlocit de l'objet
+                float dot = p->vx * fNormalX + p->vy * fNormalY;
 
-                        // Quand il n'y en a plus... l'objet est "mort" (stable)
-                        if (p->bDead)
-                        {
-                            // Ce qui se passe  ce moment
-                            int nResponse = p->BounceDeathAction();
-                            // Si la rponse est suprieure  0...
-                            if (nResponse > 0)
-                            {
-                                // Boom !
-                                Boom(p->px, p->py, nResponse);
-                                pCameraTrackingObject = nullptr;
-                            }
+                // Fait appel au coefficient de friction
+                p->vx = p->fFriction * (-2.0f * dot * fNormalX + p->vx);
+                p->vy = p->fFriction * (-2.0f * dot * fNormalY + p->vy);
 
-                        }
-                    }
-                }
-                else // Sinon, pas de collision ! Les positions sont mises  jour.
+                // Un worm qui retombe lourdement (les dbris et les grenades, eux, resteraient muets)
+                if (p->nBounceBeforeDeath < 0 && p->pWeapon == nullptr && fMagVelocity > 20.0f && pGame != nullptr)
+                    pGame->PlaySample(pGame->nSoundBounce);
+
+                // Met  jour le nombre de rebonds de l'objet avant la fin
+                if (p->nBounceBeforeDeath > 0)
                 {
-                    p->px = fPotentialX;
-                    p->py = fPotentialY;
+                    p->nBounceBeforeDeath--;
+                    p->bDead = p->nBounceBeforeDeath == 0;
+
+                    // Quand il n'y en a plus... l'objet est "mort" (stable)
+                    if (p->bDead)
+                        Detonate(terrain, listObjects, p.get(), pGame, forces);
                 }
+            }
+            else // Sinon, pas de collision ! Les positions sont mises  jour.
+            {
+                p->px = fPotentialX;
+                p->py = fPotentialY;
+            }
+
+            // Tomb sous la map, par un cratre creus jusqu'au bord : le worm y meurt et
+            // reste l, sa tombe hors de vue. Le reste disparat sans exploser
+            if (p->py > terrain.nHeight + 16.0f)
+            {
+                p->Damage(1.0e9f);
+                p->bDead = p->nLayer != cPhysicsObject::LAYER_WORM;
+                p->py = terrain.nHeight + 16.0f;
+                p->vx = p->vy = 0.0f;
+                fMagVelocity = 0.0f;
+            }
+
+            // Si le mouvement est trs petit, on le met  zro. Sinon a dure ternellement
+            if (fMagVelocity < 0.1f) p->bStable = true;
 
-                // Si le mouvement est trs petit, on le met  zro. Sinon a dure ternellement
-                if (fMagVelocity < 0.1f) p->bStable = true;
+            // Le dtonateur tourne mme  l'arrt : rien n'est stable tant qu'il n'a pas
+            // saut. Le temps de la physique va 10 fois plus vite que celui du jeu
+            if (p->fFuse > 0.0f && !p->bDead)
+            {
+                p->bStable = false;
+                p->fFuse -= 0.1f * fElapsedTime;
+                if (p->fFuse <= 0.0f)
+                {
+                    p->bDead = true;
+                    Detonate(terrain, listObjects, p.get(), pGame, forces);
+                }
             }
+        }
+
+        if (bObjects)
+            CollideObjects(terrain, listObjects);
 
-            // Retire les objets dtruits de la liste
-            listObjects.remove_if([](unique_ptr<cPhysicsObject>& o) {return o->bDead; });
+        // Retire les objets dtruits de la liste. La camra ne peut plus suivre un
+        // projectile disparu sans exploser (tomb de la map, fuse d'une frappe arienne)
+        if (pGame != nullptr && pGame->pCameraTrackingObject != nullptr && pGame->pCameraTrackingObject->bDead)
+            pGame->pCameraTrackingObject = nullptr;
+        listObjects.remove_if([](unique_ptr<cPhysicsObject>& o) {return o->bDead; });
+    }
 
+    // Le caractre et la couleur d'une case de la map. Renvoie false si elle ne se dessine pas
+    static bool TerrainPixel(char c, short& nGlyph, short& nColour)
+    {
+        switch (c)
+        {
+            //Un dgrad du ciel
+        case -1: nGlyph = PIXEL_SOLID; nColour = FG_DARK_BLUE; return true;
+        case -2: nGlyph = PIXEL_QUARTER; nColour = FG_BLUE | BG_DARK_BLUE; return true;
+        case -3: nGlyph = PIXEL_HALF; nColour = FG_BLUE | BG_DARK_BLUE; return true;
+        case -4: nGlyph = PIXEL_THREEQUARTERS; nColour = FG_BLUE | BG_DARK_BLUE; return true;
+        case -5: nGlyph = PIXEL_SOLID; nColour = FG_BLUE; return true;
+        case -6: nGlyph = PIXEL_QUARTER; nColour = FG_CYAN | BG_BLUE; return true;
+        case -7: nGlyph = PIXEL_HALF; nColour = FG_CYAN | BG_BLUE; return true;
+        case -8: nGlyph = PIXEL_THREEQUARTERS; nColour = FG_CYAN | BG_BLUE; return true;
+
+        case 0: nGlyph = PIXEL_SOLID; nColour = FG_CYAN; return true;
+        case 1: nGlyph = PIXEL_SOLID; nColour = FG_DARK_GREEN; return true;
+
+            // Les autres teintes du sol d'une map dessine
+        case 2: nGlyph = PIXEL_SOLID; nColour = FG_GREEN; return true;
+        case 3: nGlyph = PIXEL_SOLID; nColour = FG_DARK_YELLOW; return true;
+        case 4: nGlyph = PIXEL_SOLID; nColour = FG_GREY; return true;
         }
+        return false;
+    }
 
-        //Dessine le terrain. Ici, vue proche.
+    // Dessine le terrain, en vue proche ou dzoome
+    void DrawTerrain()
+    {
+        short nGlyph = 0, nColour = 0;
+
+        //Vue proche
         if (!bZoomOut)
         {
-            for (int x = 0; x < ScreenWidth(); x++)
-                for (int y = 0; y < ScreenHeight(); y++)
+            // Tuile par tuile : une tuile unie se remplit d'un bloc
+            int nCamX = (int)fCameraPosX;
+            int nCamY = (int)fCameraPosY;
+            terrain.Prepare(fCameraPosX, fCameraPosY, fCameraPosX + ScreenWidth() - 1, fCameraPosY + ScreenHeight() - 1);
+            int tx1 = min((nCamX + ScreenWidth() - 1) >> cTerrain::nTileShift, terrain.nTilesX - 1);
+            int ty1 = min((nCamY + ScreenHeight() - 1) >> cTerrain::nTileShift, terrain.nTilesY - 1);
+            for (int ty = nCamY >> cTerrain::nTileShift; ty <= ty1; ty++)
+                for (int tx = nCamX >> cTerrain::nTileShift; tx <= tx1; tx++)
                 {
-                    switch (map[(y + (int)fCameraPosY) * nMapWidth + (x + (int)fCameraPosX)])
+                    // La partie de la tuile  l'cran, en coordonnes de la map
+                    int x0 = max(tx << cTerrain::nTileShift, nCamX);
+                    int y0 = max(ty << cTerrain::nTileShift, nCamY);
+                    int x1 = min((tx + 1) << cTerrain::nTileShift, nCamX + ScreenWidth());
+                    int y1 = min((ty + 1) << cTerrain::nTileShift, nCamY + ScreenHeight());
+
+                    const cTerrain::sTile& t = terrain.Tile(tx, ty);
+                    if (t.bUniform)
                     {
-                        //Un dgrad du ciel
-                    case -1:Draw(x, y, PIXEL_SOLID, FG_DARK_BLUE); break;
-                    case -2:Draw(x, y, PIXEL_QUARTER, FG_BLUE | BG_DARK_BLUE); break;
-                    case -3:Draw(x, y, PIXEL_HALF, FG_BLUE | BG_DARK_BLUE); break;
-                    case -4:Draw(x, y, PIXEL_THREEQUARTERS, FG_BLUE | BG_DARK_BLUE); break;
-                    case -5:Draw(x, y, PIXEL_SOLID, FG_BLUE); break;
-                    case -6:Draw(x, y, PIXEL_QUARTER, FG_CYAN | BG_BLUE); break;
-                    case -7:Draw(x, y, PIXEL_HALF, FG_CYAN | BG_BLUE); break;
-                    case -8:Draw(x, y, PIXEL_THREEQUARTERS, FG_CYAN | BG_BLUE); break;
-
-                    case 0: Draw(x, y, PIXEL_SOLID, FG_CYAN); break;
-                    case 1: Draw(x, y, PIXEL_SOLID, FG_DARK_GREEN); break;
+                        if (TerrainPixel(t.nValue, nGlyph, nColour))
+                            Fill(x0 - nCamX, y0 - nCamY, x1 - nCamX, y1 - nCamY, nGlyph, nColour);
+                        continue;
                     }
-                }
-
-            //Dessine TOUS les objets
-            for (auto& p : listObjects)
-            {
-                p->Draw(this, fCameraPosX, fCameraPosY);
-
-                // Dessine une cible selon l'angle
-                cWorm* worm = (cWorm*)pObjectUnderControl;
-                if (p.get() == worm)
-                {
-                    float cx = worm->px + 12.0f * cosf(worm->fShootAngle) - fCameraPosX;
-                    float cy = worm->py + 12.0f * sinf(worm->fShootAngle) - fCameraPosY;
-
-                    Draw(cx, cy, PIXEL_SOLID, FG_BLACK);
-                    Draw(cx + 1, cy, PIXEL_SOLID, FG_BLACK);
-                    Draw(cx - 1, cy, PIXEL_SOLID, FG_BLACK);
-                    Draw(cx, cy + 1, PIXEL_SOLID, FG_BLACK);
-                    Draw(cx, cy - 1, PIXEL_SOLID, FG_BLACK);
 
-                    for (int i = 0; i < 11 * fEnergyLevel; i++)
+                    // Par plages de cases identiques
+                    for (int y = y0; y < y1; y++)
                     {
-                        Draw(worm->px - 5 + i - fCameraPosX, worm->py - 12 - fCameraPosY, PIXEL_SOLID, FG_GREEN);
-                        Draw(worm->px - 5 + i - fCameraPosX, worm->py - 11 - fCameraPosY, PIXEL_SOLID, FG_RED);
+                        const char* pRow = terrain.Cells(tx, ty) + ((y & cTerrain::nTileMask) << cTerrain::nTileShift);
+                        for (int x = x0; x < x1; )
+                        {
+                            char c = pRow[x & cTerrain::nTileMask];
+                            int nEnd = x + 1;
+                            while (nEnd < x1 && pRow[nEnd & cTerrain::nTileMask] == c)
+                                nEnd++;
+                            if (TerrainPixel(c, nGlyph, nColour))
+                                DrawSpan(x - nCamX, nEnd - nCamX, y - nCamY, nGlyph, nColour);
+                            x = nEnd;
+                        }
                     }
                 }
-            }
         }
         else // Le cas o l'on a dzoom sur la vue globale
         {
-            for (int x = 0; x < ScreenWidth(); x++)
-                for (int y = 0; y < ScreenHeight(); y++)
+            vector<char>& vecRow = vecZoomOutRow;
+            vecRow.resize(ScreenWidth());
+            for (int y = 0; y < ScreenHeight(); y++)
+            {
+                float fy = (float)y / (float)ScreenHeight() * (float)nMapHeight;
+                for (int x = 0; x < ScreenWidth(); x++)
                 {
                     float fx = (float)x / (float)ScreenWidth() * (float)nMapWidth;
-                    float fy = (float)y / (float)ScreenHeight() * (float)nMapHeight;
-
-                    switch (map[((int)fy) * nMapWidth + ((int)fx)])
-                    {
-                    case -1:Draw(x, y, PIXEL_SOLID, FG_DARK_BLUE); break;
-                    case -2:Draw(x, y, PIXEL_QUARTER, FG_BLUE | BG_DARK_BLUE); break;
-                    case -3:Draw(x, y, PIXEL_HALF, FG_BLUE | BG_DARK_BLUE); break;
-                    case -4:Draw(x, y, PIXEL_THREEQUARTERS, FG_BLUE | BG_DARK_BLUE); break;
-                    case -5:Draw(x, y, PIXEL_SOLID, FG_BLUE); break;
-                    case -6:Draw(x, y, PIXEL_QUARTER, FG_CYAN | BG_BLUE); break;
-                    case -7:Draw(x, y, PIXEL_HALF, FG_CYAN | BG_BLUE); break;
-                    case -8:Draw(x, y, PIXEL_THREEQUARTERS, FG_CYAN | BG_BLUE); break;
-
-                    case 0: Draw(x, y, PIXEL_SOLID, FG_CYAN); break;
-                    case 1: Draw(x, y, PIXEL_SOLID, FG_DARK_GREEN); break;
-                    }
+                    vecRow[x] = terrain.Peek((int)fx, (int)fy);
                 }
 
-            for (auto& p : listObjects)
-                p->Draw(this, p->px - (p->px / (float)nMapWidth) * (float)ScreenWidth(),
-                    p->py - (p->py / (float)nMapHeight) * (float)ScreenHeight(), true);
+                for (int x = 0; x < ScreenWidth(); )
+                {
+                    int nEnd = x + 1;
+                    while (nEnd < ScreenWidth() && vecRow[nEnd] == vecRow[x])
+                        nEnd++;
+                    if (TerrainPixel(vecRow[x], nGlyph, nColour))
+                        DrawSpan(x, nEnd, y, nGlyph, nColour);
+                    x = nEnd;
+                }
+            }
         }
+    }
 
-        // Vrifie si le jeu est "stable" (cad les objets au repos)
-        bGameIsStable = true;
-        for (auto& p : listObjects)
-            if (!p->bStable)
+    // Une explosion dtruit le terrain
+    void Boom(float fWorldX, float fWorldY, float fRadius, const sWeapon* pWeapon = sWeapon::Missile())
+    {
+        PlaySample(nSoundBoom);
+
+        Explode(terrain, listObjects, fWorldX, fWorldY, fRadius, bParticles ? 0 : DebrisCount(fRadius), pWeapon, &forces);
+        if (bParticles)
+            particles.Explosion(fWorldX, fWorldY, fRadius);
+    }
+
+    // Les dbris d'une explosion : un par unit de rayon, tant que la moiti de
+    // nObjectBudget n'est pas en vie, puis de moins en moins jusqu' aucun. Un
+    // barrage de cent missiles ne laisse pas des milliers de dbris  la physique
+    int DebrisCount(float fRadius) const
+    {
+        int nDebris = (int)fRadius;
+        if (nObjectBudget == 0)
+            return nDebris;
+        long long nBudget = nObjectBudget;
+        long long nLive = (long long)listObjects.size();
+        if (nLive * 2 > nBudget)
+            nDebris = (int)(nDebris * max(nBudget - nLive, 0LL) * 2 / nBudget);
+        return (int)min((long long)nDebris, max(nBudget - nLive, 0LL));
+    }
+
+    // Un projectile au bout de ses rebonds ou de son dtonateur : l'explosion de son
+    // arme, puis les projectiles qu'elle lance. Ceux-ci partent selon un motif fixe,
+    // sans cRandom, qui ne doit pas servir aux tirs d'essai des autres threads
+    template<typename TERRAIN>
+    static void Detonate(TERRAIN& terrain, list<unique_ptr<cPhysicsObject>>& listObjects, cPhysicsObject* p, Worms* pGame, sForces& forces)
+    {
+        // Ce qui se passe  ce moment
+        int nResponse = p->BounceDeathAction();
+        // Si la rponse est suprieure  0...
+        if (nResponse > 0)
+        {
+            // Boom !
+            if (pGame != nullptr)
             {
-                bGameIsStable = false;
-                break;
+                pGame->Boom(p->px, p->py, nResponse, p->pWeapon);
+                pGame->pCameraTrackingObject = nullptr;
             }
+            else
+                Explode(terrain, listObjects, p->px, p->py, nResponse, 0, p->pWeapon, &forces);
+        }
 
-        // Dessine les bars de sant de chaque quipe
-        for (size_t t = 0; t < vecTeams.size(); t++)
+        const sWeapon* w = p->pWeapon;
+        if (w == nullptr || w->pChild == nullptr)
+            return;
+        for (int i = 0; i < w->nChildren; i++)
         {
-            float fTotalHealth = 0.0f;
-            float fMaxHealth = (float)vecTeams[t].nTeamSize;
-            for (auto w : vecTeams[t].vecMembers)
-                fTotalHealth += w->fHealth;
+            float f = w->nChildren > 1 ? (float)i / (float)(w->nChildren - 1) : 0.5f;
+            cMissile* m = nullptr;
+            if (w->nSpawn == sWeapon::SPAWN_BURST)
+            {
+                // En ventail, de presque  droite  presque  gauche
+                float fAngle = -3.14159f * (0.1f + 0.8f * f);
+                m = new cMissile(p->px, p->py, cosf(fAngle) * w->fSpread, sinf(fAngle) * w->fSpread, w->pChild);
+            }
+            else
+            {
+                // En ligne au-dessus du point d'impact, sans sortir de la map
+                float x = p->px + (f - 0.5f) * w->fSpread * (float)(w->nChildren - 1);
+                x = min(max(x, 0.0f), (float)(terrain.nWidth - 1));
+                m = new cMissile(x, max(p->py - 200.0f, 0.0f), 0.0f, 10.0f, w->pChild);
+            }
+            listObjects.push_back(unique_ptr<cMissile>(m));
 
-            int cols[] =
-            { 
-                FG_RED,
-                FG_BLUE,
-                FG_MAGENTA,
-                FG_GREEN
-            };
+            // La camra suit le premier
+            if (pGame != nullptr && i == 0)
+                pGame->pCameraTrackingObject = m;
+        }
+    }
 
-            Fill(4, 4 + t * 4,
-                (fTotalHealth / fMaxHealth)* (float)(ScreenWidth() - 8) + 4,
-                4 + t * 4 + 3, PIXEL_SOLID, cols[t]);
+    // Creuse le disque d'un cratre, tel que le trace l'algorithme de Bresenham,
+    // mais une seule fois par range (le trac repasse sur certaines). Pour un grand
+    // cratre, les tuiles qu'il recouvre entirement deviennent du ciel uni d'un
+    // coup : elles ne cotent plus rien au rendu ni  la physique
+    template<typename TERRAIN>
+    static void Carve(TERRAIN& terrain, int xc, int yc, int r)
+    {
+        if (r <= 0)
+            return;
+
+        // La demi-largeur de chaque range, de yc - r  yc + r : la range ny est
+        // creuse sur [xc - h, xc + h[
+        vector<int> vecHalf(2 * r + 1, 0);
+        int x = 0;
+        int y = r;
+        int p = 3 - 2 * r;
+        while (y >= x)  //1/8 d'un cercle
+        {
+            vecHalf[r - y] = max(vecHalf[r - y], x);
+            vecHalf[r - x] = max(vecHalf[r - x], y);
+            vecHalf[r + y] = max(vecHalf[r + y], x);
+            vecHalf[r + x] = max(vecHalf[r + x], y);
+            if (p < 0) p += 4 * x++ + 6;
+            else p += 4 * (x++ - y--) + 10;
         }
 
-        // Compteur du temps restant
-        if (bShowCountDown)
+        // Les tuiles entires, de la map, que toutes leurs ranges traversent. Elles
+        // forment une bande par range de tuiles : [vecTileX0, vecTileX1[ en cases
+        const int nShift = cTerrain::nTileShift;
+        int ty0 = max(yc - r, 0) >> nShift;
+        int ty1 = (min(yc + r, terrain.nHeight - 1) >> nShift) + 1;
+        vector<int> vecTileX0, vecTileX1;
+        if (r >= cTerrain::nTileSize / 2 && ty1 > ty0)
         {
-        
-            //Random code
-            wchar_t d[] = L"w$]m.k{\%\x7Fo";
-            int tx = 4, ty = vecTeams.size() * 4 + 8;
-            for (int r = 0; r < 13; r++)
+            vecTileX0.assign(ty1 - ty0, 0);
+            vecTileX1.assign(ty1 - ty0, 0);
+            for (int ty = ty0; ty < ty1; ty++)
             {
-                for (int c = 0; c < ((fTurnTime < 10.0f) ? 1 : 2); c++)
+                int y0 = ty << nShift;
+                int y1 = y0 + cTerrain::nTileSize;
+                if (y0 < yc - r || y1 > yc + r + 1 || y1 > terrain.nHeight)
+                    continue;
+                int sx = xc - r, ex = xc + r;
+                for (int ny = y0; ny < y1; ny++)
                 {
-                    int a = to_wstring(fTurnTime)[c] - 48;
-                    if (!(r % 6))
-                    {
-                        DrawStringAlpha(tx, ty, wstring((d[a] & (1 << (r / 2)) ? L" #####  " : L"        ")), FG_BLACK);
-                        tx += 8;
-                    }
-                    else {
-                        DrawStringAlpha(tx, ty, wstring((d[a] & (1 << (r < 6 ? 1 : 4)) ? L"#     " : L"      ")), FG_BLACK);
-                        tx += 6;
-                        DrawStringAlpha(tx, ty, wstring((d[a] & (1 << (r < 6 ? 2 : 5)) ? L"# " : L"  ")), FG_BLACK);
-                        tx += 2;
-                    }
+                    sx = max(sx, xc - vecHalf[ny - yc + r]);
+                    ex = min(ex, xc + vecHalf[ny - yc + r]);
+                }
+                int tx0 = (max(sx, 0) + cTerrain::nTileMask) >> nShift;
+                int tx1 = min(ex, terrain.nWidth) >> nShift;
+                for (int tx = tx0; tx < tx1; tx++)
+                    terrain.ClearTile(tx, ty);
+                if (tx1 > tx0)
+                {
+                    vecTileX0[ty - ty0] = tx0 << nShift;
+                    vecTileX1[ty - ty0] = tx1 << nShift;
                 }
-                ty++; tx = 4;
             }
-      
         }
 
-        // State Machine
-        nGameState = nNextState;
-        nAIState = nAINextState;
-
-        return true;
+        for (int ny = max(yc - r, 0); ny <= min(yc + r, terrain.nHeight - 1); ny++)
+        {
+            int sx = max(xc - vecHalf[ny - yc + r], 0);
+            int ex = min(xc + vecHalf[ny - yc + r], terrain.nWidth);
+            int nSkip0 = ex, nSkip1 = ex;
+            if (!vecTileX0.empty())
+            {
+                nSkip0 = min(max(vecTileX0[(ny >> nShift) - ty0], sx), ex);
+                nSkip1 = min(max(vecTileX1[(ny >> nShift) - ty0], nSkip0), ex);
+            }
+            if (sx < nSkip0)
+                terrain.ClearSpan(sx, nSkip0, ny);
+            if (nSkip1 < ex)
+                terrain.ClearSpan(nSkip1, ex, ny);
+        }
     }
 
-    // Une explosion dtruit le terrain
-    void Boom(float fWorldX, float fWorldY, float fRadius)
+    // Le cratre, l'onde de choc et nDebris dbris d'une explosion. Les dommages et
+    // l'impulsion suivent les courbes de l'arme (celles du missile sans arme), et
+    // son souffle s'ajoute  l'air de pForces
+    template<typename TERRAIN>
+    static void Explode(TERRAIN& terrain, list<unique_ptr<cPhysicsObject>>& listObjects, float fWorldX, float fWorldY, float fRadius, int nDebris,
+        const sWeapon* pWeapon = sWeapon::Missile(), sForces* pForces = nullptr)
     {
-        auto CircleBresenham = [&](int xc, int yc, int r)
-            {
-                int x = 0;
-                int y = r;
-                int p = 3 - 2 * r;
-                if (!r) return;
-
-                auto drawline = [&](int sx, int ex, int ny)
-                    {
-                        for (int i = sx; i < ex; i++)
-                            if (ny >= 0 && ny < nMapHeight && i >= 0 && i < nMapWidth)
-                                map[ny * nMapWidth + i] = 0;
-                    };
-
-                while (y >= x)  //1/8 d'un cercle
-                {
-              
-                    drawline(xc - x, xc + x, yc - y);
-                    drawline(xc - y, xc + y, yc - x);
-                    drawline(xc - x, xc + x, yc + y);
-                    drawline(xc - y, xc + y, yc + x);
-                    if (p < 0) p += 4 * x++ + 6;
-                    else p += 4 * (x++ - y--) + 10;
-                }
-            };
-
         // Cre un cratre
-        CircleBresenham(fWorldX, fWorldY, fRadius);
+        terrain.Prepare(fWorldX - fRadius, fWorldY - fRadius, fWorldX + fRadius, fWorldY + fRadius);
+        Carve(terrain, fWorldX, fWorldY, fRadius);
 
         //Shockwave
         for (auto& p : listObjects)
@@ -1191,48 +5144,148 @@ private:
             // en fonction du rayon de l'explosion et de sa distance  l'picentre
             if (fDist < fRadius)
             {
-                p->vx = (dx / fDist) * fRadius;
-                p->vy = (dy / fDist) * fRadius;
-                p->Damage(((fRadius - fDist) / fRadius) * 0.8f);
+                float fNear = (fRadius - fDist) / fRadius;
+                float fKick = fRadius * pWeapon->fKick;
+                if (pWeapon->fKickFalloff != 0.0f)
+                    fKick *= powf(fNear, pWeapon->fKickFalloff);
+                p->vx = (dx / fDist) * fKick;
+                p->vy = (dy / fDist) * fKick;
+                float fDamage = fNear;
+                if (pWeapon->fFalloff != 1.0f)
+                    fDamage = powf(fDamage, pWeapon->fFalloff);
+                p->Damage(fDamage * pWeapon->fDamage);
                 p->bStable = false;
             }
 
 
         }
 
+        // Le souffle, deux fois plus large que le cratre, retombe en une demi-seconde de jeu
+        if (pForces != nullptr && pWeapon->fPush > 0.0f)
+            pForces->AddBlast(fWorldX, fWorldY, pWeapon->fPush, 2.0f * fRadius, 5.0f);
+
         // Envoie des debris
-        for (int i = 0; i < (int)fRadius; i++)
-            listObjects.push_back(unique_ptr<cDebris>(new cDebris(fWorldX, fWorldY)));
+        for (int i = 0; i < nDebris; i++)
+                listObjects.push_back(unique_ptr<cDebris>(new cDebris(fWorldX, fWorldY)));
+    }
+
+    // Joue un tir d'essai sur une copie de la partie : les worms sont copis, la
+    // map est partage (cTerrainFork) et la physique est celle du jeu, sans son
+    // ni dbris. Le bilan : dommages infligs aux autres quipes, moins ceux
+    // subis par la sienne (compts une fois et demie)
+    sShotPlan PlayShot(const cWorm* origin, float fAngle, float fEnergy) const
+    {
+        // Pas fixe : le rsultat ne dpend ni du framerate ni du thread. Avec le
+        // balayage des collisions, le plus long que permet la physique du jeu
+        const float fStep = nPhysics != PHYSICS_FIXED ? fMaxPhysicsStep : 1.0f / 60.0f;
+        const int nMaxSteps = (int)(80.0f / fStep);
+
+        sShotPlan plan;
+        plan.fAngle = fAngle;
+        plan.fEnergy = fEnergy;
+
+        cTerrainFork fork(terrain);
+        list<unique_ptr<cPhysicsObject>> listFork;
+        sForces forkForces = forces;
+        vector<pair<const cWorm*, const cWorm*>> vecWorms; // (original, copie)
+        for (auto& p : listObjects)
+            if (const cWorm* w = dynamic_cast<const cWorm*>(p.get()))
+                if (w->bIsPlayable)
+                {
+                    cWorm* c = new cWorm(*w);
+                    c->pTeam = nullptr;
+                    listFork.push_back(unique_ptr<cWorm>(c));
+                    vecWorms.push_back({ w, c });
+                }
+
+        cMissile* m = new cMissile(origin->px, origin->py, cosf(fAngle) * 40.0f * fEnergy, sinf(fAngle) * 40.0f * fEnergy, weapons[nWeapon]);
+        listFork.push_back(unique_ptr<cMissile>(m));
+
+        // Jusqu' la dernire explosion (grenade, clats d'une bombe) : les dommages
+        // sont faits  ce moment-l. Les projectiles suivent les worms dans la liste
+        bool bExploded = false;
+        for (int i = 0; i < nMaxSteps && !bExploded; i++)
+        {
+            PhysicsStep(fork, listFork, fStep, nullptr, nPhysics, bObjectCollisions, forkForces);
+            bExploded = listFork.back()->pWeapon == nullptr;
+        }
+
+        for (auto& w : vecWorms)
+        {
+            float fDamage = w.first->fHealth - w.second->fHealth;
+            float fKill = w.second->fHealth <= 0.0f ? 0.5f : 0.0f;
+            if (w.first->nTeam == origin->nTeam)
+                plan.fScore -= 1.5f * (fDamage + fKill);
+            else
+                plan.fScore += fDamage + fKill;
+        }
+        plan.nCopiedTiles = fork.CopiedTiles();
+        return plan;
+    }
+
+    // Essaie une grille d'angles et de puissances, en parallle, et garde le
+    // meilleur tir. Renvoie false si aucun ne fait mieux que de ne pas tirer
+    bool PlanShot(const cWorm* origin, sShotPlan& best)
+    {
+        const int nAngles = 32;
+        const float fEnergies[] = { 0.45f, 0.6f, 0.75f, 0.9f };
+        const int nEnergies = sizeof(fEnergies) / sizeof(fEnergies[0]);
+
+        if (pAIPool == nullptr)
+            pAIPool.reset(new cThreadPool(max(1, (int)thread::hardware_concurrency() - 1)));
+
+        if (nPhysics == PHYSICS_DISTANCE)
+            terrain.PrepareField();
+
+        vector<sShotPlan> vecPlans(nAngles * nEnergies);
+        pAIPool->ParallelFor((int)vecPlans.size(), [&](int i)
+            {
+                float fAngle = -3.14159f * ((i / nEnergies) + 0.5f) / nAngles;
+                vecPlans[i] = PlayShot(origin, fAngle, fEnergies[i % nEnergies]);
+            });
+
+        // A galit, le premier l'emporte : le choix ne dpend pas des threads
+        best = sShotPlan();
+        for (auto& p : vecPlans)
+            if (p.fScore > best.fScore)
+                best = p;
+        return best.fScore > 0.0f;
     }
 
     // Fonction cration de la carte
     void CreateMap()
+    {
+        // Une map dessine est prte tout de suite : ses tuiles seront lues du
+        // fichier au fur et  mesure
+        if (bMapFile)
+        {
+            nMapWidth = bitmap.nWidth;
+            nMapHeight = bitmap.nHeight;
+            terrain.Create(nMapWidth, nMapHeight, &bitmap, true);
+            return;
+        }
 
+        CreateNoise();
+
+        // Les grandes maps se fabriquent tuile par tuile,  la demande
+        terrain.Create(nMapWidth, nMapHeight, &noise, (int64_t)nMapWidth * nMapHeight > nStreamingCells);
+    }
+
+    // Le bruit de Perlin qui donne la surface de la map (tir de cRandom)
+    void CreateNoise()
     {
         //1D perlin noise
-        float* fSurface = new float[nMapWidth];
+        noise.nSeed = cRandom::nState;
+        noise.nHeight = nMapHeight;
+        noise.vecSurface.resize(nMapWidth);
         float* fNoiseSeed = new float[nMapWidth];
 
         for (int i = 0; i < nMapWidth; i++)
-            fNoiseSeed[i] = (float)rand() / (float)RAND_MAX;
+            fNoiseSeed[i] = cRandom::Unit();
 
         fNoiseSeed[0] = 0.5f;
-        PerlinNoise1D(nMapWidth, fNoiseSeed, 8, 2.0f, fSurface);
-
-        for (int x = 0; x < nMapWidth; x++)
-            for (int y = 0; y < nMapHeight; y++)
-            {
-                if (y >= fSurface[x] * nMapHeight)
-                    map[y * nMapWidth + x] = 1;
-                else
-                    // Le ciel
-                    if ((float)y < (float)nMapHeight / 3.0f)
-                        map[y * nMapWidth + x] = (-8.0f * ((float)y / (nMapHeight / 3.0f))) - 1.0f;
-                    else
-                        map[y * nMapWidth + x] = 0;
-            }
+        PerlinNoise1D(nMapWidth, fNoiseSeed, 8, 2.0f, noise.vecSurface.data());
 
-        delete[] fSurface;
         delete[] fNoiseSeed;
     }
 
@@ -1264,10 +5317,35 @@ private:
 };
 
 // Lance la fentre du jeu, et le jeu
-int main()
+#ifndef WORMS_NO_MAIN
+// "Worms fichier.rpl" rejoue un replay sauv avec la touche R
+int main(int argc, char** argv)
 {
     Worms game;
+
+    // Les armes sont dcrites dans armes.txt,  ct du jeu (un replay garde les siennes)
+    if (!game.LoadWeapons(L"armes.txt"))
+        cerr << "armes.txt absent ou illisible : le missile seul" << endl;
+
+    // Worms [carte.pbm] [partie.rpl]
+    for (int i = 1; i < argc; i++)
+    {
+        wstring sFile(argv[i], argv[i] + strlen(argv[i]));
+        bool bMap = sFile.size() > 4 && sFile.compare(sFile.size() - 4, 4, L".pbm") == 0;
+        if (bMap ? !game.LoadMapFile(sFile) : !game.LoadReplay(sFile))
+        {
+            cerr << (bMap ? "Carte illisible : " : "Replay illisible : ") << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (game.ReplayNeedsMapFile())
+    {
+        cerr << "Ce replay se joue sur une carte dessine : Worms carte.pbm partie.rpl" << endl;
+        return 1;
+    }
     game.ConstructConsole(256, 160, 6, 6);
+    game.EnableSound();
     game.Start();
     return 0;
 }
+#endif
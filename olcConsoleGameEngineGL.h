@@ -86,6 +86,10 @@ keycode you want to know about. bPressed is set for the frame the key is pressed
 in, bHeld is set if the key is held down, bReleased is set for the frame the key
 is released in. The same applies to mouse! m_mousePosX and Y can be used to get
 the current cursor position, and m_mouse[1..5] returns the mouse buttons.
+Behind the scenes the window queues key and mouse events, and only the keys that
+changed are updated each frame. SetInputSource() replaces the window with a script
+(olcInputScript) and SetInputRecorder() records what the game sees, so a run can be
+played again exactly.
 The draw routines treat characters like pixels. By default they are set to white solid
 blocks - but you can draw any unicode character, using any of the colours listed below.
 
@@ -106,6 +110,15 @@ http://www.twitch.tv/javidx9
 
 #pragma once
 
+// Headless mode: no window, no OpenGL and no waveOut. The engine still owns the
+// screen buffer and runs OnUserCreate/OnUserUpdate, so games can be benchmarked
+// and tested on machines without a display. It is the default outside Windows.
+#if !defined(_WIN32) && !defined(OLC_HEADLESS)
+#define OLC_HEADLESS
+#endif
+
+#ifndef OLC_HEADLESS
+
 #ifndef UNICODE
 #pragma message("Please enable UNICODE for your compiler! VS: Project Properties -> General -> \
 Character Set -> Use Unicode. Thanks! For now, I'll try enabling it for you - Javidx9")
@@ -120,18 +133,101 @@ Character Set -> Use Unicode. Thanks! For now, I'll try enabling it for you - Ja
 
 #include <windows.h>
 #include <gl/gl.h>
+
+#endif
+
 #include <iostream>
 #include <chrono>
 #include <vector>
 #include <list>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <condition_variable>
+#include <memory>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+// Linux sound output goes through ALSA (and so PulseAudio/PipeWire's default
+// device) when OLC_AUDIO_ALSA is defined. Link with -lasound.
+#ifdef OLC_AUDIO_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+// The audio mixer accumulates voices four samples at a time when SSE is there,
+// and the .wav loader converts 16-bit samples eight at a time with SSE2
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OLC_MIXER_SSE
+#include <xmmintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OLC_MIXER_SSE2
+#include <emmintrin.h>
+#endif
 using namespace std;
+
+#ifndef OLC_HEADLESS
 #define GL_GENERATE_MIPMAP                0x8191
 #define GL_GENERATE_MIPMAP_HINT           0x8192
 typedef BOOL(WINAPI wglSwapInterval_t) (int interval);
 wglSwapInterval_t *wglSwapInterval;
+#else
+// The few Win32 types and constants the engine and games rely on
+typedef struct _CHAR_INFO
+{
+	union
+	{
+		wchar_t UnicodeChar;
+		char AsciiChar;
+	} Char;
+	unsigned short Attributes;
+} CHAR_INFO;
+
+#pragma pack(push, 1)
+typedef struct
+{
+	uint16_t wFormatTag;
+	uint16_t nChannels;
+	uint32_t nSamplesPerSec;
+	uint32_t nAvgBytesPerSec;
+	uint16_t nBlockAlign;
+	uint16_t wBitsPerSample;
+	uint16_t cbSize;
+} WAVEFORMATEX;
+#pragma pack(pop)
+
+#define WAVE_FORMAT_PCM	1
+#define MAXSHORT		0x7FFF
+
+#define VK_LBUTTON		0x01
+#define VK_RBUTTON		0x02
+#define VK_MBUTTON		0x04
+#define VK_BACK			0x08
+#define VK_TAB			0x09
+#define VK_RETURN		0x0D
+#define VK_SHIFT		0x10
+#define VK_CONTROL		0x11
+#define VK_MENU			0x12
+#define VK_ESCAPE		0x1B
+#define VK_SPACE		0x20
+#define VK_LEFT			0x25
+#define VK_UP			0x26
+#define VK_RIGHT		0x27
+#define VK_DOWN			0x28
+
+// Narrow the (ASCII) file name, there is no wide fopen outside Windows
+inline int _wfopen_s(FILE **f, const wchar_t *sFile, const wchar_t *sMode)
+{
+	string file, mode;
+	for (; *sFile; sFile++) file += (char)*sFile;
+	for (; *sMode; sMode++) mode += (char)*sMode;
+	*f = fopen(file.c_str(), mode.c_str());
+	return *f == nullptr;
+}
+#endif
 
 enum COLOUR
 {
@@ -420,7 +516,19 @@ public:
 	wchar_t *m_Glyphs = nullptr;
 	short *m_Colours = nullptr;
 
+	// A run of opaque (not L' ') pixels on one row of the sprite
+	struct sSpan
+	{
+		int x;
+		int len;
+	};
+
 private:
+	// Opaque runs of every row, row y being m_Spans[m_RowSpanStart[y] .. m_RowSpanStart[y + 1])
+	std::vector<sSpan> m_Spans;
+	std::vector<int> m_RowSpanStart;
+	bool m_bSpansDirty = true;
+
 	void Create(int w, int h)
 	{
 		nWidth = w;
@@ -432,15 +540,52 @@ private:
 			m_Glyphs[i] = L' ';
 			m_Colours[i] = FG_BLACK;
 		}
+		m_bSpansDirty = true;
 	}
 
 public:
+	// Rebuilds the opaque runs. Called lazily after Load() or SetGlyph(); code
+	// writing m_Glyphs directly must call it itself.
+	void UpdateSpans()
+	{
+		m_Spans.clear();
+		m_RowSpanStart.assign(nHeight + 1, 0);
+		for (int y = 0; y < nHeight; y++)
+		{
+			m_RowSpanStart[y] = (int)m_Spans.size();
+			const wchar_t *row = &m_Glyphs[y * nWidth];
+			int x = 0;
+			while (x < nWidth)
+			{
+				while (x < nWidth && row[x] == L' ') x++;
+				int start = x;
+				while (x < nWidth && row[x] != L' ') x++;
+				if (x > start)
+					m_Spans.push_back({ start, x - start });
+			}
+		}
+		m_RowSpanStart[nHeight] = (int)m_Spans.size();
+		m_bSpansDirty = false;
+	}
+
+	// Opaque runs of row y, left to right
+	const sSpan *GetRowSpans(int y, int &nCount)
+	{
+		if (m_bSpansDirty)
+			UpdateSpans();
+		nCount = m_RowSpanStart[y + 1] - m_RowSpanStart[y];
+		return m_Spans.data() + m_RowSpanStart[y];
+	}
+
 	void SetGlyph(int x, int y, wchar_t c)
 	{
 		if (x <0 || x >= nWidth || y < 0 || y >= nHeight)
 			return;
 		else
+		{
 			m_Glyphs[y * nWidth + x] = c;
+			m_bSpansDirty = true;
+		}
 	}
 
 	void SetColour(int x, int y, short c)
@@ -497,7 +642,17 @@ public:
 		fwrite(&nWidth, sizeof(int), 1, f);
 		fwrite(&nHeight, sizeof(int), 1, f);
 		fwrite(m_Colours, sizeof(short), nWidth * nHeight, f);
-		fwrite(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		if (sizeof(wchar_t) == sizeof(uint16_t))
+			fwrite(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		else
+		{
+			// .spr files store UTF-16 glyphs, whatever the platform wchar_t is
+			for (int i = 0; i < nWidth * nHeight; i++)
+			{
+				uint16_t g = (uint16_t)m_Glyphs[i];
+				fwrite(&g, sizeof(uint16_t), 1, f);
+			}
+		}
 
 		fclose(f);
 
@@ -522,7 +677,17 @@ public:
 		Create(nWidth, nHeight);
 
 		fread(m_Colours, sizeof(short), nWidth * nHeight, f);
-		fread(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		if (sizeof(wchar_t) == sizeof(uint16_t))
+			fread(m_Glyphs, sizeof(wchar_t), nWidth * nHeight, f);
+		else
+		{
+			for (int i = 0; i < nWidth * nHeight; i++)
+			{
+				uint16_t g = 0;
+				fread(&g, sizeof(uint16_t), 1, f);
+				m_Glyphs[i] = (wchar_t)g;
+			}
+		}
 
 		fclose(f);
 		return true;
@@ -530,192 +695,798 @@ public:
 
 };
 
-class olcConsoleGameEngine
+// Audio output. The engine mixes blocks of 16-bit interleaved samples and hands
+// them to a backend. Real time backends are fed by the audio thread and block
+// until the device wants more; the others are fed by the game loop, with as much
+// sound as the frame's elapsed time, so they run as fast as the game does.
+class olcAudioBackend
 {
-	uint32_t m_ColourPalette[16] = // 0xAABBGGRR
+public:
+	virtual ~olcAudioBackend() {}
+	virtual bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples) = 0;
+	virtual void Write(const short *pBlock, unsigned int nSamples) = 0;
+	virtual void Close() = 0;
+	virtual bool IsRealTime() { return true; }
+};
+
+// Throws the sound away. For headless runs and benchmarks of the mixer
+class olcAudioBackendNull : public olcAudioBackend
+{
+public:
+	bool Open(unsigned int /*nSampleRate*/, unsigned int /*nChannels*/, unsigned int /*nBlocks*/, unsigned int /*nBlockSamples*/) override { return true; }
+	void Write(const short * /*pBlock*/, unsigned int /*nSamples*/) override {}
+	void Close() override {}
+	bool IsRealTime() override { return false; }
+};
+
+// Records the sound to a 16-bit PCM .wav file
+class olcAudioBackendWavFile : public olcAudioBackend
+{
+public:
+	olcAudioBackendWavFile(std::wstring sFile) : m_sFile(sFile)
 	{
-		0xFF000000, // BLACK
-		0xFF800000, // DARK_BLUE
-		0xFF008000, // DARK_GREEN
-		0xFF808000, // DARK_CYAN
-		0xFF000080, // DARK_RED
-		0xFF800080, // DARK_MAGENTA
-		0xFF008080, // DARK_YELLOW
-		0xFFC0C0C0, // GREY
-		0xFF808080, // DARK_GREY
-		0xFFFF0000, // BLUE
-		0xFF00FF00, // GREEN
-		0xFFFFFF00, // CYAN
-		0xFF0000FF, // RED
-		0xFFFF00FF, // MAGENTA
-		0xFF00FFFF, // YELLOW
-		0xFFFFFFFF  // WHITE
-	};
+	}
 
-	void UpdateMousePosition(int x, int y)
+	~olcAudioBackendWavFile()
 	{
-		float fx = (x - m_fDrawOffsetX) / (m_nScreenWidth * m_nFontWidth * m_fDrawScale);
-		float fy = (y - m_fDrawOffsetY) / (m_nScreenHeight * m_nFontHeight * m_fDrawScale);
+		Close();
+	}
 
-		fx = fx < 0 ? 0 : fx > 1.0f ? 1.0f : fx;
-		fy = fy < 0 ? 0 : fy > 1.0f ? 1.0f : fy;
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int /*nBlocks*/, unsigned int /*nBlockSamples*/) override
+	{
+		_wfopen_s(&m_pFile, m_sFile.c_str(), L"wb");
+		if (m_pFile == nullptr)
+			return false;
 
-		m_mousePosX = (int)(fx * m_nScreenWidth);
-		m_mousePosY = (int)(fy * m_nScreenHeight);
+		// The two sizes are patched in Close(), once known
+		uint16_t nBlockAlign = (uint16_t)(nChannels * sizeof(short));
+		uint32_t nByteRate = nSampleRate * nBlockAlign;
+		uint32_t nFmtSize = 16, nSize = 0;
+		uint16_t nFormat = WAVE_FORMAT_PCM, nWavChannels = (uint16_t)nChannels, nBits = 16;
+		std::fwrite("RIFF", 1, 4, m_pFile);
+		std::fwrite(&nSize, sizeof(uint32_t), 1, m_pFile);
+		std::fwrite("WAVEfmt ", 1, 8, m_pFile);
+		std::fwrite(&nFmtSize, sizeof(uint32_t), 1, m_pFile);
+		std::fwrite(&nFormat, sizeof(uint16_t), 1, m_pFile);
+		std::fwrite(&nWavChannels, sizeof(uint16_t), 1, m_pFile);
+		std::fwrite(&nSampleRate, sizeof(uint32_t), 1, m_pFile);
+		std::fwrite(&nByteRate, sizeof(uint32_t), 1, m_pFile);
+		std::fwrite(&nBlockAlign, sizeof(uint16_t), 1, m_pFile);
+		std::fwrite(&nBits, sizeof(uint16_t), 1, m_pFile);
+		std::fwrite("data", 1, 4, m_pFile);
+		std::fwrite(&nSize, sizeof(uint32_t), 1, m_pFile);
+		m_nDataBytes = 0;
+		return true;
 	}
 
-	void ToggleFullscreen(HWND hWnd)
+	void Write(const short *pBlock, unsigned int nSamples) override
 	{
-		static WINDOWPLACEMENT prev = { sizeof(WINDOWPLACEMENT) };
-
-		DWORD style = GetWindowLong(hWnd, GWL_STYLE);
+		std::fwrite(pBlock, sizeof(short), nSamples, m_pFile);
+		m_nDataBytes += nSamples * sizeof(short);
+	}
 
-		if (style & WS_OVERLAPPEDWINDOW)
-		{
-			int width = GetSystemMetrics(SM_CXSCREEN);
-			int height = GetSystemMetrics(SM_CYSCREEN);
+	void Close() override
+	{
+		if (m_pFile == nullptr)
+			return;
 
-			if (GetWindowPlacement(hWnd, &prev))
-			{
-				SetWindowLong(hWnd, GWL_STYLE, style & ~WS_OVERLAPPEDWINDOW);
-				SetWindowPos(hWnd, HWND_TOP, 0, 0, width, height, SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
-			}
-		}
-		else
-		{
-			SetWindowLong(hWnd, GWL_STYLE, style | WS_OVERLAPPEDWINDOW);
-			SetWindowPlacement(hWnd, &prev);
-			SetWindowPos(hWnd, NULL, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
-		}
+		uint32_t nRiffSize = 36 + m_nDataBytes;
+		std::fseek(m_pFile, 4, SEEK_SET);
+		std::fwrite(&nRiffSize, sizeof(uint32_t), 1, m_pFile);
+		std::fseek(m_pFile, 40, SEEK_SET);
+		std::fwrite(&m_nDataBytes, sizeof(uint32_t), 1, m_pFile);
+		std::fclose(m_pFile);
+		m_pFile = nullptr;
 	}
 
-	void WindowResize(void)
-	{
-		DWORD style = GetWindowLong(m_hWnd, GWL_STYLE);
-		DWORD stylex = GetWindowLong(m_hWnd, GWL_EXSTYLE);
+	bool IsRealTime() override { return false; }
 
-		RECT rWndRect = { 0, 0, m_nWindowWidth, m_nWindowHeight };
+private:
+	std::wstring m_sFile;
+	FILE *m_pFile = nullptr;
+	uint32_t m_nDataBytes = 0;
+};
 
-		if (style & WS_OVERLAPPEDWINDOW)
+#ifndef OLC_HEADLESS
+// Win32 waveOut: a ring of blocks queued on the sound card, each one refilled
+// as soon as the card has played it
+class olcAudioBackendWaveOut : public olcAudioBackend
+{
+public:
+	~olcAudioBackendWaveOut()
+	{
+		Close();
+	}
+
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples) override
+	{
+		m_nBlockCount = nBlocks;
+		m_nBlockSamples = nBlockSamples;
+		m_nBlockFree = m_nBlockCount;
+		m_nBlockCurrent = 0;
+
+		// Device is available
+		WAVEFORMATEX waveFormat;
+		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+		waveFormat.nSamplesPerSec = nSampleRate;
+		waveFormat.wBitsPerSample = sizeof(short) * 8;
+		waveFormat.nChannels = nChannels;
+		waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
+		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+		waveFormat.cbSize = 0;
+
+		// Open Device if valid
+		if (waveOutOpen(&m_hwDevice, WAVE_MAPPER, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
 		{
-			AdjustWindowRectEx(&rWndRect, style, FALSE, stylex);
+			m_hwDevice = nullptr;
+			return false;
+		}
 
-			int width = rWndRect.right - rWndRect.left;
-			int height = rWndRect.bottom - rWndRect.top;
+		// Allocate Wave|Block Memory
+		m_pBlockMemory = new short[m_nBlockCount * m_nBlockSamples];
+		ZeroMemory(m_pBlockMemory, sizeof(short) * m_nBlockCount * m_nBlockSamples);
 
-			SetWindowPos(m_hWnd, HWND_TOP, 0, 0, width, height, SWP_NOMOVE | SWP_NOOWNERZORDER);
+		m_pWaveHeaders = new WAVEHDR[m_nBlockCount];
+		ZeroMemory(m_pWaveHeaders, sizeof(WAVEHDR) * m_nBlockCount);
+
+		// Link headers to block memory
+		for (unsigned int n = 0; n < m_nBlockCount; n++)
+		{
+			m_pWaveHeaders[n].dwBufferLength = m_nBlockSamples * sizeof(short);
+			m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nBlockSamples));
 		}
-		else
+		return true;
+	}
+
+	void Write(const short *pBlock, unsigned int nSamples) override
+	{
+		// Wait for block to become available
+		if (m_nBlockFree == 0)
 		{
-			ToggleFullscreen(m_hWnd);
+			std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
+			while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
+				m_cvBlockNotZero.wait(lm);
+		}
 
-			AdjustWindowRectEx(&rWndRect, style, FALSE, stylex);
+		// Block is here, so use it
+		m_nBlockFree--;
 
-			int width = rWndRect.right - rWndRect.left;
-			int height = rWndRect.bottom - rWndRect.top;
+		// Prepare block for processing
+		if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
+			waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
 
-			SetWindowPos(m_hWnd, HWND_TOP, 0, 0, width, height, SWP_NOMOVE | SWP_NOOWNERZORDER);
+		memcpy(m_pBlockMemory + m_nBlockCurrent * m_nBlockSamples, pBlock, sizeof(short) * nSamples);
 
-			ToggleFullscreen(m_hWnd);
-		}
+		// Send block to sound device
+		waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		m_nBlockCurrent++;
+		m_nBlockCurrent %= m_nBlockCount;
+	}
 
+	void Close() override
+	{
+		if (m_hwDevice != nullptr)
+		{
+			waveOutReset(m_hwDevice);
+			for (unsigned int n = 0; n < m_nBlockCount; n++)
+				if (m_pWaveHeaders[n].dwFlags & WHDR_PREPARED)
+					waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[n], sizeof(WAVEHDR));
+			waveOutClose(m_hwDevice);
+			m_hwDevice = nullptr;
+		}
+		delete[] m_pWaveHeaders;
+		delete[] m_pBlockMemory;
+		m_pWaveHeaders = nullptr;
+		m_pBlockMemory = nullptr;
 	}
 
-	void WindowUpdateScale(void)
+private:
+	// Handler for soundcard request for more data
+	void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
 	{
-		int width = m_nWindowWidth;
-		int height = m_nWindowHeight;
+		if (uMsg != WOM_DONE) return;
+		m_nBlockFree++;
+		std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
+		m_cvBlockNotZero.notify_one();
+	}
 
-		glViewport(0, 0, width, height);
+	// Static wrapper for sound card handler
+	static void CALLBACK waveOutProcWrap(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2)
+	{
+		((olcAudioBackendWaveOut*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
+	}
 
-		glMatrixMode(GL_PROJECTION);
-		glLoadIdentity();
-		glOrtho(0, width, height, 0, -1, 100);
-		glMatrixMode(GL_MODELVIEW);
+	unsigned int m_nBlockCount = 0;
+	unsigned int m_nBlockSamples = 0;
+	unsigned int m_nBlockCurrent = 0;
+	short *m_pBlockMemory = nullptr;
+	WAVEHDR *m_pWaveHeaders = nullptr;
+	HWAVEOUT m_hwDevice = nullptr;
+	std::atomic<unsigned int> m_nBlockFree = 0;
+	std::condition_variable m_cvBlockNotZero;
+	std::mutex m_muxBlockNotZero;
+};
+#endif
 
-		float scaleX = (float)width / (float)(m_nScreenWidth * m_nFontWidth);
-		float scaleY = (float)height / (float)(m_nScreenHeight * m_nFontHeight);
+#ifdef OLC_AUDIO_ALSA
+// ALSA "default" PCM device; writes block until the device has room
+class olcAudioBackendALSA : public olcAudioBackend
+{
+public:
+	~olcAudioBackendALSA()
+	{
+		Close();
+	}
 
-		if (scaleX < scaleY)
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples) override
+	{
+		m_nChannels = nChannels;
+		if (snd_pcm_open(&m_hPCM, "default", SND_PCM_STREAM_PLAYBACK, 0) < 0)
 		{
-			m_fDrawScale = scaleX;
-			m_fDrawOffsetX = 0;
-			m_fDrawOffsetY = ((float)height - (float)(m_nScreenHeight * m_nFontHeight * scaleX)) * 0.5f;
+			m_hPCM = nullptr;
+			return false;
 		}
-		else
+
+		// Same latency as the block ring would give with waveOut
+		unsigned int nLatency = (unsigned int)((unsigned long long)nBlocks * nBlockSamples / nChannels * 1000000 / nSampleRate);
+		if (snd_pcm_set_params(m_hPCM, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, nChannels, nSampleRate, 1, nLatency) < 0)
 		{
-			m_fDrawScale = scaleY;
-			m_fDrawOffsetX = ((float)width - (float)(m_nScreenWidth * m_nFontWidth * scaleY)) * 0.5f;
-			m_fDrawOffsetY = 0;
+			Close();
+			return false;
 		}
+		return true;
 	}
 
-	int SetPixelFormatGL(void)
+	void Write(const short *pBlock, unsigned int nSamples) override
 	{
-		PIXELFORMATDESCRIPTOR pfd =
+		snd_pcm_uframes_t nFrames = nSamples / m_nChannels;
+		while (nFrames > 0)
 		{
-			sizeof(PIXELFORMATDESCRIPTOR), 1,
-			PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER,
-			PFD_TYPE_RGBA, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-			PFD_MAIN_PLANE, 0, 0, 0, 0
-		};
-
-		int pf = ChoosePixelFormat(m_hDevCtx, &pfd);
-		if (!pf) return 0;
+			snd_pcm_sframes_t n = snd_pcm_writei(m_hPCM, pBlock, nFrames);
+			if (n < 0)
+			{
+				// Underrun or suspend: recover and try again, give the block up otherwise
+				if (snd_pcm_recover(m_hPCM, (int)n, 1) < 0)
+					return;
+				continue;
+			}
+			pBlock += n * m_nChannels;
+			nFrames -= n;
+		}
+	}
 
-		return SetPixelFormat(m_hDevCtx, pf, &pfd);
+	void Close() override
+	{
+		if (m_hPCM == nullptr)
+			return;
+		snd_pcm_drain(m_hPCM);
+		snd_pcm_close(m_hPCM);
+		m_hPCM = nullptr;
 	}
 
-	static
-		LRESULT CALLBACK olcWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+private:
+	snd_pcm_t *m_hPCM = nullptr;
+	unsigned int m_nChannels = 1;
+};
+#endif
+
+// Band-limited sample rate conversion: windowed sinc (Blackman window) read from
+// a precomputed table. Used once at load time for whole samples, or chunk by
+// chunk for streams, since it keeps the input it still needs between calls.
+class olcAudioResampler
+{
+public:
+	olcAudioResampler(unsigned int nInRate = 44100, unsigned int nOutRate = 44100, int nChannels = 1)
 	{
-		static olcConsoleGameEngine *cge;
+		m_fStep = (double)nInRate / (double)nOutRate;
+		m_nChannels = nChannels;
+		if (IsPassThrough())
+			return;
 
+		// Low pass at the lowest of the two Nyquist frequencies, with a kernel
+		// widened as much as the cut off is lowered
+		float fCutoff = nOutRate < nInRate ? (float)nOutRate / (float)nInRate : 1.0f;
+		m_nHalfTaps = (int)ceilf(16.0f / fCutoff);
 
-		switch (uMsg)
+		m_vecKernel.resize(2 * m_nHalfTaps * nKernelPhases + 2);
+		for (size_t i = 0; i < m_vecKernel.size(); i++)
 		{
-		case WM_CREATE:
-			cge = static_cast<olcConsoleGameEngine*>(((LPCREATESTRUCT)lParam)->lpCreateParams);
+			float x = (float)i / (float)nKernelPhases - (float)m_nHalfTaps;
+			float t = x / (float)m_nHalfTaps;
+			float fSinc = x == 0.0f ? 1.0f : sinf(3.14159265f * fCutoff * x) / (3.14159265f * fCutoff * x);
+			float fWindow = fabsf(t) >= 1.0f ? 0.0f : 0.42f + 0.5f * cosf(3.14159265f * t) + 0.08f * cosf(2.0f * 3.14159265f * t);
+			m_vecKernel[i] = fCutoff * fSinc * fWindow;
+		}
 
-			cge->m_hDevCtx = GetDC(hWnd);
-			if (!cge->SetPixelFormatGL()) return -1;
+		// Centre the first output on the first input frame
+		m_vecInput.assign(m_nHalfTaps * m_nChannels, 0.0f);
+		m_fPos = (double)m_nHalfTaps;
+	}
 
-			cge->m_hRenCtx = wglCreateContext(cge->m_hDevCtx);
-			if (!cge->m_hRenCtx) return -1;
+	bool IsPassThrough() const
+	{
+		return m_fStep == 1.0;
+	}
 
-			wglMakeCurrent(cge->m_hDevCtx, cge->m_hRenCtx);
-			ShowWindow(cge->m_hConsole, SW_HIDE);
-			return 0;
+	// Appends the output that nFrames more input frames make available
+	void Process(const float *pIn, long nFrames, std::vector<float> &vecOut)
+	{
+		m_nInFrames += nFrames;
+		if (IsPassThrough())
+		{
+			vecOut.insert(vecOut.end(), pIn, pIn + nFrames * m_nChannels);
+			return;
+		}
 
-		case WM_SYSCHAR:
-			//ding ding ding
-			return 0;
+		m_vecInput.insert(m_vecInput.end(), pIn, pIn + nFrames * m_nChannels);
+		Emit(vecOut, false);
+	}
 
-		case WM_MOUSEMOVE:
-			cge->UpdateMousePosition(LOWORD(lParam), HIWORD(lParam));
-			return 0;
+	// No more input: appends the tail still held by the filter
+	void Flush(std::vector<float> &vecOut)
+	{
+		if (IsPassThrough())
+			return;
 
-		case WM_SIZE:
-			cge->m_nWindowWidth = LOWORD(lParam);
-			cge->m_nWindowHeight = HIWORD(lParam);
-			cge->m_bDoWindowUpdate = true;
-			return 0;
+		m_vecInput.resize(m_vecInput.size() + (m_nHalfTaps + 1) * m_nChannels, 0.0f);
+		Emit(vecOut, true);
+	}
 
-		case WM_SETFOCUS:
-			cge->m_bConsoleInFocus = true;
-			return 0;
+private:
+	void Emit(std::vector<float> &vecOut, bool bFlushing)
+	{
+		long nAvailable = (long)(m_vecInput.size() / m_nChannels);
+		while ((long)m_fPos + m_nHalfTaps < nAvailable)
+		{
+			// When flushing, stop at the length the input maps to
+			if (bFlushing && (double)m_nOutFrames * m_fStep >= (double)m_nInFrames)
+				break;
 
-		case WM_KILLFOCUS:
-			cge->m_bConsoleInFocus = false;
-			return 0;
+			long nCentre = (long)m_fPos;
+			float fFrac = (float)(m_fPos - (double)nCentre);
+			size_t nOut = vecOut.size();
+			vecOut.resize(nOut + m_nChannels, 0.0f);
 
-		case WM_CLOSE:
-			m_bAtomActive = false;
-			return 0;
+			for (long j = nCentre - m_nHalfTaps + 1; j <= nCentre + m_nHalfTaps; j++)
+			{
+				// Kernel at distance (m_fPos - j), linearly interpolated between table phases
+				float fTable = ((float)(nCentre - j) + fFrac + (float)m_nHalfTaps) * (float)nKernelPhases;
+				int nIndex = (int)fTable;
+				float fBlend = fTable - (float)nIndex;
+				float fWeight = m_vecKernel[nIndex] + (m_vecKernel[nIndex + 1] - m_vecKernel[nIndex]) * fBlend;
+
+				const float *pFrame = &m_vecInput[j * m_nChannels];
+				for (int c = 0; c < m_nChannels; c++)
+					vecOut[nOut + c] += pFrame[c] * fWeight;
+			}
 
-		case WM_DESTROY:
-			ShowWindow(cge->m_hConsole, SW_SHOW);
-			PostQuitMessage(0);
+			m_fPos += m_fStep;
+			m_nOutFrames++;
+		}
+
+		// Forget the input no future output can reach
+		long nDrop = (long)m_fPos - m_nHalfTaps;
+		if (nDrop > 0)
+		{
+			m_vecInput.erase(m_vecInput.begin(), m_vecInput.begin() + nDrop * m_nChannels);
+			m_fPos -= (double)nDrop;
+		}
+	}
+
+	static const int nKernelPhases = 256;
+	std::vector<float> m_vecKernel;
+	std::vector<float> m_vecInput;  // Interleaved frames still needed by the filter
+	double m_fStep = 1.0;           // Input frames per output frame
+	double m_fPos = 0.0;            // Next output, in frames from the start of m_vecInput
+	int m_nHalfTaps = 0;
+	int m_nChannels = 1;
+	long long m_nInFrames = 0;
+	long long m_nOutFrames = 0;
+};
+
+// One change of the input state. Keys and mouse buttons use virtual key codes
+// (VK_LBUTTON for the left button...), mouse positions are in screen cells.
+struct olcInputEvent
+{
+	enum Type : uint8_t
+	{
+		KEY_DOWN,
+		KEY_UP,
+		MOUSE_MOVE
+	};
+
+	Type nType = KEY_DOWN;
+	uint8_t nKey = 0;
+	int16_t x = 0;
+	int16_t y = 0;
+};
+
+// Something other than the window that feeds input frame by frame: a script
+// for benchmarks, a recording being replayed...
+class olcInputSource
+{
+public:
+	virtual ~olcInputSource() {}
+
+	// Appends the events of frame nFrame
+	virtual void Poll(uint32_t nFrame, std::vector<olcInputEvent> &vecEvents) = 0;
+};
+
+// A list of events, each stamped with the frame it happens in. Can be written
+// by hand, or filled by the engine while it runs (see SetInputRecorder)
+class olcInputScript : public olcInputSource
+{
+public:
+	void Add(uint32_t nFrame, const olcInputEvent &e)
+	{
+		// Recorded events come in order, so this is normally a push_back
+		auto it = vecEvents.end();
+		while (it != vecEvents.begin() && (it - 1)->first > nFrame)
+			--it;
+		vecEvents.insert(it, { nFrame, e });
+	}
+
+	void KeyDown(uint32_t nFrame, int nKey)
+	{
+		olcInputEvent e;
+		e.nType = olcInputEvent::KEY_DOWN;
+		e.nKey = (uint8_t)nKey;
+		Add(nFrame, e);
+	}
+
+	void KeyUp(uint32_t nFrame, int nKey)
+	{
+		olcInputEvent e;
+		e.nType = olcInputEvent::KEY_UP;
+		e.nKey = (uint8_t)nKey;
+		Add(nFrame, e);
+	}
+
+	void MouseMove(uint32_t nFrame, int x, int y)
+	{
+		olcInputEvent e;
+		e.nType = olcInputEvent::MOUSE_MOVE;
+		e.x = (int16_t)x;
+		e.y = (int16_t)y;
+		Add(nFrame, e);
+	}
+
+	// Back to the first event, to play the script again
+	void Rewind()
+	{
+		nNext = 0;
+	}
+
+	void Poll(uint32_t nFrame, std::vector<olcInputEvent> &vecOut) override
+	{
+		// Frames are polled in order: skip what is already past
+		while (nNext < vecEvents.size() && vecEvents[nNext].first < nFrame)
+			nNext++;
+		while (nNext < vecEvents.size() && vecEvents[nNext].first == nFrame)
+			vecOut.push_back(vecEvents[nNext++].second);
+	}
+
+	std::vector<std::pair<uint32_t, olcInputEvent>> vecEvents;
+
+private:
+	size_t nNext = 0;
+};
+
+class olcConsoleGameEngine
+{
+	uint32_t m_ColourPalette[16] = // 0xAABBGGRR
+	{
+		0xFF000000, // BLACK
+		0xFF800000, // DARK_BLUE
+		0xFF008000, // DARK_GREEN
+		0xFF808000, // DARK_CYAN
+		0xFF000080, // DARK_RED
+		0xFF800080, // DARK_MAGENTA
+		0xFF008080, // DARK_YELLOW
+		0xFFC0C0C0, // GREY
+		0xFF808080, // DARK_GREY
+		0xFFFF0000, // BLUE
+		0xFF00FF00, // GREEN
+		0xFFFFFF00, // CYAN
+		0xFF0000FF, // RED
+		0xFFFF00FF, // MAGENTA
+		0xFF00FFFF, // YELLOW
+		0xFFFFFFFF  // WHITE
+	};
+
+	void UpdateMousePosition(int x, int y)
+	{
+		float fx = (x - m_fDrawOffsetX) / (m_nScreenWidth * m_nFontWidth * m_fDrawScale);
+		float fy = (y - m_fDrawOffsetY) / (m_nScreenHeight * m_nFontHeight * m_fDrawScale);
+
+		fx = fx < 0 ? 0 : fx > 1.0f ? 1.0f : fx;
+		fy = fy < 0 ? 0 : fy > 1.0f ? 1.0f : fy;
+
+		olcInputEvent e;
+		e.nType = olcInputEvent::MOUSE_MOVE;
+		e.x = (int16_t)(fx * m_nScreenWidth);
+		e.y = (int16_t)(fy * m_nScreenHeight);
+		std::lock_guard<std::mutex> lm(m_muxInput);
+		m_vecInputQueue.push_back(e);
+	}
+
+	// Window side: queues a key change for the game thread. nKey -1 releases every key
+	void PushInputEvent(olcInputEvent::Type nType, int nKey)
+	{
+		std::lock_guard<std::mutex> lm(m_muxInput);
+		if (nKey < 0)
+		{
+			for (int k = 0; k < 256; k++)
+			{
+				olcInputEvent e;
+				e.nType = olcInputEvent::KEY_UP;
+				e.nKey = (uint8_t)k;
+				m_vecInputQueue.push_back(e);
+			}
+			return;
+		}
+
+		olcInputEvent e;
+		e.nType = nType;
+		e.nKey = (uint8_t)nKey;
+		m_vecInputQueue.push_back(e);
+	}
+
+public:
+	// Input comes from pSource instead of the window (nullptr: back to the
+	// window). Nothing typed meanwhile reaches the game, so runs are repeatable
+	void SetInputSource(olcInputSource *pSource)
+	{
+		m_pInputSource = pSource;
+	}
+
+	// Every event the game sees is also added to pRecorder, with its frame number
+	void SetInputRecorder(olcInputScript *pRecorder)
+	{
+		m_pInputRecorder = pRecorder;
+	}
+
+	// Game thread, once per frame: applies the events of this frame to m_keys,
+	// m_mouse and the mouse position. Only keys that change are touched
+	void ProcessInputEvents()
+	{
+		// Last frame's edges are over
+		for (uint8_t k : m_vecKeysChanged)
+		{
+			m_keys[k].bPressed = false;
+			m_keys[k].bReleased = false;
+		}
+		m_vecKeysChanged.clear();
+
+		m_vecInputEvents.clear();
+		{
+			std::lock_guard<std::mutex> lm(m_muxInput);
+			if (m_pInputSource == nullptr)
+				m_vecInputEvents.swap(m_vecInputQueue);
+			m_vecInputQueue.clear();
+		}
+		if (m_pInputSource != nullptr)
+			m_pInputSource->Poll(m_nInputFrame, m_vecInputEvents);
+
+		for (auto &e : m_vecInputEvents)
+		{
+			sKeyState &k = m_keys[e.nKey];
+			switch (e.nType)
+			{
+			case olcInputEvent::KEY_DOWN:
+				if (k.bHeld) continue;
+				k.bPressed = true;
+				k.bHeld = true;
+				m_vecKeysChanged.push_back(e.nKey);
+				break;
+
+			case olcInputEvent::KEY_UP:
+				if (!k.bHeld) continue;
+				k.bReleased = true;
+				k.bHeld = false;
+				m_vecKeysChanged.push_back(e.nKey);
+				break;
+
+			case olcInputEvent::MOUSE_MOVE:
+				m_mousePosX = e.x;
+				m_mousePosY = e.y;
+				break;
+			}
+
+			if (m_pInputRecorder != nullptr)
+				m_pInputRecorder->Add(m_nInputFrame, e);
+		}
+
+		m_mouse[0x00] = m_keys[VK_LBUTTON];
+		m_mouse[0x01] = m_keys[VK_RBUTTON];
+		m_mouse[0x02] = m_keys[VK_MBUTTON];
+		m_mouse[0x03] = m_keys[0x05]; // VK_XBUTTON1
+		m_mouse[0x04] = m_keys[0x06]; // VK_XBUTTON2
+
+		m_nInputFrame++;
+	}
+
+private:
+
+#ifndef OLC_HEADLESS
+	void ToggleFullscreen(HWND hWnd)
+	{
+		static WINDOWPLACEMENT prev = { sizeof(WINDOWPLACEMENT) };
+
+		DWORD style = GetWindowLong(hWnd, GWL_STYLE);
+
+		if (style & WS_OVERLAPPEDWINDOW)
+		{
+			int width = GetSystemMetrics(SM_CXSCREEN);
+			int height = GetSystemMetrics(SM_CYSCREEN);
+
+			if (GetWindowPlacement(hWnd, &prev))
+			{
+				SetWindowLong(hWnd, GWL_STYLE, style & ~WS_OVERLAPPEDWINDOW);
+				SetWindowPos(hWnd, HWND_TOP, 0, 0, width, height, SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
+			}
+		}
+		else
+		{
+			SetWindowLong(hWnd, GWL_STYLE, style | WS_OVERLAPPEDWINDOW);
+			SetWindowPlacement(hWnd, &prev);
+			SetWindowPos(hWnd, NULL, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
+		}
+	}
+
+	void WindowResize(void)
+	{
+		DWORD style = GetWindowLong(m_hWnd, GWL_STYLE);
+		DWORD stylex = GetWindowLong(m_hWnd, GWL_EXSTYLE);
+
+		RECT rWndRect = { 0, 0, m_nWindowWidth, m_nWindowHeight };
+
+		if (style & WS_OVERLAPPEDWINDOW)
+		{
+			AdjustWindowRectEx(&rWndRect, style, FALSE, stylex);
+
+			int width = rWndRect.right - rWndRect.left;
+			int height = rWndRect.bottom - rWndRect.top;
+
+			SetWindowPos(m_hWnd, HWND_TOP, 0, 0, width, height, SWP_NOMOVE | SWP_NOOWNERZORDER);
+		}
+		else
+		{
+			ToggleFullscreen(m_hWnd);
+
+			AdjustWindowRectEx(&rWndRect, style, FALSE, stylex);
+
+			int width = rWndRect.right - rWndRect.left;
+			int height = rWndRect.bottom - rWndRect.top;
+
+			SetWindowPos(m_hWnd, HWND_TOP, 0, 0, width, height, SWP_NOMOVE | SWP_NOOWNERZORDER);
+
+			ToggleFullscreen(m_hWnd);
+		}
+
+	}
+
+	void WindowUpdateScale(void)
+	{
+		int width = m_nWindowWidth;
+		int height = m_nWindowHeight;
+
+		glViewport(0, 0, width, height);
+
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		glOrtho(0, width, height, 0, -1, 100);
+		glMatrixMode(GL_MODELVIEW);
+
+		float scaleX = (float)width / (float)(m_nScreenWidth * m_nFontWidth);
+		float scaleY = (float)height / (float)(m_nScreenHeight * m_nFontHeight);
+
+		if (scaleX < scaleY)
+		{
+			m_fDrawScale = scaleX;
+			m_fDrawOffsetX = 0;
+			m_fDrawOffsetY = ((float)height - (float)(m_nScreenHeight * m_nFontHeight * scaleX)) * 0.5f;
+		}
+		else
+		{
+			m_fDrawScale = scaleY;
+			m_fDrawOffsetX = ((float)width - (float)(m_nScreenWidth * m_nFontWidth * scaleY)) * 0.5f;
+			m_fDrawOffsetY = 0;
+		}
+	}
+
+	int SetPixelFormatGL(void)
+	{
+		PIXELFORMATDESCRIPTOR pfd =
+		{
+			sizeof(PIXELFORMATDESCRIPTOR), 1,
+			PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER,
+			PFD_TYPE_RGBA, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			PFD_MAIN_PLANE, 0, 0, 0, 0
+		};
+
+		int pf = ChoosePixelFormat(m_hDevCtx, &pfd);
+		if (!pf) return 0;
+
+		return SetPixelFormat(m_hDevCtx, pf, &pfd);
+	}
+
+	static
+		LRESULT CALLBACK olcWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+	{
+		static olcConsoleGameEngine *cge;
+
+
+		switch (uMsg)
+		{
+		case WM_CREATE:
+			cge = static_cast<olcConsoleGameEngine*>(((LPCREATESTRUCT)lParam)->lpCreateParams);
+
+			cge->m_hDevCtx = GetDC(hWnd);
+			if (!cge->SetPixelFormatGL()) return -1;
+
+			cge->m_hRenCtx = wglCreateContext(cge->m_hDevCtx);
+			if (!cge->m_hRenCtx) return -1;
+
+			wglMakeCurrent(cge->m_hDevCtx, cge->m_hRenCtx);
+			ShowWindow(cge->m_hConsole, SW_HIDE);
+			return 0;
+
+		case WM_SYSCHAR:
+			//ding ding ding
+			return 0;
+
+		case WM_MOUSEMOVE:
+			cge->UpdateMousePosition(LOWORD(lParam), HIWORD(lParam));
+			return 0;
+
+		// Keyboard and mouse buttons become events for the game thread
+		case WM_KEYDOWN:
+		case WM_SYSKEYDOWN:
+			if (!(lParam & (1 << 30))) // Not auto-repeat
+				cge->PushInputEvent(olcInputEvent::KEY_DOWN, (int)wParam);
+			if (uMsg == WM_SYSKEYDOWN) break; // Let Windows see Alt+F4
+			return 0;
+
+		case WM_KEYUP:
+		case WM_SYSKEYUP:
+			cge->PushInputEvent(olcInputEvent::KEY_UP, (int)wParam);
+			if (uMsg == WM_SYSKEYUP) break;
+			return 0;
+
+		case WM_LBUTTONDOWN: cge->PushInputEvent(olcInputEvent::KEY_DOWN, VK_LBUTTON); return 0;
+		case WM_LBUTTONUP: cge->PushInputEvent(olcInputEvent::KEY_UP, VK_LBUTTON); return 0;
+		case WM_RBUTTONDOWN: cge->PushInputEvent(olcInputEvent::KEY_DOWN, VK_RBUTTON); return 0;
+		case WM_RBUTTONUP: cge->PushInputEvent(olcInputEvent::KEY_UP, VK_RBUTTON); return 0;
+		case WM_MBUTTONDOWN: cge->PushInputEvent(olcInputEvent::KEY_DOWN, VK_MBUTTON); return 0;
+		case WM_MBUTTONUP: cge->PushInputEvent(olcInputEvent::KEY_UP, VK_MBUTTON); return 0;
+		case WM_XBUTTONDOWN: cge->PushInputEvent(olcInputEvent::KEY_DOWN, HIWORD(wParam) == XBUTTON1 ? 0x05 : 0x06); return TRUE;
+		case WM_XBUTTONUP: cge->PushInputEvent(olcInputEvent::KEY_UP, HIWORD(wParam) == XBUTTON1 ? 0x05 : 0x06); return TRUE;
+
+		case WM_SIZE:
+			cge->m_nWindowWidth = LOWORD(lParam);
+			cge->m_nWindowHeight = HIWORD(lParam);
+			cge->m_bDoWindowUpdate = true;
+			return 0;
+
+		case WM_SETFOCUS:
+			cge->m_bConsoleInFocus = true;
+			return 0;
+
+		case WM_KILLFOCUS:
+			// Keys released elsewhere would never be seen: release everything
+			cge->m_bConsoleInFocus = false;
+			cge->PushInputEvent(olcInputEvent::KEY_UP, -1);
+			return 0;
+
+		case WM_CLOSE:
+			m_bAtomActive = false;
+			return 0;
+
+		case WM_DESTROY:
+			ShowWindow(cge->m_hConsole, SW_SHOW);
+			PostQuitMessage(0);
 			return 0;
 
 		case 0x8000:
@@ -765,6 +1536,7 @@ class olcConsoleGameEngine
 		return CreateWindowEx(dwExStyle, wnd_class, wnd_title, dwStyle,
 			CW_USEDEFAULT, CW_USEDEFAULT, width, height, NULL, NULL, hInstance, this);
 	}
+#endif
 
 public:
 	olcConsoleGameEngine()
@@ -772,21 +1544,28 @@ public:
 		m_nScreenWidth = 80;
 		m_nScreenHeight = 30;
 
-		memset(m_keyNewState, 0, 256 * sizeof(short));
-		memset(m_keyOldState, 0, 256 * sizeof(short));
 		memset(m_keys, 0, 256 * sizeof(sKeyState));
+		memset(m_mouse, 0, 5 * sizeof(sKeyState));
 		m_mousePosX = 0;
 		m_mousePosY = 0;
 
 		m_bEnableSound = false;
+		m_nSampleRate = 44100;
+		m_nChannels = 1;
 
 		m_sAppName = L"Default";
 
 		//grab 1 GB or memory
+#ifndef OLC_HEADLESS
 		m_bufMemory = (uint8_t*)VirtualAlloc(NULL, 1024 * 1024 * 1024, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 		if (!m_bufMemory) throw exception("No Memory!");
+#else
+		// Pages are only committed once touched, like VirtualAlloc
+		m_bufMemory = (uint8_t*)calloc(1024 * 1024 * 1024, 1);
+		if (!m_bufMemory) throw bad_alloc();
+#endif
 
-		m_bufScreen = (CHAR_INFO*)&m_bufMemory[0];
+		m_bufScreen = m_bufScreenMain = (CHAR_INFO*)&m_bufMemory[0];
 		m_bufScreen_old = (CHAR_INFO*)&m_bufMemory[21474304];
 
 		m_fVertexArray = (float*)&m_bufMemory[42948608];
@@ -796,14 +1575,25 @@ public:
 		m_uForegroundColorArray = (uint32_t*)&m_bufMemory[816023552];
 		m_uBackgroundColorArray = (uint32_t*)&m_bufMemory[944869376];
 
+#ifndef OLC_HEADLESS
 		m_hConsole = GetConsoleWindow();
+#endif
 	}
 
+	// Sound goes to the platform's device: waveOut on Windows, ALSA if built
+	// with OLC_AUDIO_ALSA, otherwise nowhere (null backend)
 	void EnableSound()
 	{
 		m_bEnableSound = true;
 	}
 
+	// Sound goes to the given backend, which the engine now owns
+	void EnableSound(olcAudioBackend *pBackend)
+	{
+		m_pAudioBackend.reset(pBackend);
+		m_bEnableSound = true;
+	}
+
 	int ConstructConsole(int width, int height, int fontw, int fonth)
 	{
 		m_nScreenWidth = width;
@@ -815,10 +1605,12 @@ public:
 		int newWndWidth = width * fontw;
 		int newWndHeight = height * fonth;
 
+#ifndef OLC_HEADLESS
 		if (m_hWnd && ((m_nWindowWidth != newWndWidth) || (m_nWindowHeight != newWndHeight)))
 		{
 			SendMessage(m_hWnd, 0x8001, 0, 0);
 		}
+#endif
 
 		m_nWindowWidth = newWndWidth;
 		m_nWindowHeight = newWndHeight;
@@ -828,12 +1620,23 @@ public:
 
 		if (bufLen > 0x51EB00)
 		{
+#ifndef OLC_HEADLESS
 			MessageBoxA(NULL, "Not enough memory!", "ERROR!", MB_OK);
 			ExitProcess(0xDEADC0DE);
+#else
+			fprintf(stderr, "Not enough memory!\n");
+			exit(0xDE);
+#endif
 		}
 
 		memset(m_bufMemory, 0, bufLen * 200);
 
+#ifdef OLC_HEADLESS
+		// No mouse without a window: park it in the middle of the screen
+		m_mousePosX = m_nScreenWidth / 2;
+		m_mousePosY = m_nScreenHeight / 2;
+#endif
+
 		for (int y = 0; y < m_nScreenHeight; y++)
 			for (int x = 0; x < m_nScreenWidth; x++)
 			{
@@ -889,9 +1692,36 @@ public:
 	{
 		Clip(x1, y1);
 		Clip(x2, y2);
+		for (int y = y1; y < y2; y++)
+			DrawSpan(x1, x2, y, c, col);
+	}
+
+	// Cells [x1, x2[ of row y, clipped once and written in a single run
+	void DrawSpan(int x1, int x2, int y, wchar_t c = 0x2588, short col = 0x000F)
+	{
+		if (y < 0 || y >= m_nScreenHeight)
+			return;
+		if (x1 < 0) x1 = 0;
+		if (x2 > m_nScreenWidth) x2 = m_nScreenWidth;
+		CHAR_INFO *dst = &m_bufScreen[y * m_nScreenWidth];
 		for (int x = x1; x < x2; x++)
-			for (int y = y1; y < y2; y++)
-				Draw(x, y, c, col);
+		{
+			dst[x].Char.UnicodeChar = c;
+			dst[x].Attributes = col;
+		}
+	}
+
+	// Sends every drawing call to pTarget, a buffer of ScreenWidth() x ScreenHeight()
+	// cells (a layer, copied later with DrawLayer), or back to the screen with nullptr
+	void SetDrawTarget(CHAR_INFO *pTarget)
+	{
+		m_bufScreen = pTarget != nullptr ? pTarget : m_bufScreenMain;
+	}
+
+	// Copies a whole layer onto the screen
+	void DrawLayer(const CHAR_INFO *pLayer)
+	{
+		memcpy(m_bufScreenMain, pLayer, (size_t)m_nScreenWidth * m_nScreenHeight * sizeof(CHAR_INFO));
 	}
 
 	void DrawString(int x, int y, wstring c, short col = 0x000F)
@@ -1194,14 +2024,7 @@ public:
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < sprite->nWidth; i++)
-		{
-			for (int j = 0; j < sprite->nHeight; j++)
-			{
-				if (sprite->GetGlyph(i, j) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i, j), sprite->GetColour(i, j));
-			}
-		}
+		DrawPartialSprite(x, y, sprite, 0, 0, sprite->nWidth, sprite->nHeight);
 	}
 
 	void DrawPartialSprite(int x, int y, olcSprite *sprite, int ox, int oy, int w, int h)
@@ -1209,12 +2032,53 @@ public:
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < w; i++)
+		// Clip once against both the sprite and the screen...
+		int i0 = 0, i1 = w, j0 = 0, j1 = h;
+		if (i0 < -ox) i0 = -ox;
+		if (i0 < -x) i0 = -x;
+		if (i1 > sprite->nWidth - ox) i1 = sprite->nWidth - ox;
+		if (i1 > m_nScreenWidth - x) i1 = m_nScreenWidth - x;
+		if (j0 < -oy) j0 = -oy;
+		if (j0 < -y) j0 = -y;
+		if (j1 > sprite->nHeight - oy) j1 = sprite->nHeight - oy;
+		if (j1 > m_nScreenHeight - y) j1 = m_nScreenHeight - y;
+		if (i0 >= i1 || j0 >= j1)
+			return;
+
+		// ...then copy the opaque runs of each row straight into the screen buffer
+		int sx0 = ox + i0, sx1 = ox + i1;
+		for (int j = j0; j < j1; j++)
 		{
-			for (int j = 0; j < h; j++)
+			int sy = oy + j;
+			const wchar_t *glyphs = &sprite->m_Glyphs[sy * sprite->nWidth];
+			const short *colours = &sprite->m_Colours[sy * sprite->nWidth];
+			CHAR_INFO *dst = &m_bufScreen[(y + j) * m_nScreenWidth];
+			int dx = x - ox; // Sprite column to screen column
+
+			int nSpans = 0;
+			const olcSprite::sSpan *spans = sprite->GetRowSpans(sy, nSpans);
+
+			// Skip the runs ending left of the clipped area (sprite sheets have many per row)
+			int first = 0, last = nSpans;
+			while (first < last)
 			{
-				if (sprite->GetGlyph(i + ox, j + oy) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i + ox, j + oy), sprite->GetColour(i + ox, j + oy));
+				int mid = (first + last) / 2;
+				if (spans[mid].x + spans[mid].len <= sx0) first = mid + 1;
+				else last = mid;
+			}
+
+			for (int s = first; s < nSpans; s++)
+			{
+				int a = spans[s].x, b = spans[s].x + spans[s].len;
+				if (a >= sx1)
+					break;
+				if (a < sx0) a = sx0;
+				if (b > sx1) b = sx1;
+				for (int k = a; k < b; k++)
+				{
+					dst[k + dx].Char.UnicodeChar = glyphs[k];
+					dst[k + dx].Attributes = colours[k];
+				}
 			}
 		}
 	}
@@ -1223,49 +2087,83 @@ public:
 	{
 		// pair.first = x coordinate
 		// pair.second = y coordinate
+		DrawWireFrameModelTransformed(vecModelCoordinates.data(), (int)vecModelCoordinates.size(), x, y, cosf(r) * s, sinf(r) * s, col, c);
+	}
 
-		// Create translated model vector of coordinate pairs
-		vector<pair<float, float>> vecTransformedCoordinates;
-		int verts = vecModelCoordinates.size();
-		vecTransformedCoordinates.resize(verts);
+	// One placement of a wire frame model, for DrawWireFrameModels()
+	struct sWireFrameInstance
+	{
+		float x = 0.0f;
+		float y = 0.0f;
+		float r = 0.0f;
+		float s = 1.0f;
+	};
 
-		// Rotate
-		for (int i = 0; i < verts; i++)
-		{
-			vecTransformedCoordinates[i].first = vecModelCoordinates[i].first * cosf(r) - vecModelCoordinates[i].second * sinf(r);
-			vecTransformedCoordinates[i].second = vecModelCoordinates[i].first * sinf(r) + vecModelCoordinates[i].second * cosf(r);
-		}
+	// Draws many instances of the same model in one call (e.g. all the debris of an explosion)
+	void DrawWireFrameModels(const std::vector<std::pair<float, float>> &vecModelCoordinates, const std::vector<sWireFrameInstance> &vecInstances, short col = FG_WHITE, short c = PIXEL_SOLID)
+	{
+		const std::pair<float, float> *model = vecModelCoordinates.data();
+		int verts = (int)vecModelCoordinates.size();
+		for (auto &inst : vecInstances)
+			DrawWireFrameModelTransformed(model, verts, inst.x, inst.y, cosf(inst.r) * inst.s, sinf(inst.r) * inst.s, col, c);
+	}
 
-		// Scale
-		for (int i = 0; i < verts; i++)
+	// Plots one cell per point straight into the screen buffer (e.g. a particle system
+	// kept as separate arrays). A point lands at ((x - fOffsetX) * fScaleX, (y - fOffsetY) * fScaleY)
+	// and is skipped if that is off screen
+	void DrawPoints(const float *x, const float *y, const short *col, size_t n, float fOffsetX = 0.0f, float fOffsetY = 0.0f,
+		float fScaleX = 1.0f, float fScaleY = 1.0f, short c = PIXEL_SOLID)
+	{
+		for (size_t i = 0; i < n; i++)
 		{
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first * s;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second * s;
+			int sx = (int)((x[i] - fOffsetX) * fScaleX);
+			int sy = (int)((y[i] - fOffsetY) * fScaleY);
+			if ((unsigned)sx < (unsigned)m_nScreenWidth && (unsigned)sy < (unsigned)m_nScreenHeight)
+			{
+				CHAR_INFO &ci = m_bufScreen[sy * m_nScreenWidth + sx];
+				ci.Char.UnicodeChar = c;
+				ci.Attributes = col[i];
+			}
 		}
+	}
 
-		// Translate
-		for (int i = 0; i < verts; i++)
-		{
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first + x;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second + y;
-		}
+private:
+	// Rotate, scale and translate in a single pass: fCos and fSin are already
+	// multiplied by the scale. Each vertex is transformed once and only the
+	// first and previous ones are kept, so nothing is allocated.
+	void DrawWireFrameModelTransformed(const std::pair<float, float> *model, int verts, float x, float y, float fCos, float fSin, short col, short c)
+	{
+		if (verts <= 0)
+			return;
 
-		// Draw Closed Polygon
-		for (int i = 0; i < verts + 1; i++)
+		int x0 = (int)(model[0].first * fCos - model[0].second * fSin + x);
+		int y0 = (int)(model[0].first * fSin + model[0].second * fCos + y);
+		int px = x0, py = y0;
+
+		for (int i = 1; i < verts; i++)
 		{
-			int j = (i + 1);
-			DrawLine((int)vecTransformedCoordinates[i % verts].first, (int)vecTransformedCoordinates[i % verts].second,
-				(int)vecTransformedCoordinates[j % verts].first, (int)vecTransformedCoordinates[j % verts].second, c, col);
+			int nx = (int)(model[i].first * fCos - model[i].second * fSin + x);
+			int ny = (int)(model[i].first * fSin + model[i].second * fCos + y);
+			DrawLine(px, py, nx, ny, c, col);
+			px = nx; py = ny;
 		}
+
+		// Close the polygon
+		DrawLine(px, py, x0, y0, c, col);
 	}
 
+public:
 	~olcConsoleGameEngine()
 	{
+#ifndef OLC_HEADLESS
 		if (m_bufMemory) VirtualFree(m_bufMemory, 0, MEM_RELEASE);
+#else
+		free(m_bufMemory);
+#endif
 
 		m_bufMemory = nullptr;
 
-		m_bufScreen = nullptr;
+		m_bufScreen = m_bufScreenMain = nullptr;
 		m_bufScreen_old = nullptr;
 
 		m_fVertexArray = nullptr;
@@ -1317,6 +2215,7 @@ public:
 	}
 
 public:
+#ifndef OLC_HEADLESS
 	void Start()
 	{
 		m_bAtomActive = true;
@@ -1420,21 +2319,106 @@ public:
 		// Wait for thread to be exited
 		t.join();
 	}
+#else
+	void Start()
+	{
+		// Nothing to pump messages for, the game loop runs on the caller's thread
+		m_bAtomActive = true;
+		GameThread();
+	}
+#endif
 
 	int ScreenWidth()
 	{
 		return m_nScreenWidth;
 	}
 
-	int ScreenHeight()
-	{
-		return m_nScreenHeight;
+	int ScreenHeight()
+	{
+		return m_nScreenHeight;
+	}
+
+protected:
+	// Upload only the cells that changed since the last frame into the vertex
+	// colour and texture coordinate arrays. Window independent, so it also
+	// runs (and can be measured) in headless mode.
+	void UpdateScreenArrays()
+	{
+		for (int y = 0; y < m_nScreenHeight; y++)
+			for (int x = 0; x < m_nScreenWidth; x++)
+			{
+				int pos = y * m_nScreenWidth + x;
+
+				if ((m_bufScreen[pos].Char.UnicodeChar == m_bufScreen_old[pos].Char.UnicodeChar) &&
+					(m_bufScreen[pos].Attributes == m_bufScreen_old[pos].Attributes))
+					continue;
+
+				m_bufScreen_old[pos] = m_bufScreen[pos];
+
+				wchar_t id = m_bufScreen[pos].Char.UnicodeChar;
+				unsigned short col = m_bufScreen[pos].Attributes;
+
+				int u, v;
+				float u1, v1, u2, v2;
+				uint32_t fg, bg;
+
+				if (id == L' ')
+				{
+					u1 = u2 = v1 = v2 = 0.0f;
+					fg = bg = 0;
+				}
+				else
+				{
+					GetFontCoords(id, &u, &v);
+
+					u1 = (u) / 256.0f;
+					v1 = (v) / 256.0f;
+					u2 = (u + 8) / 256.0f;
+					v2 = (v + 8) / 256.0f;
+
+					fg = m_ColourPalette[col & 0xF];
+					bg = m_ColourPalette[(col >> 4) & 0xF];
+				}
+
+				pos *= 6;
+
+				m_uForegroundColorArray[pos + 0] = fg;
+				m_uForegroundColorArray[pos + 1] = fg;
+				m_uForegroundColorArray[pos + 2] = fg;
+				m_uForegroundColorArray[pos + 3] = fg;
+				m_uForegroundColorArray[pos + 4] = fg;
+				m_uForegroundColorArray[pos + 5] = fg;
+
+				m_uBackgroundColorArray[pos + 0] = bg;
+				m_uBackgroundColorArray[pos + 1] = bg;
+				m_uBackgroundColorArray[pos + 2] = bg;
+				m_uBackgroundColorArray[pos + 3] = bg;
+				m_uBackgroundColorArray[pos + 4] = bg;
+				m_uBackgroundColorArray[pos + 5] = bg;
+
+				pos *= 2;
+
+				m_fTexCoordArray[pos + 0] = u1;
+				m_fTexCoordArray[pos + 1] = v1;
+				m_fTexCoordArray[pos + 2] = u2;
+				m_fTexCoordArray[pos + 3] = v1;
+				m_fTexCoordArray[pos + 4] = u1;
+				m_fTexCoordArray[pos + 5] = v2;
+				m_fTexCoordArray[pos + 6] = u2;
+				m_fTexCoordArray[pos + 7] = v1;
+				m_fTexCoordArray[pos + 8] = u1;
+				m_fTexCoordArray[pos + 9] = v2;
+				m_fTexCoordArray[pos + 10] = u2;
+				m_fTexCoordArray[pos + 11] = v2;
+			}
 	}
 
 private:
 	void GameThread()
 	{
+#ifndef OLC_HEADLESS
 		wglMakeCurrent(m_hDevCtx, m_hRenCtx);
+#endif
 
 		// Create user resources as part of this thread
 		if (!OnUserCreate())
@@ -1444,12 +2428,10 @@ private:
 		if (m_bEnableSound)
 		{
 			if (!CreateAudio())
-			{
-				m_bAtomActive = false; // Failed to create audio system			
-				m_bEnableSound = false;
-			}
+				m_bEnableSound = false; // No audio device: the game carries on silently
 		}
 
+#ifndef OLC_HEADLESS
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glEnableClientState(GL_COLOR_ARRAY);
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -1461,6 +2443,9 @@ private:
 		QueryPerformanceFrequency(&timeFreq);
 		QueryPerformanceCounter(&timeOld);
 		QueryPerformanceCounter(&timeNew);
+#else
+		auto timeOld = chrono::steady_clock::now();
+#endif
 
 		int nFrameCounter = 0;
 		float fFrameTimeAccum = 0;
@@ -1470,39 +2455,37 @@ private:
 			// Run as fast as possible
 			while (m_bAtomActive)
 			{
-				QueryPerformanceCounter(&timeNew);
-				float fElapsedTime = (float)((timeNew.QuadPart - timeOld.QuadPart) / (double)timeFreq.QuadPart);
+#ifdef OLC_HEADLESS
+				auto timeNew = chrono::steady_clock::now();
+				float fElapsedTime = chrono::duration<float>(timeNew - timeOld).count();
 				timeOld = timeNew;
 
-				for (int i = 0; i < 256; i++)
-				{
-					m_keyNewState[i] = GetAsyncKeyState(i) >> 15;
+				// No window: input only comes from an input source, if there is one
+				ProcessInputEvents();
 
-					m_keys[i].bPressed = false;
-					m_keys[i].bReleased = false;
+				// Run the frame and keep the screen arrays up to date
+				if (!OnUserUpdate(fElapsedTime))
+				{
+					m_bAtomActive = false;
+					break;
+				}
 
-					if (m_keyNewState[i] != m_keyOldState[i])
-					{
-						if (m_keyNewState[i])
-						{
-							m_keys[i].bPressed = true;
-							m_keys[i].bHeld = true;
-						}
-						else
-						{
-							m_keys[i].bReleased = true;
-							m_keys[i].bHeld = false;
-						}
-					}
+				UpdateScreenArrays();
 
-					m_keyOldState[i] = m_keyNewState[i];
+				if (m_bEnableSound)
+				{
+					if (m_pAudioBackend->IsRealTime())
+						UpdateAudioStreams();
+					else
+						PumpAudio(fElapsedTime);
 				}
+#else
+				QueryPerformanceCounter(&timeNew);
+				float fElapsedTime = (float)((timeNew.QuadPart - timeOld.QuadPart) / (double)timeFreq.QuadPart);
+				timeOld = timeNew;
 
-				m_mouse[0x00] = m_keys[VK_LBUTTON];
-				m_mouse[0x01] = m_keys[VK_RBUTTON];
-				m_mouse[0x02] = m_keys[VK_MBUTTON];
-				m_mouse[0x03] = m_keys[0x05]; // VK_XBUTTON1
-				m_mouse[0x04] = m_keys[0x06]; // VK_XBUTTON2
+				// Apply the key and mouse events the window queued since last frame
+				ProcessInputEvents();
 
 				if (m_keys[VK_MENU].bHeld && m_keys[VK_RETURN].bPressed)
 				{
@@ -1524,78 +2507,20 @@ private:
 					break;
 				}
 
+				if (m_bEnableSound)
+				{
+					if (m_pAudioBackend->IsRealTime())
+						UpdateAudioStreams();
+					else
+						PumpAudio(fElapsedTime);
+				}
+
 				// draw the things
 				glPushMatrix();
 				glTranslatef(m_fDrawOffsetX, m_fDrawOffsetY, 0.0f);
 				glScalef(m_fDrawScale * m_nFontWidth, m_fDrawScale * m_nFontHeight, 1.0f);
 
-				for (int y = 0; y < m_nScreenHeight; y++)
-					for (int x = 0; x < m_nScreenWidth; x++)
-					{
-						int pos = y * m_nScreenWidth + x;
-
-						if ((m_bufScreen[pos].Char.UnicodeChar == m_bufScreen_old[pos].Char.UnicodeChar) &&
-							(m_bufScreen[pos].Attributes == m_bufScreen_old[pos].Attributes))
-							continue;
-
-						m_bufScreen_old[pos] = m_bufScreen[pos];
-
-						WCHAR id = m_bufScreen[pos].Char.UnicodeChar;
-						WORD col = m_bufScreen[pos].Attributes;
-
-						int u, v;
-						float u1, v1, u2, v2;
-						uint32_t fg, bg;
-
-						if (id == L' ')
-						{
-							u1 = u2 = v1 = v2 = 0.0f;
-							fg = bg = 0;
-						}
-						else
-						{
-							GetFontCoords(id, &u, &v);
-
-							u1 = (u) / 256.0f;
-							v1 = (v) / 256.0f;
-							u2 = (u + 8) / 256.0f;
-							v2 = (v + 8) / 256.0f;
-
-							fg = m_ColourPalette[col & 0xF];
-							bg = m_ColourPalette[(col >> 4) & 0xF];
-						}
-
-						pos *= 6;
-
-						m_uForegroundColorArray[pos + 0] = fg;
-						m_uForegroundColorArray[pos + 1] = fg;
-						m_uForegroundColorArray[pos + 2] = fg;
-						m_uForegroundColorArray[pos + 3] = fg;
-						m_uForegroundColorArray[pos + 4] = fg;
-						m_uForegroundColorArray[pos + 5] = fg;
-
-						m_uBackgroundColorArray[pos + 0] = bg;
-						m_uBackgroundColorArray[pos + 1] = bg;
-						m_uBackgroundColorArray[pos + 2] = bg;
-						m_uBackgroundColorArray[pos + 3] = bg;
-						m_uBackgroundColorArray[pos + 4] = bg;
-						m_uBackgroundColorArray[pos + 5] = bg;
-
-						pos *= 2;
-
-						m_fTexCoordArray[pos + 0] = u1;
-						m_fTexCoordArray[pos + 1] = v1;
-						m_fTexCoordArray[pos + 2] = u2;
-						m_fTexCoordArray[pos + 3] = v1;
-						m_fTexCoordArray[pos + 4] = u1;
-						m_fTexCoordArray[pos + 5] = v2;
-						m_fTexCoordArray[pos + 6] = u2;
-						m_fTexCoordArray[pos + 7] = v1;
-						m_fTexCoordArray[pos + 8] = u1;
-						m_fTexCoordArray[pos + 9] = v2;
-						m_fTexCoordArray[pos + 10] = u2;
-						m_fTexCoordArray[pos + 11] = v2;
-					}
+				UpdateScreenArrays();
 
 				glColorPointer(4, GL_UNSIGNED_BYTE, 0, m_uBackgroundColorArray);
 				glDrawArrays(GL_TRIANGLES, 0, m_nScreenWidth * m_nScreenHeight * 6);
@@ -1618,11 +2543,13 @@ private:
 				SetWindowText(m_hWnd, sNewTitle);
 
 				SwapBuffers(m_hDevCtx);
+#endif
 			}
 
 			if (m_bEnableSound)
 			{
 				// Close and Clean up audio system
+				DestroyAudio();
 			}
 
 			if (OnUserDestroy())
@@ -1637,7 +2564,9 @@ private:
 			}
 		}
 
+#ifndef OLC_HEADLESS
 		PostMessage(m_hWnd, WM_DESTROY, 0, 0);
+#endif
 	}
 
 public:
@@ -1676,16 +2605,50 @@ public:
 protected:
 	int Error(const wchar_t *msg)
 	{
+#ifndef OLC_HEADLESS
 		wchar_t buff1[256];
 		wchar_t buff2[256];
 		FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), 0, buff1, 256, NULL);
 		wsprintf(buff2, L"%s\n\n%s", msg, buff1);
 		MessageBox(NULL, buff2, L"ERROR", MB_ICONERROR | MB_OK);
+#else
+		fwprintf(stderr, L"ERROR: %ls\n", msg);
+#endif
 		return 0;
 	}
 
 	protected: // Audio Engine =====================================================================
 
+		// The part of a streamed sample that lives on while it plays: the open
+		// file, and a ring of frames decoded ahead by the game thread for the
+		// audio thread (one writer, one reader, no lock)
+		struct sAudioStream
+		{
+			FILE *f = nullptr;
+			long nDataStart = 0;
+			long nFileFrames = 0;
+			long nFramesRead = 0;
+			int nBitsPerSample = 16;
+			bool bLoop = false;
+			bool bInputDone = false;
+			olcAudioResampler resampler;
+
+			std::vector<float> vecRing;
+			long nRingFrames = 0;
+			std::atomic<long long> nWritten = 0;
+			std::atomic<long long> nRead = 0;
+			std::atomic<bool> bEnded = false;   // Nothing left to write, once the ring is read
+
+			std::vector<float> vecPending;      // Resampled, waiting for room in the ring
+			size_t nPendingPos = 0;
+
+			~sAudioStream()
+			{
+				if (f != nullptr)
+					std::fclose(f);
+			}
+		};
+
 		class olcAudioSample
 		{
 		public:
@@ -1694,77 +2657,161 @@ protected:
 
 			}
 
-			olcAudioSample(std::wstring sWavFile)
+			// Loads a PCM .wav file (8 or 16-bit, any rate, any number of channels)
+			// and converts it once to float samples at nDeviceRate. With bStream,
+			// only the header is read now: the samples are decoded a little ahead
+			// of playback, so long tracks never sit fully decoded in memory.
+			olcAudioSample(std::wstring sWavFile, unsigned int nDeviceRate = 44100, bool bStream = false, bool bLoop = false)
 			{
-				// Load Wav file and convert to float format
 				FILE *f = nullptr;
 				_wfopen_s(&f, sWavFile.c_str(), L"rb");
 				if (f == nullptr)
 					return;
 
-				char dump[4];
-				std::fread(&dump, sizeof(char), 4, f); // Read "RIFF"
-				if (strncmp(dump, "RIFF", 4) != 0) return;
-				std::fread(&dump, sizeof(char), 4, f); // Not Interested
-				std::fread(&dump, sizeof(char), 4, f); // Read "WAVE"
-				if (strncmp(dump, "WAVE", 4) != 0) return;
-
-				// Read Wave description chunk
-				std::fread(&dump, sizeof(char), 4, f); // Read "fmt "
-				std::fread(&dump, sizeof(char), 4, f); // Not Interested
-				std::fread(&wavHeader, sizeof(WAVEFORMATEX) - 2, 1, f); // Read Wave Format Structure chunk
-																		// Note the -2, because the structure has 2 bytes to indicate its own size
-																		// which are not in the wav file
-
-																		// Just check if wave format is compatible with olcCGE
-				if (wavHeader.wBitsPerSample != 16 || wavHeader.nSamplesPerSec != 44100)
+				uint32_t nDataSize = 0;
+				if (!ReadHeader(f, nDataSize))
 				{
 					std::fclose(f);
 					return;
 				}
 
-				// Search for audio data chunk
-				long nChunksize = 0;
-				std::fread(&dump, sizeof(char), 4, f); // Read chunk header
-				std::fread(&nChunksize, sizeof(long), 1, f); // Read chunk size
-				while (strncmp(dump, "data", 4) != 0)
+				nChannels = wavHeader.nChannels;
+				int nBytesPerFrame = nChannels * (wavHeader.wBitsPerSample >> 3);
+				long nFileFrames = (long)(nDataSize / nBytesPerFrame);
+
+				if (bStream)
 				{
-					// Not audio data, so just skip it
-					std::fseek(f, nChunksize, SEEK_CUR);
-					std::fread(&dump, sizeof(char), 4, f);
-					std::fread(&nChunksize, sizeof(long), 1, f);
+					pStream = std::make_shared<sAudioStream>();
+					pStream->f = f;
+					pStream->nDataStart = std::ftell(f);
+					pStream->nFileFrames = nFileFrames;
+					pStream->nBitsPerSample = wavHeader.wBitsPerSample;
+					pStream->bLoop = bLoop;
+					pStream->resampler = olcAudioResampler(wavHeader.nSamplesPerSec, nDeviceRate, nChannels);
+					pStream->nRingFrames = nDeviceRate; // One second ahead
+					pStream->vecRing.resize(pStream->nRingFrames * nChannels);
+					bSampleValid = true;
+					return;
 				}
 
-				// Finally got to data, so read it all in and convert to float samples
-				nSamples = nChunksize / (wavHeader.nChannels * (wavHeader.wBitsPerSample >> 3));
-				nChannels = wavHeader.nChannels;
+				// Read the whole data chunk at once...
+				std::vector<uint8_t> vecRaw((size_t)nFileFrames * nBytesPerFrame);
+				nFileFrames = (long)std::fread(vecRaw.data(), nBytesPerFrame, nFileFrames, f);
+				std::fclose(f);
 
-				// Create floating point buffer to hold audio sample
-				fSample = new float[nSamples * nChannels];
-				float *pSample = fSample;
+				// ...convert it...
+				std::vector<float> vecFloat((size_t)nFileFrames * nChannels);
+				ConvertPCM(vecRaw.data(), vecFloat.data(), (long)vecFloat.size(), wavHeader.wBitsPerSample);
 
-				// Read in audio data and normalise
-				for (long i = 0; i < nSamples; i++)
+				// ...and bring it to the device rate
+				std::vector<float> vecOut;
+				olcAudioResampler resampler(wavHeader.nSamplesPerSec, nDeviceRate, nChannels);
+				if (resampler.IsPassThrough())
+					vecOut.swap(vecFloat);
+				else
 				{
-					for (int c = 0; c < nChannels; c++)
-					{
-						short s = 0;
-						std::fread(&s, sizeof(short), 1, f);
-						*pSample = (float)s / (float)(MAXSHORT);
-						pSample++;
-					}
+					vecOut.reserve((size_t)((double)vecFloat.size() * nDeviceRate / wavHeader.nSamplesPerSec) + nChannels);
+					resampler.Process(vecFloat.data(), nFileFrames, vecOut);
+					resampler.Flush(vecOut);
 				}
 
+				nSamples = (long)(vecOut.size() / nChannels);
+				fSample = new float[nSamples * nChannels];
+				memcpy(fSample, vecOut.data(), sizeof(float) * nSamples * nChannels);
+
 				// All done, flag sound as valid
-				std::fclose(f);
 				bSampleValid = true;
 			}
 
+			// Decodes the next nFrames frames of a stream into vecOut, at the file's rate
+			static long ReadFrames(sAudioStream &s, int nChannels, long nFrames, std::vector<float> &vecOut)
+			{
+				int nBytesPerFrame = nChannels * (s.nBitsPerSample >> 3);
+				std::vector<uint8_t> vecRaw((size_t)nFrames * nBytesPerFrame);
+				nFrames = (long)std::fread(vecRaw.data(), nBytesPerFrame, nFrames, s.f);
+				vecOut.resize((size_t)nFrames * nChannels);
+				ConvertPCM(vecRaw.data(), vecOut.data(), nFrames * nChannels, s.nBitsPerSample);
+				s.nFramesRead += nFrames;
+				return nFrames;
+			}
+
+			// Integer PCM to float in -1..1
+			static void ConvertPCM(const uint8_t *pRaw, float *pOut, long n, int nBitsPerSample)
+			{
+				long i = 0;
+				if (nBitsPerSample == 8)
+				{
+					for (; i < n; i++)
+						pOut[i] = ((float)pRaw[i] - 128.0f) / 128.0f;
+					return;
+				}
+
+				const int16_t *pSrc = (const int16_t*)pRaw;
+				const float fScale = 1.0f / (float)(MAXSHORT);
+#ifdef OLC_MIXER_SSE2
+				const __m128 vScale = _mm_set1_ps(fScale);
+				for (; i + 8 <= n; i += 8)
+				{
+					// Duplicate each 16-bit value into a 32-bit lane, then shift it back down with its sign
+					__m128i v = _mm_loadu_si128((const __m128i*)(pSrc + i));
+					__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+					__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+					_mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vScale));
+					_mm_storeu_ps(pOut + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vScale));
+				}
+#endif
+				for (; i < n; i++)
+					pOut[i] = (float)pSrc[i] * fScale;
+			}
+
 			WAVEFORMATEX wavHeader;
 			float *fSample = nullptr;
 			long nSamples = 0;
 			int nChannels = 0;
 			bool bSampleValid = false;
+			std::shared_ptr<sAudioStream> pStream;  // Set for streamed samples, which have no fSample
+
+		private:
+			// Walks the RIFF chunks up to "data", reading "fmt " on the way. Leaves
+			// the file at the first sample and returns the size of the data
+			bool ReadHeader(FILE *f, uint32_t &nDataSize)
+			{
+				char dump[4];
+				uint32_t nChunkSize = 0;
+				if (std::fread(dump, 1, 4, f) != 4 || strncmp(dump, "RIFF", 4) != 0) return false;
+				std::fread(&nChunkSize, sizeof(uint32_t), 1, f); // Not Interested
+				if (std::fread(dump, 1, 4, f) != 4 || strncmp(dump, "WAVE", 4) != 0) return false;
+
+				bool bFormat = false;
+				while (std::fread(dump, 1, 4, f) == 4 && std::fread(&nChunkSize, sizeof(uint32_t), 1, f) == 1)
+				{
+					if (strncmp(dump, "fmt ", 4) == 0)
+					{
+						// The file lacks the last 2 bytes of the structure (its own size)
+						if (nChunkSize < sizeof(WAVEFORMATEX) - 2)
+							return false;
+						std::fread(&wavHeader, sizeof(WAVEFORMATEX) - 2, 1, f);
+						wavHeader.cbSize = 0;
+						std::fseek(f, (long)(nChunkSize - (sizeof(WAVEFORMATEX) - 2) + (nChunkSize & 1)), SEEK_CUR);
+
+						// Integer PCM only (plain or "extensible"), 8 or 16 bits
+						bFormat = (wavHeader.wFormatTag == WAVE_FORMAT_PCM || wavHeader.wFormatTag == 0xFFFE) &&
+							(wavHeader.wBitsPerSample == 8 || wavHeader.wBitsPerSample == 16) &&
+							wavHeader.nChannels > 0 && wavHeader.nSamplesPerSec > 0;
+					}
+					else if (strncmp(dump, "data", 4) == 0)
+					{
+						nDataSize = nChunkSize;
+						return bFormat;
+					}
+					else
+					{
+						// Not audio data, so just skip it (chunks are padded to even sizes)
+						std::fseek(f, (long)(nChunkSize + (nChunkSize & 1)), SEEK_CUR);
+					}
+				}
+				return false;
+			}
 		};
 
 		// This vector holds all loaded sound samples in memory
@@ -1772,7 +2819,7 @@ protected:
 
 		// This structure represents a sound that is currently playing. It only
 		// holds the sound ID and where this instance of it is up to for its
-		// current playback
+		// current playback. A voice with nAudioSampleID 0 is free.
 		struct sCurrentlyPlayingSample
 		{
 			int nAudioSampleID = 0;
@@ -1780,18 +2827,107 @@ protected:
 			bool bFinished = false;
 			bool bLoop = false;
 		};
-		std::list<sCurrentlyPlayingSample> listActiveSamples;
 
-		// Load a 16-bit WAVE file @ 44100Hz ONLY into memory. A sample ID
-		// number is returned if successful, otherwise -1
+		// Fixed pool of voices, only ever touched by the audio thread
+		static const int nMaxVoices = 64;
+		sCurrentlyPlayingSample m_Voices[nMaxVoices];
+
+		// Requests from the game thread to the audio thread. This is a single
+		// producer / single consumer ring: the game thread only writes the head,
+		// the audio thread only writes the tail, so no lock is needed.
+		struct sAudioCommand
+		{
+			int nAudioSampleID = 0;
+			bool bLoop = false;
+			bool bStop = false;
+		};
+		static const unsigned int nAudioCommandQueueSize = 256; // Power of two
+		sAudioCommand m_AudioCommands[nAudioCommandQueueSize];
+		std::atomic<unsigned int> m_nAudioCommandHead = 0;
+		std::atomic<unsigned int> m_nAudioCommandTail = 0;
+
+		// Game thread side. Returns false (and drops the request) if the queue is full
+		bool PushAudioCommand(const sAudioCommand &cmd)
+		{
+			unsigned int nHead = m_nAudioCommandHead.load(std::memory_order_relaxed);
+			if (nHead - m_nAudioCommandTail.load(std::memory_order_acquire) == nAudioCommandQueueSize)
+				return false;
+			m_AudioCommands[nHead & (nAudioCommandQueueSize - 1)] = cmd;
+			m_nAudioCommandHead.store(nHead + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Drops every pending request and silences every voice. Only while no
+		// audio thread runs (CreateAudio, or a mixer driven by hand)
+		void ResetAudioVoices()
+		{
+			m_nAudioCommandHead.store(0, std::memory_order_relaxed);
+			m_nAudioCommandTail.store(0, std::memory_order_relaxed);
+			for (auto &v : m_Voices)
+				v = sCurrentlyPlayingSample();
+		}
+
+		// Audio thread side: applies every pending request to the voice pool
+		void ProcessAudioCommands()
+		{
+			unsigned int nTail = m_nAudioCommandTail.load(std::memory_order_relaxed);
+			unsigned int nHead = m_nAudioCommandHead.load(std::memory_order_acquire);
+			for (; nTail != nHead; nTail++)
+			{
+				const sAudioCommand &cmd = m_AudioCommands[nTail & (nAudioCommandQueueSize - 1)];
+				if (cmd.bStop)
+				{
+					for (auto &v : m_Voices)
+						if (v.nAudioSampleID == cmd.nAudioSampleID)
+							v.nAudioSampleID = 0;
+				}
+				else
+				{
+					// Take the first free voice. When all are busy the sound is dropped
+					for (auto &v : m_Voices)
+						if (v.nAudioSampleID == 0)
+						{
+							v.nAudioSampleID = cmd.nAudioSampleID;
+							v.nSamplePosition = 0;
+							v.bFinished = false;
+							v.bLoop = cmd.bLoop;
+							break;
+						}
+				}
+			}
+			m_nAudioCommandTail.store(nTail, std::memory_order_release);
+		}
+
+		// Load an 8 or 16-bit PCM WAVE file into memory, at the device rate
+		// (CreateAudio's, 44100Hz by default). A sample ID number is returned
+		// if successful, otherwise -1
 		unsigned int LoadAudioSample(std::wstring sWavFile)
 		{
 			if (!m_bEnableSound)
 				return -1;
 
-			olcAudioSample a(sWavFile);
+			olcAudioSample a(sWavFile, m_nSampleRate);
+			if (a.bSampleValid)
+			{
+				vecAudioSamples.push_back(a);
+				return vecAudioSamples.size();
+			}
+			else
+				return -1;
+		}
+
+		// Same, for long tracks such as music: the file stays open and is
+		// decoded about a second ahead of playback by the game thread. A
+		// stream has a single play position, so it plays on one voice only
+		unsigned int LoadAudioStream(std::wstring sWavFile, bool bLoop = false)
+		{
+			if (!m_bEnableSound)
+				return -1;
+
+			olcAudioSample a(sWavFile, m_nSampleRate, true, bLoop);
 			if (a.bSampleValid)
 			{
+				FillAudioStream(*a.pStream, a.nChannels);
 				vecAudioSamples.push_back(a);
 				return vecAudioSamples.size();
 			}
@@ -1799,20 +2935,119 @@ protected:
 				return -1;
 		}
 
+		// Game thread side of a stream: tops its ring up with decoded frames
+		void FillAudioStream(sAudioStream &s, int nChannels)
+		{
+			std::vector<float> vecDecoded;
+			while (true)
+			{
+				// Hand over what is already resampled, as far as the ring has room
+				long long nFree = s.nRingFrames - (s.nWritten.load(std::memory_order_relaxed) - s.nRead.load(std::memory_order_acquire));
+				long long nPending = (long long)(s.vecPending.size() - s.nPendingPos) / nChannels;
+				long long nCopy = nPending < nFree ? nPending : nFree;
+				long long nWritten = s.nWritten.load(std::memory_order_relaxed);
+				for (long long i = 0; i < nCopy; i++)
+				{
+					long nSlot = (long)((nWritten + i) % s.nRingFrames);
+					for (int c = 0; c < nChannels; c++)
+						s.vecRing[nSlot * nChannels + c] = s.vecPending[s.nPendingPos + i * nChannels + c];
+				}
+				s.nPendingPos += (size_t)(nCopy * nChannels);
+				s.nWritten.store(nWritten + nCopy, std::memory_order_release);
+
+				if (nCopy < nPending)
+					return; // Ring is full
+
+				s.vecPending.clear();
+				s.nPendingPos = 0;
+				if (s.bInputDone)
+				{
+					s.bEnded = true;
+					return;
+				}
+
+				// Decode and resample the next chunk of the file
+				long nChunk = s.nFileFrames - s.nFramesRead;
+				if (nChunk > 4096) nChunk = 4096;
+				if (nChunk > 0)
+					nChunk = olcAudioSample::ReadFrames(s, nChannels, nChunk, vecDecoded);
+
+				if (nChunk > 0)
+					s.resampler.Process(vecDecoded.data(), nChunk, s.vecPending);
+				else if (s.bLoop && s.nFileFrames > 0)
+				{
+					std::fseek(s.f, s.nDataStart, SEEK_SET);
+					s.nFramesRead = 0;
+				}
+				else
+				{
+					s.resampler.Flush(s.vecPending);
+					s.bInputDone = true;
+				}
+			}
+		}
+
+		// Keeps every stream a second ahead. Called by the game loop each frame
+		void UpdateAudioStreams()
+		{
+			for (auto &a : vecAudioSamples)
+				if (a.pStream)
+					FillAudioStream(*a.pStream, a.nChannels);
+		}
+
+		// Add a sound generated by the program itself: 44100Hz, interleaved if
+		// it has several channels, values in -1..1. Like LoadAudioSample, it is
+		// brought to the device rate. Returns its sample ID
+		unsigned int AddAudioSample(const std::vector<float> &vecSamples, int nChannels = 1)
+		{
+			long nFrames = (long)vecSamples.size() / nChannels;
+			std::vector<float> vecOut;
+			olcAudioResampler resampler(44100, m_nSampleRate, nChannels);
+			if (resampler.IsPassThrough())
+				vecOut.assign(vecSamples.begin(), vecSamples.begin() + nFrames * nChannels);
+			else
+			{
+				resampler.Process(vecSamples.data(), nFrames, vecOut);
+				resampler.Flush(vecOut);
+			}
+
+			olcAudioSample a;
+			a.wavHeader.wFormatTag = WAVE_FORMAT_PCM;
+			a.wavHeader.nChannels = nChannels;
+			a.wavHeader.nSamplesPerSec = m_nSampleRate;
+			a.wavHeader.wBitsPerSample = 16;
+			a.nChannels = nChannels;
+			a.nSamples = (long)vecOut.size() / nChannels;
+			a.fSample = new float[a.nSamples * nChannels];
+			memcpy(a.fSample, vecOut.data(), sizeof(float) * a.nSamples * nChannels);
+			a.bSampleValid = true;
+			vecAudioSamples.push_back(a);
+			return vecAudioSamples.size();
+		}
+
 		// Add sample 'id' to the mixers sounds to play list
 		void PlaySample(int id, bool bLoop = false)
 		{
-			sCurrentlyPlayingSample a;
+			// Without sound nothing would drain the requests
+			if (!m_bEnableSound || id <= 0)
+				return;
+
+			sAudioCommand a;
 			a.nAudioSampleID = id;
-			a.nSamplePosition = 0;
-			a.bFinished = false;
 			a.bLoop = bLoop;
-			listActiveSamples.push_back(a);
+			PushAudioCommand(a);
 		}
 
+		// Stop every playing instance of sample 'id'
 		void StopSample(int id)
 		{
+			if (!m_bEnableSound)
+				return;
 
+			sAudioCommand a;
+			a.nAudioSampleID = id;
+			a.bStop = true;
+			PushAudioCommand(a);
 		}
 
 		// The audio system uses by default a specific wave format
@@ -1825,49 +3060,35 @@ protected:
 			m_nChannels = nChannels;
 			m_nBlockCount = nBlocks;
 			m_nBlockSamples = nBlockSamples;
-			m_nBlockFree = m_nBlockCount;
-			m_nBlockCurrent = 0;
-			m_pBlockMemory = nullptr;
-			m_pWaveHeaders = nullptr;
-
-			// Device is available
-			WAVEFORMATEX waveFormat;
-			waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-			waveFormat.nSamplesPerSec = m_nSampleRate;
-			waveFormat.wBitsPerSample = sizeof(short) * 8;
-			waveFormat.nChannels = m_nChannels;
-			waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
-			waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-			waveFormat.cbSize = 0;
-
-			// Open Device if valid
-			if (waveOutOpen(&m_hwDevice, WAVE_MAPPER, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
-				return DestroyAudio();
+			m_fGlobalTime = 0.0f;
+			m_fAudioTimeToRender = 0.0f;
+			ResetAudioVoices();
 
-			// Allocate Wave|Block Memory
-			m_pBlockMemory = new short[m_nBlockCount * m_nBlockSamples];
-			if (m_pBlockMemory == nullptr)
-				return DestroyAudio();
-			ZeroMemory(m_pBlockMemory, sizeof(short) * m_nBlockCount * m_nBlockSamples);
+			if (!m_pAudioBackend)
+			{
+#ifndef OLC_HEADLESS
+				m_pAudioBackend.reset(new olcAudioBackendWaveOut());
+#elif defined(OLC_AUDIO_ALSA)
+				m_pAudioBackend.reset(new olcAudioBackendALSA());
+#else
+				m_pAudioBackend.reset(new olcAudioBackendNull());
+#endif
+			}
 
-			m_pWaveHeaders = new WAVEHDR[m_nBlockCount];
-			if (m_pWaveHeaders == nullptr)
+			if (!m_pAudioBackend->Open(m_nSampleRate, m_nChannels, m_nBlockCount, m_nBlockSamples))
 				return DestroyAudio();
-			ZeroMemory(m_pWaveHeaders, sizeof(WAVEHDR) * m_nBlockCount);
 
-			// Link headers to block memory
-			for (unsigned int n = 0; n < m_nBlockCount; n++)
+			m_pBlockMemory = new short[m_nBlockSamples];
+			m_pMixBuffer = new float[m_nBlockSamples];
+
+			// Real time devices pull blocks from their own thread, the others are
+			// pumped by the game loop (see PumpAudio). Streams are refilled by
+			// the game loop in both cases
+			if (m_pAudioBackend->IsRealTime())
 			{
-				m_pWaveHeaders[n].dwBufferLength = m_nBlockSamples * sizeof(short);
-				m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nBlockSamples));
+				m_bAudioThreadActive = true;
+				m_AudioThread = std::thread(&olcConsoleGameEngine::AudioThread, this);
 			}
-
-			m_bAudioThreadActive = true;
-			m_AudioThread = std::thread(&olcConsoleGameEngine::AudioThread, this);
-
-			// Start the ball rolling with the sound delivery thread
-			std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-			m_cvBlockNotZero.notify_one();
 			return true;
 		}
 
@@ -1875,84 +3096,68 @@ protected:
 		bool DestroyAudio()
 		{
 			m_bAudioThreadActive = false;
-			return false;
-		}
-
-		// Handler for soundcard request for more data
-		void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
-		{
-			if (uMsg != WOM_DONE) return;
-			m_nBlockFree++;
-			std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-			m_cvBlockNotZero.notify_one();
-		}
+			if (m_AudioThread.joinable())
+				m_AudioThread.join();
+			if (m_pAudioBackend)
+				m_pAudioBackend->Close();
 
-		// Static wrapper for sound card handler
-		static void CALLBACK waveOutProcWrap(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2)
-		{
-			((olcConsoleGameEngine*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
+			delete[] m_pBlockMemory;
+			delete[] m_pMixBuffer;
+			m_pBlockMemory = nullptr;
+			m_pMixBuffer = nullptr;
+			return false;
 		}
 
-		// Audio thread. This loop responds to requests from the soundcard to fill 'blocks'
-		// with audio data. If no requests are available it goes dormant until the sound
-		// card is ready for more data. The block is fille by the "user" in some manner
-		// and then issued to the soundcard.
-		void AudioThread()
+		// Mixes the next block and converts it to 16-bit samples in m_pBlockMemory
+		void RenderAudioBlock()
 		{
-			m_fGlobalTime = 0.0f;
 			float fTimeStep = 1.0f / (float)m_nSampleRate;
 
 			// Goofy hack to get maximum integer for a type at run-time
 			short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
 			float fMaxSample = (float)nMaxSample;
-			short nPreviousSample = 0;
 
-			while (m_bAudioThreadActive)
+			auto clip = [](float fSample, float fMax)
 			{
-				// Wait for block to become available
-				if (m_nBlockFree == 0)
-				{
-					std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-					while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
-						m_cvBlockNotZero.wait(lm);
-				}
-
-				// Block is here, so use it
-				m_nBlockFree--;
-
-				// Prepare block for processing
-				if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
-					waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+				if (fSample >= 0.0)
+					return fmin(fSample, fMax);
+				else
+					return fmax(fSample, -fMax);
+			};
 
-				short nNewSample = 0;
-				int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
+			// Mix the whole block at once, then convert it
+			unsigned int nFrames = m_nBlockSamples / m_nChannels;
+			MixBlock(m_pMixBuffer, nFrames, m_fGlobalTime, fTimeStep);
 
-				auto clip = [](float fSample, float fMax)
-				{
-					if (fSample >= 0.0)
-						return fmin(fSample, fMax);
-					else
-						return fmax(fSample, -fMax);
-				};
+			for (unsigned int n = 0; n < m_nBlockSamples; n++)
+				m_pBlockMemory[n] = (short)(clip(m_pMixBuffer[n], 1.0) * fMaxSample);
 
-				for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-				{
-					// User Process
-					for (unsigned int c = 0; c < m_nChannels; c++)
-					{
-						nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime, fTimeStep), 1.0) * fMaxSample);
-						m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-						nPreviousSample = nNewSample;
-					}
+			m_fGlobalTime = m_fGlobalTime + fTimeStep * (float)nFrames;
+		}
 
-					m_fGlobalTime = m_fGlobalTime + fTimeStep;
-				}
+		// Audio thread. The backend blocks in Write() until the soundcard is ready
+		// for more data, so this loop simply mixes and hands over block after block.
+		void AudioThread()
+		{
+			while (m_bAudioThreadActive)
+			{
+				RenderAudioBlock();
+				m_pAudioBackend->Write(m_pBlockMemory, m_nBlockSamples);
+			}
+		}
 
-				// Send block to sound device
-				waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-				waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-				m_nBlockCurrent++;
-				m_nBlockCurrent %= m_nBlockCount;
+		// Non real time backends: renders as many blocks as fElapsedTime of game
+		// time covers, so a recording follows the game whatever its frame rate
+		void PumpAudio(float fElapsedTime)
+		{
+			float fBlockTime = (float)(m_nBlockSamples / m_nChannels) / (float)m_nSampleRate;
+			m_fAudioTimeToRender += fElapsedTime;
+			while (m_fAudioTimeToRender >= fBlockTime)
+			{
+				UpdateAudioStreams();
+				RenderAudioBlock();
+				m_pAudioBackend->Write(m_pBlockMemory, m_nBlockSamples);
+				m_fAudioTimeToRender -= fBlockTime;
 			}
 		}
 
@@ -1971,11 +3176,14 @@ protected:
 		// The Sound Mixer - If the user wants to play many sounds simultaneously, and
 		// perhaps the same sound overlapping itself, then you need a mixer, which
 		// takes input from all sound sources for that audio frame. This mixer maintains
-		// a list of sound locations for all concurrently playing audio samples. Instead
+		// a pool of voices for all concurrently playing audio samples. Instead
 		// of duplicating audio data, we simply store the fact that a sound sample is in
 		// use and an offset into its sample data. As time progresses we update this offset
 		// until it is beyound the length of the sound sample it is attached to. At this
-		// point we remove the playing souind from the list.
+		// point the voice is freed.
+		//
+		// The mixer renders a whole block of nFrames interleaved frames per call, so each
+		// voice is a straight run of additions rather than a lookup per sample.
 		//
 		// Additionally, the users application may want to generate sound instead of just
 		// playing audio clips (think a synthesizer for example) in whcih case we also
@@ -1985,48 +3193,131 @@ protected:
 		// Finally, before the sound is issued to the operating system for performing, the
 		// user gets one final chance to "filter" the sound, perhaps changing the volume
 		// or adding funky effects
-		float GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep)
+		void MixBlock(float *pOut, unsigned int nFrames, float fGlobalTime, float fTimeStep)
 		{
-			// Accumulate sample for this channel
-			float fMixerSample = 0.0f;
+			ProcessAudioCommands();
 
-			for (auto &s : listActiveSamples)
+			int nOutChannels = (int)m_nChannels;
+			long nOutSamples = (long)nFrames * nOutChannels;
+			memset(pOut, 0, sizeof(float) * nOutSamples);
+
+			for (auto &v : m_Voices)
 			{
-				// Calculate sample position
-				s.nSamplePosition += (long)((float)vecAudioSamples[s.nAudioSampleID - 1].wavHeader.nSamplesPerSec * fTimeStep);
+				if (v.nAudioSampleID == 0)
+					continue;
 
-				// If sample position is valid add to the mix
-				if (s.nSamplePosition < vecAudioSamples[s.nAudioSampleID - 1].nSamples)
-					fMixerSample += vecAudioSamples[s.nAudioSampleID - 1].fSample[(s.nSamplePosition * vecAudioSamples[s.nAudioSampleID - 1].nChannels) + nChannel];
-				else
-					s.bFinished = true; // Else sound has completed
+				const olcAudioSample &a = vecAudioSamples[v.nAudioSampleID - 1];
+				if (a.pStream)
+				{
+					MixStream(v, *a.pStream, a.nChannels, pOut, nFrames);
+					continue;
+				}
+
+				long nFrame = 0;
+				while (nFrame < (long)nFrames)
+				{
+					if (v.nSamplePosition >= a.nSamples)
+					{
+						if (v.bLoop && a.nSamples > 0)
+							v.nSamplePosition = 0;
+						else
+						{
+							v.bFinished = true; // Sound has completed, free the voice
+							v.nAudioSampleID = 0;
+							break;
+						}
+					}
+
+					long nRun = a.nSamples - v.nSamplePosition;
+					if (nRun > (long)nFrames - nFrame)
+						nRun = (long)nFrames - nFrame;
+
+					MixFrames(pOut + nFrame * nOutChannels, a.fSample + v.nSamplePosition * a.nChannels, nRun, a.nChannels);
+
+					v.nSamplePosition += nRun;
+					nFrame += nRun;
+				}
+			}
+
+			// The users application might be generating sound, and may want to filter the result
+			for (unsigned int n = 0; n < nFrames; n++)
+			{
+				for (int c = 0; c < nOutChannels; c++)
+				{
+					float &fMixerSample = pOut[n * nOutChannels + c];
+					fMixerSample += onUserSoundSample(c, fGlobalTime, fTimeStep);
+					fMixerSample = onUserSoundFilter(c, fGlobalTime, fMixerSample);
+				}
+				fGlobalTime += fTimeStep;
+			}
+		}
+
+		// Adds nRun frames of a sample with nSrcChannels channels to the output frames
+		void MixFrames(float *pDst, const float *pSrc, long nRun, int nSrcChannels)
+		{
+			int nOutChannels = (int)m_nChannels;
+			if (nSrcChannels == nOutChannels)
+				MixAccumulate(pDst, pSrc, nRun * nOutChannels);
+			else
+			{
+				for (long i = 0; i < nRun; i++)
+					for (int c = 0; c < nOutChannels; c++)
+						pDst[i * nOutChannels + c] += pSrc[i * nSrcChannels + (c % nSrcChannels)];
 			}
+		}
+
+		// Audio thread side of a stream: mixes what the ring holds. Running dry
+		// before the end only leaves a gap; the voice is freed once it has ended
+		void MixStream(sCurrentlyPlayingSample &v, sAudioStream &s, int nSrcChannels, float *pOut, unsigned int nFrames)
+		{
+			long long nRead = s.nRead.load(std::memory_order_relaxed);
+			bool bEnded = s.bEnded.load(std::memory_order_acquire);
+			long long nAvailable = s.nWritten.load(std::memory_order_acquire) - nRead;
+			long long nRun = nAvailable < (long long)nFrames ? nAvailable : (long long)nFrames;
 
-			// If sounds have completed then remove them
-			listActiveSamples.remove_if([](const sCurrentlyPlayingSample &s) {return s.bFinished; });
+			long nFrame = 0;
+			while (nFrame < nRun)
+			{
+				// Up to the end of the ring, then from its start
+				long nSlot = (long)((nRead + nFrame) % s.nRingFrames);
+				long nPart = s.nRingFrames - nSlot;
+				if (nPart > nRun - nFrame) nPart = (long)(nRun - nFrame);
+				MixFrames(pOut + nFrame * m_nChannels, &s.vecRing[nSlot * nSrcChannels], nPart, nSrcChannels);
+				nFrame += nPart;
+			}
+			s.nRead.store(nRead + nRun, std::memory_order_release);
 
-			// The users application might be generating sound, so grab that if it exists
-			fMixerSample += onUserSoundSample(nChannel, fGlobalTime, fTimeStep);
+			if (bEnded && nRun == nAvailable)
+			{
+				v.bFinished = true;
+				v.nAudioSampleID = 0;
+			}
+		}
 
-			// Return the sample via an optional user override to filter the sound
-			return onUserSoundFilter(nChannel, fGlobalTime, fMixerSample);
+		// pDst[i] += pSrc[i]
+		static void MixAccumulate(float *pDst, const float *pSrc, long n)
+		{
+			long i = 0;
+#ifdef OLC_MIXER_SSE
+			for (; i + 4 <= n; i += 4)
+				_mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pDst + i), _mm_loadu_ps(pSrc + i)));
+#endif
+			for (; i < n; i++)
+				pDst[i] += pSrc[i];
 		}
 
 		unsigned int m_nSampleRate;
 		unsigned int m_nChannels;
 		unsigned int m_nBlockCount;
 		unsigned int m_nBlockSamples;
-		unsigned int m_nBlockCurrent;
 
-		short* m_pBlockMemory = nullptr;
-		WAVEHDR *m_pWaveHeaders = nullptr;
-		HWAVEOUT m_hwDevice = nullptr;
+		short* m_pBlockMemory = nullptr;    // One block, converted for the backend
+		float* m_pMixBuffer = nullptr;      // One block, as mixed
+		std::unique_ptr<olcAudioBackend> m_pAudioBackend;
+		float m_fAudioTimeToRender = 0.0f;
 
 		std::thread m_AudioThread;
 		std::atomic<bool> m_bAudioThreadActive = false;
-		std::atomic<unsigned int> m_nBlockFree = 0;
-		std::condition_variable m_cvBlockNotZero;
-		std::mutex m_muxBlockNotZero;
 		std::atomic<float> m_fGlobalTime = 0.0f;
 		bool m_bEnableSound = false;
 
@@ -2046,21 +3337,32 @@ protected:
 	uint32_t *m_uBackgroundColorArray;
 	float *m_fTexCoordArray;
 	CHAR_INFO *m_bufScreen;
+	CHAR_INFO *m_bufScreenMain;		// The screen itself, whatever SetDrawTarget points m_bufScreen at
 	CHAR_INFO *m_bufScreen_old;
 	uint8_t *m_bufMemory;
 	wstring m_sAppName;
+#ifndef OLC_HEADLESS
 	SMALL_RECT m_rectWindow;
-	short m_keyOldState[256] = { 0 };
-	short m_keyNewState[256] = { 0 };
+#endif
+	// Input: queued by the window thread, applied by the game thread
+	std::mutex m_muxInput;
+	std::vector<olcInputEvent> m_vecInputQueue;
+	std::vector<olcInputEvent> m_vecInputEvents;
+	std::vector<uint8_t> m_vecKeysChanged;
+	olcInputSource *m_pInputSource = nullptr;
+	olcInputScript *m_pInputRecorder = nullptr;
+	uint32_t m_nInputFrame = 0;
 	bool m_mouseOldState[5] = { 0 };
 	bool m_mouseNewState[5] = { 0 };
 	bool m_bConsoleInFocus = true;
 	bool m_bDoWindowUpdate = false;
+#ifndef OLC_HEADLESS
 	HWND  m_hConsole = nullptr;
 	HWND  m_hWnd = nullptr;
 	HDC   m_hDevCtx = nullptr;
 	HGLRC m_hRenCtx = nullptr;
 	GLuint m_uFontTexture;
+#endif
 	static atomic<bool> m_bAtomActive;
 	static condition_variable m_cvGameFinished;
 	static mutex m_muxGame;